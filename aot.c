@@ -0,0 +1,326 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <math.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "aot.h"
+#include "cache.h"
+#include "compiler.h"
+
+// Ahead-of-time compilation: a chunk becomes a C function, the system
+// compiler builds it into a shared object, and clox calls it through
+// dlopen(). Built objects are kept in nativeCacheDir as
+//
+//   <hash>-<version>[f].c    the generated C, for reading
+//   <hash>-<version>[f].so   what gets loaded
+//
+// keyed by the source's FNV-1a hash, AOT_VERSION and whether it was
+// compiled with --fast-math. Each object carries the source it was
+// built from, which is checked once it's loaded, so that the check and
+// the code are the same file. A hash collision, or another process
+// replacing the object in between, costs a rebuild, never a wrong
+// result. Each file is written under a temporary name and renamed into
+// place, so processes sharing the directory never load half an object.
+
+#define NATIVE_PATH_MAX 4096
+
+extern char** environ;
+
+const char* nativeCacheDir = NULL;
+
+static int instructionLength(uint8_t instruction) {
+  switch (instruction) {
+    case OP_CONSTANT:
+    case OP_SMALL_INT:
+    case OP_ADD_CONSTANT:
+    case OP_SUBTRACT_CONSTANT:
+    case OP_MULTIPLY_CONSTANT:
+    case OP_DIVIDE_CONSTANT:
+    case OP_GET_TEMP:
+    case OP_RESULT:
+      return 2;
+    default:
+      return 1;
+  }
+}
+
+// How many values the instruction leaves on the stack, net.
+static int stackEffect(uint8_t instruction) {
+  switch (instruction) {
+    case OP_CONSTANT:
+    case OP_ZERO:
+    case OP_ONE:
+    case OP_SMALL_INT:
+    case OP_GET_TEMP:
+      return 1;
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_RETURN:
+      return -1;
+    case OP_MULTIPLY_ADD:
+    case OP_MULTIPLY_SUBTRACT:
+      return -2;
+    default:
+      return 0;
+  }
+}
+
+// Hex floats read back exactly. NaN and the infinities have no
+// literal, so they go through math.h.
+static void emitValue(FILE* out, Value value) {
+  fprintf(out, "literal(");
+  if (isnan(value)) {
+    fprintf(out, "%sNAN", signbit(value) ? "-" : "");
+  } else if (isinf(value)) {
+    fprintf(out, "%sINFINITY", value < 0 ? "-" : "");
+  } else {
+    fprintf(out, "%a", value);
+  }
+  fprintf(out, ")");
+}
+
+static void emitOperator(FILE* out, int slot, char op, Value* right) {
+  fprintf(out, "  s%d = s%d %c ", slot, slot, op);
+  if (right != NULL) {
+    emitValue(out, *right);
+  } else {
+    fprintf(out, "s%d", slot + 1);
+  }
+  fprintf(out, ";\n");
+}
+
+// Writes the expression at offset, up to its OP_RETURN, as a C
+// translation unit defining "double clox_expression(void)". Code is
+// straight-line, so the stack's depth is known at every instruction
+// and each slot becomes a local the C compiler can keep in a register.
+// CSE temporaries stay below the result, which is the top slot.
+// Returns false, having written nothing, if the code isn't one whole
+// expression, as in a --batch chunk.
+bool emitC(Chunk* chunk, int offset, FILE* out) {
+  int depth = 0;
+  int maxDepth = 0;
+  int end = offset;
+  for (;;) {
+    if (end >= chunk->count) return false;
+    uint8_t instruction = chunk->code[end];
+    if (instruction == OP_RESULT) return false;
+    depth += stackEffect(instruction);
+    if (depth < 0) return false;
+    if (depth > maxDepth) maxDepth = depth;
+    end += instructionLength(instruction);
+    if (instruction == OP_RETURN) break;
+  }
+
+  // Literals pass through a volatile so the C compiler can't fold
+  // them. Folded, 0 / 0 would be its NaN rather than the hardware's,
+  // which has the other sign on x86.
+  fprintf(out, "#include <math.h>\n\n"
+               "static double literal(double value) {\n"
+               "  volatile double opaque = value;\n"
+               "  return opaque;\n"
+               "}\n\n"
+               "double clox_expression(void) {\n");
+  fprintf(out, "  double s0");
+  for (int slot = 1; slot < maxDepth; slot++) fprintf(out, ", s%d", slot);
+  fprintf(out, ";\n");
+
+  Value* constants = chunk->constants.values;
+  depth = 0;
+  for (int i = offset; i < end; i += instructionLength(chunk->code[i])) {
+    uint8_t instruction = chunk->code[i];
+    uint8_t operand = i + 1 < chunk->count ? chunk->code[i + 1] : 0;
+    switch (instruction) {
+      case OP_CONSTANT:
+        fprintf(out, "  s%d = ", depth);
+        emitValue(out, constants[operand]);
+        fprintf(out, ";\n");
+        break;
+      case OP_ZERO:
+        fprintf(out, "  s%d = literal(0.0);\n", depth);
+        break;
+      case OP_ONE:
+        fprintf(out, "  s%d = literal(1.0);\n", depth);
+        break;
+      case OP_SMALL_INT:
+        fprintf(out, "  s%d = literal(%d.0);\n", depth, (int8_t)operand);
+        break;
+      case OP_ADD:      emitOperator(out, depth - 2, '+', NULL); break;
+      case OP_SUBTRACT: emitOperator(out, depth - 2, '-', NULL); break;
+      case OP_MULTIPLY: emitOperator(out, depth - 2, '*', NULL); break;
+      case OP_DIVIDE:   emitOperator(out, depth - 2, '/', NULL); break;
+      case OP_ADD_CONSTANT:
+        emitOperator(out, depth - 1, '+', &constants[operand]);
+        break;
+      case OP_SUBTRACT_CONSTANT:
+        emitOperator(out, depth - 1, '-', &constants[operand]);
+        break;
+      case OP_MULTIPLY_CONSTANT:
+        emitOperator(out, depth - 1, '*', &constants[operand]);
+        break;
+      case OP_DIVIDE_CONSTANT:
+        emitOperator(out, depth - 1, '/', &constants[operand]);
+        break;
+      case OP_MULTIPLY_ADD:
+      case OP_MULTIPLY_SUBTRACT:
+        fprintf(out, "  s%d = fma(s%d, s%d, %ss%d);\n", depth - 3,
+                depth - 3, depth - 2,
+                instruction == OP_MULTIPLY_ADD ? "" : "-", depth - 1);
+        break;
+      case OP_NEGATE:
+        fprintf(out, "  s%d = -s%d;\n", depth - 1, depth - 1);
+        break;
+      case OP_GET_TEMP:
+        fprintf(out, "  s%d = s%d;\n", depth, operand);
+        break;
+      case OP_RETURN:
+        fprintf(out, "  return s%d;\n}\n", depth - 1);
+        break;
+    }
+    depth += stackEffect(instruction);
+  }
+  return true;
+}
+
+// mkdir -p.
+bool makeDirectories(const char* path) {
+  char partial[NATIVE_PATH_MAX];
+  size_t length = strlen(path);
+  if (length >= sizeof(partial)) return false;
+  memcpy(partial, path, length + 1);
+
+  for (size_t i = 1; i <= length; i++) {
+    if (partial[i] != '/' && partial[i] != '\0') continue;
+    char saved = partial[i];
+    partial[i] = '\0';
+    if (mkdir(partial, 0777) < 0 && errno != EEXIST) return false;
+    partial[i] = saved;
+  }
+  return true;
+}
+
+// Runs $CC, or cc, on the generated file. Strict C11 with contraction
+// off, so a * b + c is only fused where the chunk already says fma().
+static bool build(const char* cPath, const char* soPath) {
+  const char* cc = getenv("CC");
+  if (cc == NULL || cc[0] == '\0') cc = "cc";
+  char* argv[] = {
+    (char*)cc, "-std=c11", "-O2", "-ffp-contract=off", "-fPIC",
+    "-shared", "-o", (char*)soPath, (char*)cPath, "-lm", NULL,
+  };
+
+  pid_t pid;
+  if (posix_spawnp(&pid, cc, NULL, NULL, argv, environ) != 0) {
+    return false;
+  }
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) return false;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// The source as a C string, so it can hold any byte. Octal escapes,
+// since a hex one would run on into the digits after it, and ? too,
+// for trigraphs.
+static void emitSource(FILE* out, const char* source, size_t length) {
+  fprintf(out, "\nconst unsigned long clox_source_length = %zu;\n"
+               "const char clox_source[] =\n  \"", length);
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = (unsigned char)source[i];
+    if (c == '\n') {
+      fprintf(out, "\\n\"\n  \"");
+    } else if (c < ' ' || c > '~' || c == '"' || c == '\\' || c == '?') {
+      fprintf(out, "\\%03o", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fprintf(out, "\";\n");
+}
+
+// Only returns the object's function if it was built from source. The
+// handle is never closed: the function is used until exit.
+static NativeFunction openNative(const char* path, const char* source,
+                                 size_t length) {
+  void* library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (library == NULL) return NULL;
+  NativeFunction function =
+      (NativeFunction)dlsym(library, "clox_expression");
+  const unsigned long* builtLength =
+      (const unsigned long*)dlsym(library, "clox_source_length");
+  const char* built = (const char*)dlsym(library, "clox_source");
+  if (function == NULL || builtLength == NULL || built == NULL ||
+      *builtLength != length || memcmp(built, source, length) != 0) {
+    dlclose(library);
+    return NULL;
+  }
+  return function;
+}
+
+static bool buildNative(const char* base, const char* source,
+                        size_t length, Chunk* chunk) {
+  char path[NATIVE_PATH_MAX + 32];
+  char temporary[NATIVE_PATH_MAX + 32];
+  long pid = (long)getpid();
+
+  snprintf(temporary, sizeof(temporary), "%s.c.%ld", base, pid);
+  FILE* file = fopen(temporary, "w");
+  if (file == NULL) return false;
+  bool emitted = emitC(chunk, 0, file);
+  if (emitted) emitSource(file, source, length);
+  if (fclose(file) != 0 || !emitted) {
+    remove(temporary);
+    return false;
+  }
+  snprintf(path, sizeof(path), "%s.c", base);
+  if (rename(temporary, path) < 0) {
+    remove(temporary);
+    return false;
+  }
+
+  snprintf(temporary, sizeof(temporary), "%s.so.%ld", base, pid);
+  if (!build(path, temporary)) {
+    remove(temporary);
+    return false;
+  }
+  snprintf(path, sizeof(path), "%s.so", base);
+  if (rename(temporary, path) < 0) {
+    remove(temporary);
+    return false;
+  }
+  return true;
+}
+
+// Finds source's native function in nativeCacheDir. On a miss, if the
+// compiled chunk is given, builds it there first. Returns NULL if it
+// isn't cached and can't be built, e.g. for want of a C compiler.
+NativeFunction loadNative(const char* source, size_t length,
+                          Chunk* chunk) {
+  char base[NATIVE_PATH_MAX];
+  int baseLength = snprintf(base, sizeof(base), "%s/%016llx-%d%s",
+                            nativeCacheDir,
+                            (unsigned long long)hashSource(source, length),
+                            AOT_VERSION, compilerOptions.fastMath ? "f" : "");
+  if (baseLength < 0 || baseLength >= (int)sizeof(base)) return NULL;
+
+  // Room for the suffixes.
+  char path[NATIVE_PATH_MAX + 32];
+  snprintf(path, sizeof(path), "%s.so", base);
+  NativeFunction function = openNative(path, source, length);
+  if (function != NULL || chunk == NULL) return function;
+
+  if (!makeDirectories(nativeCacheDir) ||
+      !buildNative(base, source, length, chunk)) {
+    return NULL;
+  }
+  return openNative(path, source, length);
+}
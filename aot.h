@@ -0,0 +1,22 @@
+#ifndef clox_aot_h
+#define clox_aot_h
+
+#include <stdio.h>
+
+#include "chunk.h"
+
+// Bump with any change to the C that emitC() or buildNative() writes.
+#define AOT_VERSION 2
+
+// What a chunk compiles to: its expression as a C function.
+typedef double (*NativeFunction)(void);
+
+// Where built code is cached, or NULL to interpret as usual.
+extern const char* nativeCacheDir;
+
+bool emitC(Chunk* chunk, int offset, FILE* out);
+NativeFunction loadNative(const char* source, size_t length,
+                          Chunk* chunk);
+bool makeDirectories(const char* path);
+
+#endif
@@ -0,0 +1,127 @@
+// Batches: compiles and runs a script of short generated expressions
+// a chunk per expression, as `-` does, and then packed into shared
+// chunks, as --batch does. Results are written raw to /dev/null, so
+// what's left is compiling, running and the per-chunk overhead.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compiler.h"
+
+#define STATEMENTS 20000
+#define ROUNDS 40
+#define SOURCE_MAX 512
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// A random expression, depth levels deep, over small counts and now
+// and then a fraction.
+static int generate(char* out, int depth) {
+  if (depth == 0 || rand() % 4 == 0) {
+    if (rand() % 4 == 0) {
+      return sprintf(out, "%d.%d", rand() % 100, 1 + rand() % 9);
+    }
+    return sprintf(out, "%d", rand() % 200);
+  }
+  static const char operators[] = "+-*/";
+  int length = sprintf(out, "(");
+  length += generate(out + length, depth - 1);
+  length += sprintf(out + length, " %c ", operators[rand() % 4]);
+  length += generate(out + length, depth - 1);
+  return length + sprintf(out + length, ")");
+}
+
+static void separate(const char* source, size_t length) {
+  initScannerRange(source, length);
+  beginStatements();
+  while (!atEndOfStatements()) {
+    Chunk chunk;
+    initChunk(&chunk);
+    Value value;
+    if (compileStatement(&chunk)) runChunk(&chunk, &value);
+    freeChunk(&chunk);
+  }
+}
+
+static void batched(const char* source, size_t length) {
+  interpretBatch(source, length);
+}
+
+static double timed(void (*run)(const char*, size_t),
+                    const char* source, size_t length) {
+  double start = now();
+  run(source, length);
+  return now() - start;
+}
+
+// Alternates the two, so that the machine getting faster or slower
+// part way through doesn't favour either.
+static void measure(const char* source, size_t length) {
+  double bestSeparate = 1e9;
+  double bestBatched = 1e9;
+  for (int round = 0; round < ROUNDS; round++) {
+    double elapsed = timed(separate, source, length);
+    if (elapsed < bestSeparate) bestSeparate = elapsed;
+    elapsed = timed(batched, source, length);
+    if (elapsed < bestBatched) bestBatched = elapsed;
+  }
+  printf("  %-10s %7.1f ns/expression\n", "separate",
+         bestSeparate / STATEMENTS * 1e9);
+  printf("  %-10s %7.1f ns/expression\n", "batched",
+         bestBatched / STATEMENTS * 1e9);
+}
+
+int main() {
+  char* source = malloc((size_t)STATEMENTS * SOURCE_MAX);
+  size_t length = 0;
+  srand(11);
+  for (int i = 0; i < STATEMENTS; i++) {
+    length += (size_t)generate(source + length, 2);
+    length += (size_t)sprintf(source + length, ";\n");
+  }
+
+  initVM();
+  vm.outputFormat = OUTPUT_RAW;
+  vm.outputFile = fopen("/dev/null", "w");
+
+  Chunk chunk;
+  initChunk(&chunk);
+  long separateConstants = 0;
+  initScannerRange(source, length);
+  beginStatements();
+  while (!atEndOfStatements()) {
+    truncateChunk(&chunk, 0, 0);
+    compileStatement(&chunk);
+    separateConstants += chunk.constants.count;
+  }
+
+  int chunks = 0;
+  long batchedConstants = 0;
+  beginBatch(source, length);
+  while (!atEndOfStatements()) {
+    truncateChunk(&chunk, 0, 0);
+    compileBatch(&chunk);
+    chunks++;
+    batchedConstants += chunk.constants.count;
+  }
+  freeChunk(&chunk);
+
+  printf("batch: %d expressions; %d chunks and %ld constants batched, "
+         "%ld separate\n", STATEMENTS, chunks, batchedConstants,
+         separateConstants);
+  measure(source, length);
+
+  fclose(vm.outputFile);
+  vm.outputFile = stdout;
+  freeVM();
+  free(source);
+  return 0;
+}
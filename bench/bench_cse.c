@@ -0,0 +1,109 @@
+// Common subexpression elimination: compiles generated expressions
+// that reuse a handful of subterms, as machine-written code tends to,
+// once as a tree and once through the DAG, and runs both.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compiler.h"
+
+#define EXPRESSIONS 2000
+#define ROUNDS 200
+#define SOURCE_MAX 4096
+#define TERMS 4
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// A random term over small literals, depth levels deep.
+static int generate(char* out, int depth) {
+  if (depth == 0 || rand() % 4 == 0) {
+    return sprintf(out, "%d.%d", 1 + rand() % 9, rand() % 10);
+  }
+  static const char operators[] = "+-*";
+  int length = sprintf(out, "(");
+  length += generate(out + length, depth - 1);
+  length += sprintf(out + length, " %c ", operators[rand() % 3]);
+  length += generate(out + length, depth - 1);
+  return length + sprintf(out + length, ")");
+}
+
+// Combines picks from a few shared terms, depth levels deep.
+static int combine(char* out, char terms[TERMS][SOURCE_MAX],
+                   int depth) {
+  if (depth == 0) return sprintf(out, "%s", terms[rand() % TERMS]);
+  static const char operators[] = "+-";
+  int length = sprintf(out, "(");
+  length += combine(out + length, terms, depth - 1);
+  length += sprintf(out + length, " %c ", operators[rand() % 2]);
+  length += combine(out + length, terms, depth - 1);
+  return length + sprintf(out + length, ")");
+}
+
+static void measure(const char* name, Chunk* chunks) {
+  double best = 1e9;
+  double sum = 0;
+  for (int round = 0; round < 5; round++) {
+    double start = now();
+    sum = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+      for (int i = 0; i < EXPRESSIONS; i++) {
+        Value value;
+        runChunk(&chunks[i], &value);
+        sum += value;
+      }
+    }
+    double elapsed = now() - start;
+    if (elapsed < best) best = elapsed;
+  }
+
+  long bytes = 0;
+  for (int i = 0; i < EXPRESSIONS; i++) bytes += chunks[i].count;
+  printf("  %-6s %7.1f ns/expression  %7ld bytes of code  (sum %g)\n",
+         name, best / ((double)EXPRESSIONS * ROUNDS) * 1e9, bytes, sum);
+}
+
+int main() {
+  static Chunk tree[EXPRESSIONS];
+  static Chunk dag[EXPRESSIONS];
+  static char terms[TERMS][SOURCE_MAX];
+  char source[SOURCE_MAX * 8];
+
+  initVM();
+  srand(5);
+  for (int i = 0; i < EXPRESSIONS; i++) {
+    for (int t = 0; t < TERMS; t++) generate(terms[t], 2);
+    int length = combine(source, terms, 3);
+
+    compilerOptions.cse = false;
+    initChunk(&tree[i]);
+    compile(source, (size_t)length, &tree[i]);
+
+    compilerOptions.cse = true;
+    initChunk(&dag[i]);
+    compile(source, (size_t)length, &dag[i]);
+  }
+
+  int64_t eliminated = cseStats.treeInstructions -
+                       cseStats.emittedInstructions;
+  printf("cse: %d expressions, %d runs each, "
+         "%lld of %lld instructions eliminated\n",
+         EXPRESSIONS, ROUNDS, (long long)eliminated,
+         (long long)cseStats.treeInstructions);
+  measure("tree", tree);
+  measure("dag", dag);
+
+  for (int i = 0; i < EXPRESSIONS; i++) {
+    freeChunk(&tree[i]);
+    freeChunk(&dag[i]);
+  }
+  freeVM();
+  return 0;
+}
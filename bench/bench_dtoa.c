@@ -0,0 +1,72 @@
+// Number formatting throughput: formatDouble() against the
+// snprintf("%g") printValue() used to do, and "%.17g", which is what
+// printf needs to round-trip.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dtoa.h"
+
+#define VALUES (1024 * 1024)
+#define ROUNDS 5
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+static int viaG(double value, char* buffer) {
+  return snprintf(buffer, DTOA_BUFFER_SIZE, "%g", value);
+}
+
+static int viaRoundTrip(double value, char* buffer) {
+  return snprintf(buffer, DTOA_BUFFER_SIZE, "%.17g", value);
+}
+
+typedef int (*Format)(double value, char* buffer);
+
+static void measure(const char* name, Format format, double* values) {
+  char buffer[DTOA_BUFFER_SIZE];
+  double best = 1e9;
+  size_t bytes = 0;
+  for (int round = 0; round < ROUNDS; round++) {
+    double start = now();
+    bytes = 0;
+    for (int i = 0; i < VALUES; i++) {
+      bytes += (size_t)format(values[i], buffer);
+    }
+    double elapsed = now() - start;
+    if (elapsed < best) best = elapsed;
+  }
+
+  printf("  %-14s %7.1f M values/s  (%zu bytes)\n", name,
+         VALUES / best / 1e6, bytes);
+}
+
+int main() {
+  double* values = malloc(sizeof(double) * VALUES);
+
+  // A mix of whole numbers, short decimals and arbitrary quotients,
+  // like the results of evaluating our generated expressions.
+  srand(3);
+  for (int i = 0; i < VALUES; i++) {
+    switch (rand() % 3) {
+      case 0: values[i] = rand() % 100000; break;
+      case 1: values[i] = (rand() % 100000) / 100.0; break;
+      default: values[i] = (double)rand() / (1 + rand() % 1000); break;
+    }
+  }
+
+  printf("dtoa: %d values, best of %d\n", VALUES, ROUNDS);
+  measure("%g", viaG, values);
+  measure("%.17g", viaRoundTrip, values);
+  measure("formatDouble", formatDouble, values);
+
+  free(values);
+  return 0;
+}
@@ -0,0 +1,123 @@
+// Keyword recognition: the perfect hash in keywords.h against the
+// nested-switch trie the scanner used before it.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "keywords.h"
+#include "scanner.h"
+
+#define WORDS (4 * 1024 * 1024)
+#define ROUNDS 5
+
+static TokenType checkKeyword(const char* word, int wordLength,
+                              int start, int length, const char* rest,
+                              TokenType type) {
+  if (wordLength == start + length &&
+      memcmp(word + start, rest, length) == 0) {
+    return type;
+  }
+  return TOKEN_IDENTIFIER;
+}
+
+static TokenType trieLookup(const char* word, int length) {
+  switch (word[0]) {
+    case 'a': return checkKeyword(word, length, 1, 2, "nd", TOKEN_AND);
+    case 'c': return checkKeyword(word, length, 1, 4, "lass", TOKEN_CLASS);
+    case 'e': return checkKeyword(word, length, 1, 3, "lse", TOKEN_ELSE);
+    case 'f':
+      if (length > 1) {
+        switch (word[1]) {
+          case 'a':
+            return checkKeyword(word, length, 2, 3, "lse", TOKEN_FALSE);
+          case 'o':
+            return checkKeyword(word, length, 2, 1, "r", TOKEN_FOR);
+          case 'u':
+            return checkKeyword(word, length, 2, 1, "n", TOKEN_FUN);
+        }
+      }
+      break;
+    case 'i': return checkKeyword(word, length, 1, 1, "f", TOKEN_IF);
+    case 'n': return checkKeyword(word, length, 1, 2, "il", TOKEN_NIL);
+    case 'o': return checkKeyword(word, length, 1, 1, "r", TOKEN_OR);
+    case 'p': return checkKeyword(word, length, 1, 4, "rint", TOKEN_PRINT);
+    case 'r':
+      return checkKeyword(word, length, 1, 5, "eturn", TOKEN_RETURN);
+    case 's': return checkKeyword(word, length, 1, 4, "uper", TOKEN_SUPER);
+    case 't':
+      if (length > 1) {
+        switch (word[1]) {
+          case 'h':
+            return checkKeyword(word, length, 2, 2, "is", TOKEN_THIS);
+          case 'r':
+            return checkKeyword(word, length, 2, 2, "ue", TOKEN_TRUE);
+        }
+      }
+      break;
+    case 'v': return checkKeyword(word, length, 1, 2, "ar", TOKEN_VAR);
+    case 'w': return checkKeyword(word, length, 1, 4, "hile", TOKEN_WHILE);
+  }
+  return TOKEN_IDENTIFIER;
+}
+
+typedef struct {
+  const char* start;
+  int length;
+} Word;
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+typedef TokenType (*Lookup)(const char* word, int length);
+
+static void measure(const char* name, Lookup lookup, Word* words) {
+  double best = 1e9;
+  long keywords = 0;
+  for (int round = 0; round < ROUNDS; round++) {
+    double start = now();
+    keywords = 0;
+    for (int i = 0; i < WORDS; i++) {
+      if (lookup(words[i].start, words[i].length) != TOKEN_IDENTIFIER) {
+        keywords++;
+      }
+    }
+    double elapsed = now() - start;
+    if (elapsed < best) best = elapsed;
+  }
+
+  printf("  %-12s %8.1f M lookups/s  (%ld keywords)\n", name,
+         WORDS / best / 1e6, keywords);
+}
+
+int main() {
+  // Identifier-heavy: a third keywords, the rest names that share a
+  // keyword's first letter or length.
+  static const char* vocabulary[] = {
+    "var", "while", "return", "if", "and", "this", "true", "fun",
+    "value", "width", "result", "index", "amount", "total", "temp",
+    "factor", "count", "sum", "v", "x", "coefficient_17", "nil_ratio",
+  };
+  int size = (int)(sizeof(vocabulary) / sizeof(vocabulary[0]));
+
+  Word* words = malloc(sizeof(Word) * WORDS);
+  srand(7);
+  for (int i = 0; i < WORDS; i++) {
+    const char* word = vocabulary[rand() % size];
+    words[i].start = word;
+    words[i].length = (int)strlen(word);
+  }
+
+  printf("keywords: %d identifiers, best of %d\n", WORDS, ROUNDS);
+  measure("trie", trieLookup, words);
+  measure("perfect hash", lookupKeyword, words);
+
+  free(words);
+  return 0;
+}
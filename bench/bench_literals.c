@@ -0,0 +1,127 @@
+// Immediate literals: runs generated expressions over small integers
+// as compiled, with OP_ZERO, OP_ONE and OP_SMALL_INT, and again with
+// each of those moved back into the constant pool. Once with a batch
+// that stays in cache and once with one that doesn't.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compiler.h"
+
+#define SMALL_BATCH 200
+#define LARGE_BATCH 50000
+#define RUNS 400000
+#define SOURCE_MAX 512
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// A random expression, depth levels deep, over the kind of literals
+// scripts are full of: mostly small counts, now and then a fraction.
+// Negations put literals where they can't fold into an operator.
+static int generate(char* out, int depth) {
+  if (depth == 0 || rand() % 4 == 0) {
+    if (rand() % 8 == 0) {
+      return sprintf(out, "%d.%d", rand() % 100, 1 + rand() % 9);
+    }
+    return sprintf(out, rand() % 3 == 0 ? "-%d" : "%d", rand() % 20);
+  }
+  static const char operators[] = "+-*/";
+  int length = sprintf(out, "(");
+  length += generate(out + length, depth - 1);
+  length += sprintf(out + length, " %c ", operators[rand() % 4]);
+  length += generate(out + length, depth - 1);
+  return length + sprintf(out + length, ")");
+}
+
+// Copies chunk with every immediate literal read from the pool.
+static void pooled(Chunk* chunk, Chunk* out) {
+  initChunk(out);
+  for (int i = 0; i < chunk->constants.count; i++) {
+    addConstant(out, chunk->constants.values[i]);
+  }
+  for (int offset = 0; offset < chunk->count;) {
+    uint8_t op = chunk->code[offset];
+    if (op == OP_ZERO || op == OP_ONE || op == OP_SMALL_INT) {
+      Value value = op == OP_ZERO ? 0
+                  : op == OP_ONE ? 1
+                  : (int8_t)chunk->code[offset + 1];
+      writeChunk(out, OP_CONSTANT, 1);
+      writeChunk(out, (uint8_t)addConstant(out, value), 1);
+      offset += op == OP_SMALL_INT ? 2 : 1;
+    } else if (op == OP_CONSTANT ||
+               (op >= OP_ADD_CONSTANT && op <= OP_DIVIDE_CONSTANT)) {
+      writeChunk(out, op, 1);
+      writeChunk(out, chunk->code[offset + 1], 1);
+      offset += 2;
+    } else {
+      writeChunk(out, op, 1);
+      offset++;
+    }
+  }
+}
+
+static void measure(const char* name, Chunk* chunks, int count) {
+  int rounds = RUNS / count;
+  double best = 1e9;
+  double sum = 0;
+  for (int round = 0; round < 5; round++) {
+    double start = now();
+    sum = 0;
+    for (int r = 0; r < rounds; r++) {
+      for (int i = 0; i < count; i++) {
+        Value value;
+        runChunk(&chunks[i], &value);
+        sum += value;
+      }
+    }
+    double elapsed = now() - start;
+    if (elapsed < best) best = elapsed;
+  }
+
+  long bytes = 0;
+  long constants = 0;
+  for (int i = 0; i < count; i++) {
+    bytes += chunks[i].count;
+    constants += chunks[i].constants.count;
+  }
+  printf("  %-10s %6d %7.1f ns/expression  %8ld bytes of code  "
+         "%8ld of constants  (sum %g)\n",
+         name, count, best / ((double)count * rounds) * 1e9, bytes,
+         constants * (long)sizeof(Value), sum);
+}
+
+int main() {
+  static Chunk immediate[LARGE_BATCH];
+  static Chunk pool[LARGE_BATCH];
+  char source[SOURCE_MAX];
+
+  initVM();
+  srand(9);
+  for (int i = 0; i < LARGE_BATCH; i++) {
+    int length = generate(source, 4);
+    initChunk(&immediate[i]);
+    compile(source, (size_t)length, &immediate[i]);
+    pooled(&immediate[i], &pool[i]);
+  }
+
+  printf("literals: %d expression runs per batch\n", RUNS);
+  measure("pooled", pool, SMALL_BATCH);
+  measure("immediate", immediate, SMALL_BATCH);
+  measure("pooled", pool, LARGE_BATCH);
+  measure("immediate", immediate, LARGE_BATCH);
+
+  for (int i = 0; i < LARGE_BATCH; i++) {
+    freeChunk(&immediate[i]);
+    freeChunk(&pool[i]);
+  }
+  freeVM();
+  return 0;
+}
@@ -0,0 +1,78 @@
+// Memoization: interprets a generated sum, as long as one chunk's
+// constants allow, compiled and run every time as a script would be,
+// and then with --memoize's in-memory cache, where all that's left is
+// hashing the source.
+// Results are written raw to /dev/null.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compiler.h"
+#include "memo.h"
+
+#define TERMS 250
+#define ROUNDS 2000
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+static double timed(bool memoize, const char* source, size_t length) {
+  memoizeResults = memoize;
+  double start = now();
+  interpretRange(source, length);
+  return now() - start;
+}
+
+int main() {
+  char* source = malloc((size_t)TERMS * 16);
+  size_t length = 0;
+  srand(5);
+  for (int i = 0; i < TERMS; i++) {
+    length += (size_t)sprintf(source + length, "%s%d.%d",
+                              i == 0 ? "" : " + ", rand() % 100,
+                              rand() % 10);
+  }
+
+  initVM();
+  vm.outputFormat = OUTPUT_RAW;
+  vm.outputFile = fopen("/dev/null", "w");
+
+  // Alternating, so a machine speeding up or slowing down part way
+  // through doesn't favour either.
+  double bestCold = 1e9;
+  double bestHit = 1e9;
+  for (int round = 0; round < ROUNDS; round++) {
+    double elapsed = timed(false, source, length);
+    if (elapsed < bestCold) bestCold = elapsed;
+    elapsed = timed(true, source, length);
+    if (elapsed < bestHit) bestHit = elapsed;
+  }
+
+  uint8_t digest[32];
+  double start = now();
+  for (int round = 0; round < ROUNDS; round++) {
+    sha256(source, length, digest);
+  }
+  double hashing = (now() - start) / ROUNDS;
+
+  printf("memo: %zu bytes, %llu hits, %llu misses\n", length,
+         (unsigned long long)memoStats.hits,
+         (unsigned long long)memoStats.misses);
+  printf("  %-10s %8.1f us\n", "compiled", bestCold * 1e6);
+  printf("  %-10s %8.1f us\n", "memoized", bestHit * 1e6);
+  printf("  %-10s %8.1f us (%.0f MB/s)\n", "sha256", hashing * 1e6,
+         (double)length / hashing / 1e6);
+
+  fclose(vm.outputFile);
+  vm.outputFile = stdout;
+  freeVM();
+  free(source);
+  return 0;
+}
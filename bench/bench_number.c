@@ -0,0 +1,87 @@
+// Literal parsing throughput: parseNumber() against strtod() on the
+// kind of literals our generated data files are full of.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "number.h"
+
+#define LITERALS (2 * 1024 * 1024)
+#define ROUNDS 5
+
+typedef struct {
+  const char* start;
+  int length;
+} Literal;
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// strtod() stops at the space after each literal, so it can read the
+// buffer in place the way the scanner's tokens sit in the source.
+static double viaStrtod(const char* start, int length) {
+  (void)length;
+  return strtod(start, NULL);
+}
+
+typedef double (*Parse)(const char* start, int length);
+
+static void measure(const char* name, Parse parse, Literal* literals,
+                    size_t bytes) {
+  double best = 1e9;
+  double sum = 0;
+  for (int round = 0; round < ROUNDS; round++) {
+    double start = now();
+    sum = 0;
+    for (int i = 0; i < LITERALS; i++) {
+      sum += parse(literals[i].start, literals[i].length);
+    }
+    double elapsed = now() - start;
+    if (elapsed < best) best = elapsed;
+  }
+
+  printf("  %-12s %7.1f M literals/s  %7.1f MB/s  (sum %g)\n", name,
+         LITERALS / best / 1e6, bytes / best / 1e6, sum);
+}
+
+int main() {
+  char* text = malloc((size_t)LITERALS * 32);
+  Literal* literals = malloc(sizeof(Literal) * LITERALS);
+  size_t bytes = 0;
+
+  srand(3);
+  char* p = text;
+  for (int i = 0; i < LITERALS; i++) {
+    int length;
+    switch (rand() % 3) {
+      case 0: length = sprintf(p, "%d", rand() % 100000); break;
+      case 1:
+        length = sprintf(p, "%d.%d", rand() % 1000, rand() % 100);
+        break;
+      default:
+        length = sprintf(p, "%.15f", (double)rand() / RAND_MAX);
+        break;
+    }
+    literals[i].start = p;
+    literals[i].length = length;
+    bytes += (size_t)length;
+    p += length;
+    *p++ = ' ';
+  }
+  *p = '\0';
+
+  printf("numbers: %d literals, best of %d\n", LITERALS, ROUNDS);
+  measure("strtod", viaStrtod, literals, bytes);
+  measure("parseNumber", parseNumber, literals, bytes);
+
+  free(literals);
+  free(text);
+  return 0;
+}
@@ -0,0 +1,108 @@
+// Scanner throughput over a synthetic source shaped like our generated
+// inputs: mostly indentation, comments and long numeric literals.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scanner.h"
+#include "simd.h"
+#include "tokens.h"
+
+#define SOURCE_SIZE (32 * 1024 * 1024)
+#define ROUNDS 5
+
+static char* makeSource(size_t size) {
+  static const char* pieces[] = {
+    "        ",
+    "// generated coefficient table, do not edit\n",
+    "3.14159265358979323846 ",
+    "12345678901234567890 ",
+    "+ ",
+    "coefficient_name_0042 ",
+    "\n",
+  };
+  int count = (int)(sizeof(pieces) / sizeof(pieces[0]));
+
+  char* source = malloc(size + 1);
+  size_t length = 0;
+  srand(42);
+  while (length < size) {
+    const char* piece = pieces[rand() % count];
+    size_t pieceLength = strlen(piece);
+    if (length + pieceLength > size) break;
+    memcpy(source + length, piece, pieceLength);
+    length += pieceLength;
+  }
+  source[length] = '\0';
+  return source;
+}
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+static void measure(SimdLevel level, const char* source, size_t length) {
+  if (!useSimd(level)) {
+    printf("  %-8s unsupported on this CPU\n", simdName(level));
+    return;
+  }
+
+  double best = 1e9;
+  long tokens = 0;
+  for (int round = 0; round < ROUNDS; round++) {
+    double start = now();
+    initScannerRange(source, length);
+    tokens = 0;
+    while (scanToken().type != TOKEN_EOF) tokens++;
+    double elapsed = now() - start;
+    if (elapsed < best) best = elapsed;
+  }
+
+  printf("  %-8s %8.1f MB/s  (%ld tokens)\n", simdName(level),
+         (double)length / best / 1e6, tokens);
+}
+
+// Lexing alone into the struct-of-arrays buffer the parser can read by
+// index.
+static void measureTokenArray(const char* source, size_t length,
+                              int threads) {
+  useSimd(detectSimd());
+
+  double best = 1e9;
+  int tokens = 0;
+  for (int round = 0; round < ROUNDS; round++) {
+    TokenArray array;
+    double start = now();
+    scanAllParallel(source, length, &array, threads);
+    double elapsed = now() - start;
+    if (elapsed < best) best = elapsed;
+    tokens = array.count;
+    freeTokenArray(&array);
+  }
+
+  printf("  scanAll  %8.1f MB/s  (%d tokens, %d thread%s)\n",
+         (double)length / best / 1e6, tokens, threads,
+         threads == 1 ? "" : "s");
+}
+
+int main() {
+  char* source = makeSource(SOURCE_SIZE);
+  size_t length = strlen(source);
+
+  printf("scanner: %zu bytes, best of %d\n", length, ROUNDS);
+  measure(SIMD_SCALAR, source, length);
+  measure(SIMD_SSE2, source, length);
+  measure(SIMD_AVX2, source, length);
+  for (int threads = 1; threads <= 8; threads *= 2) {
+    measureTokenArray(source, length, threads);
+  }
+
+  free(source);
+  return 0;
+}
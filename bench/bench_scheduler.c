@@ -0,0 +1,104 @@
+// Time slicing: how long small expressions wait when they are queued
+// behind a few big ones, with and without an instruction budget.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "scheduler.h"
+
+#define BIG 16
+#define SMALL 500
+#define BIG_TERMS 250
+#define TASKS (BIG + SMALL)
+
+static double started;
+static double finishedAt[TASKS];
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+static void finished(Task* task) {
+  finishedAt[(intptr_t)task->data] = now() - started;
+}
+
+static int compareDoubles(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+static void compileSum(int terms, Chunk* chunk) {
+  static char source[8 * BIG_TERMS];
+  int length = 0;
+  for (int i = 0; i < terms; i++) {
+    length += sprintf(source + length, i == 0 ? "%d" : " + %d", i);
+  }
+  initChunk(chunk);
+  compile(source, (size_t)length, chunk);
+}
+
+static void measure(FILE* report, Chunk* chunks, int threads,
+                    int64_t slice) {
+  static Task tasks[TASKS];
+  // The big ones go first, where they do the most damage.
+  for (int i = 0; i < TASKS; i++) {
+    initTask(&tasks[i], &chunks[i]);
+    tasks[i].finished = finished;
+    tasks[i].data = (void*)(intptr_t)i;
+  }
+
+  started = now();
+  runTasks(tasks, TASKS, threads, slice);
+  double total = now() - started;
+
+  char label[24];
+  if (slice > 0) {
+    snprintf(label, sizeof(label), "%lld", (long long)slice);
+  } else {
+    snprintf(label, sizeof(label), "unlimited");
+  }
+
+  static double small[SMALL];
+  memcpy(small, finishedAt + BIG, sizeof(small));
+  qsort(small, SMALL, sizeof(double), compareDoubles);
+  fprintf(report, "  %d thread%s slice %-9s small p50 %7.2f ms  "
+          "p99 %7.2f ms  all done %7.2f ms\n", threads,
+          threads == 1 ? " " : "s", label, small[SMALL / 2] * 1e3, small[SMALL * 99 / 100] * 1e3,
+          total * 1e3);
+}
+
+int main() {
+  // Debug builds disassemble and trace to stdout.
+  FILE* report = fdopen(dup(STDOUT_FILENO), "w");
+  if (freopen("/dev/null", "w", stdout) == NULL) return 1;
+
+  initVM();
+  static Chunk chunks[TASKS];
+  for (int i = 0; i < TASKS; i++) {
+    compileSum(i < BIG ? BIG_TERMS : 3, &chunks[i]);
+  }
+
+  fprintf(report, "scheduler: %d tasks of %d terms ahead of %d of 3\n",
+          BIG, BIG_TERMS, SMALL);
+  int threads[] = {1, 4};
+  int64_t slices[] = {0, 256, 32};
+  for (int t = 0; t < 2; t++) {
+    for (int s = 0; s < 3; s++) {
+      measure(report, chunks, threads[t], slices[s]);
+    }
+  }
+
+  for (int i = 0; i < TASKS; i++) freeChunk(&chunks[i]);
+  freeVM();
+  fclose(report);
+  return 0;
+}
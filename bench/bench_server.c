@@ -0,0 +1,203 @@
+// Load generator for the evaluation server: a few pipelined
+// connections sending a mix of expressions, reporting throughput and
+// request latency. Pass a socket path to load a running
+// `clox --serve=PATH`; without one it forks a server of its own.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "vm.h"
+
+#define CONNECTIONS 4
+#define DEPTH 32
+#define REQUESTS 200000
+#define DISTINCT 512
+#define SOURCE_MAX 64
+
+typedef struct {
+  int fd;
+  int outstanding;
+  char input[DEPTH * RECORD_SIZE];
+  size_t inputLength;
+} Connection;
+
+static char sources[DISTINCT][SOURCE_MAX];
+static double sentAt[REQUESTS];
+static double latencies[REQUESTS];
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+static int connectTo(const char* path) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void writeUint32(char* out, uint32_t value) {
+  for (int i = 0; i < 4; i++) out[i] = (char)(value >> (8 * i));
+}
+
+static uint32_t readUint32(const char* bytes) {
+  const unsigned char* in = (const unsigned char*)bytes;
+  return (uint32_t)in[0] | (uint32_t)in[1] << 8 |
+         (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+// Tops the connection up to DEPTH requests in flight with one write.
+static void sendRequests(Connection* connection, int* next) {
+  char buffer[DEPTH * (REQUEST_HEADER + SOURCE_MAX)];
+  size_t length = 0;
+  while (connection->outstanding < DEPTH && *next < REQUESTS) {
+    int id = (*next)++;
+    const char* source = sources[rand() % DISTINCT];
+    uint32_t sourceLength = (uint32_t)strlen(source);
+    writeUint32(buffer + length, (uint32_t)id);
+    writeUint32(buffer + length + 4, sourceLength);
+    memcpy(buffer + length + REQUEST_HEADER, source, sourceLength);
+    length += REQUEST_HEADER + sourceLength;
+    sentAt[id] = now();
+    connection->outstanding++;
+  }
+
+  size_t written = 0;
+  while (written < length) {
+    ssize_t count = write(connection->fd, buffer + written,
+                          length - written);
+    if (count <= 0) {
+      perror("write");
+      exit(1);
+    }
+    written += (size_t)count;
+  }
+}
+
+static int receiveResults(Connection* connection, int* failures) {
+  ssize_t count = read(connection->fd,
+                       connection->input + connection->inputLength,
+                       sizeof(connection->input) - connection->inputLength);
+  if (count <= 0) {
+    fprintf(stderr, "server closed the connection\n");
+    exit(1);
+  }
+  connection->inputLength += (size_t)count;
+
+  double arrived = now();
+  int done = 0;
+  size_t offset = 0;
+  while (connection->inputLength - offset >= RECORD_SIZE) {
+    const char* record = connection->input + offset;
+    uint32_t id = readUint32(record);
+    if (readUint32(record + 4) != INTERPRET_OK) (*failures)++;
+    latencies[id] = arrived - sentAt[id];
+    done++;
+    offset += RECORD_SIZE;
+  }
+  memmove(connection->input, connection->input + offset,
+          connection->inputLength - offset);
+  connection->inputLength -= offset;
+  connection->outstanding -= done;
+  return done;
+}
+
+static int compareDoubles(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char* argv[]) {
+  char ownPath[64];
+  const char* path = argc > 1 ? argv[1] : NULL;
+  pid_t server = -1;
+
+  if (path == NULL) {
+    snprintf(ownPath, sizeof(ownPath), "/tmp/clox-bench-%d.sock",
+             (int)getpid());
+    path = ownPath;
+    server = fork();
+    if (server == 0) {
+      // Debug builds trace to stdout.
+      if (freopen("/dev/null", "w", stdout) == NULL) _exit(1);
+      initVM();
+      _exit(runServer(path, NULL) ? 0 : 1);
+    }
+  }
+
+  srand(7);
+  for (int i = 0; i < DISTINCT; i++) {
+    snprintf(sources[i], SOURCE_MAX, "(%d + %d.5) * %d / -%d",
+             rand() % 1000, rand() % 1000, rand() % 100,
+             1 + rand() % 100);
+  }
+
+  Connection connections[CONNECTIONS];
+  struct pollfd fds[CONNECTIONS];
+  for (int i = 0; i < CONNECTIONS; i++) {
+    int fd = -1;
+    for (int attempt = 0; fd < 0 && attempt < 500; attempt++) {
+      fd = connectTo(path);
+      if (fd < 0) nanosleep(&(struct timespec){0, 10000000}, NULL);
+    }
+    if (fd < 0) {
+      fprintf(stderr, "could not connect to %s\n", path);
+      return 1;
+    }
+    connections[i].fd = fd;
+    connections[i].outstanding = 0;
+    connections[i].inputLength = 0;
+    fds[i].fd = fd;
+    fds[i].events = POLLIN;
+  }
+
+  int next = 0;
+  int received = 0;
+  int failures = 0;
+  double start = now();
+  for (int i = 0; i < CONNECTIONS; i++) sendRequests(&connections[i], &next);
+  while (received < REQUESTS) {
+    poll(fds, CONNECTIONS, -1);
+    for (int i = 0; i < CONNECTIONS; i++) {
+      if (!(fds[i].revents & POLLIN)) continue;
+      received += receiveResults(&connections[i], &failures);
+      sendRequests(&connections[i], &next);
+    }
+  }
+  double elapsed = now() - start;
+
+  qsort(latencies, REQUESTS, sizeof(double), compareDoubles);
+  printf("server: %d requests, %d connections, %d in flight each, "
+         "%d distinct sources\n", REQUESTS, CONNECTIONS, DEPTH, DISTINCT);
+  printf("  %.0f requests/s  p50 %.1f us  p99 %.1f us  (%d failed)\n",
+         REQUESTS / elapsed, latencies[REQUESTS / 2] * 1e6,
+         latencies[REQUESTS * 99 / 100] * 1e6, failures);
+
+  for (int i = 0; i < CONNECTIONS; i++) close(connections[i].fd);
+  if (server > 0) {
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+  }
+  return 0;
+}
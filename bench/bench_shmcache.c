@@ -0,0 +1,114 @@
+// Several worker processes evaluating the same set of scripts, each
+// with its own ChunkCache against all of them sharing one segment.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "shmcache.h"
+#include "vm.h"
+
+#define WORKERS 4
+#define SCRIPTS 1000
+#define PASSES 3
+#define SOURCE_MAX 96
+
+static char sources[SCRIPTS][SOURCE_MAX];
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// Each worker walks the scripts from a different starting point and
+// writes how many it had to compile to the pipe.
+static void work(int worker, const char* sharedName, int report) {
+  if (freopen("/dev/null", "w", stdout) == NULL) _exit(1);
+  initVM();
+
+  ChunkCache local;
+  SharedCache shared;
+  if (sharedName == NULL) {
+    initChunkCache(&local);
+  } else if (!openSharedCache(&shared, sharedName)) {
+    _exit(1);
+  }
+
+  for (int pass = 0; pass < PASSES; pass++) {
+    for (int i = 0; i < SCRIPTS; i++) {
+      const char* source = sources[(i + worker * SCRIPTS / WORKERS) %
+                                   SCRIPTS];
+      Value value;
+      if (sharedName == NULL) {
+        Chunk* chunk = cachedChunk(&local, source, strlen(source));
+        runChunk(chunk, &value);
+      } else {
+        SharedChunk chunk;
+        acquireSharedChunk(&shared, source, strlen(source), &chunk);
+        runChunk(&chunk.chunk, &value);
+        releaseSharedChunk(&chunk);
+      }
+    }
+  }
+
+  uint64_t compiles = sharedName == NULL ? local.misses : shared.misses;
+  _exit(write(report, &compiles, sizeof(compiles)) == sizeof(compiles)
+        ? 0 : 1);
+}
+
+static void measure(const char* label, const char* sharedName) {
+  int report[2];
+  if (pipe(report) != 0) exit(1);
+
+  double start = now();
+  for (int i = 0; i < WORKERS; i++) {
+    if (fork() == 0) work(i, sharedName, report[1]);
+  }
+  for (int i = 0; i < WORKERS; i++) wait(NULL);
+  double elapsed = now() - start;
+
+  uint64_t total = 0;
+  for (int i = 0; i < WORKERS; i++) {
+    uint64_t compiles = 0;
+    if (read(report[0], &compiles, sizeof(compiles)) > 0) {
+      total += compiles;
+    }
+  }
+  close(report[0]);
+  close(report[1]);
+  printf("  %-8s %6llu compiles  %8.1f ms\n", label,
+         (unsigned long long)total, elapsed * 1e3);
+  fflush(stdout);
+}
+
+int main() {
+  srand(11);
+  for (int i = 0; i < SCRIPTS; i++) {
+    int length = 0;
+    for (int term = 0; term < 12; term++) {
+      length += snprintf(sources[i] + length, SOURCE_MAX - length,
+                         term == 0 ? "%d" : " * %d", rand() % 100);
+    }
+  }
+
+  char name[64];
+  snprintf(name, sizeof(name), "/clox-bench-%d", (int)getpid());
+  removeSharedCache(name);
+
+  printf("shmcache: %d workers, %d scripts, %d passes each\n", WORKERS,
+         SCRIPTS, PASSES);
+  // Workers reopen stdout; don't let them flush a copy of this.
+  fflush(stdout);
+  measure("private", NULL);
+  measure("shared", name);
+
+  removeSharedCache(name);
+  return 0;
+}
@@ -0,0 +1,154 @@
+// Dispatch cost: runs a batch of compiled arithmetic expressions as the
+// compiler emits them and again with every OP_*_CONSTANT expanded back
+// into OP_CONSTANT and the generic operator, then as compiled with
+// --fast-math, then predecoded: once up front, and again before every
+// run, as --predecode does.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compiler.h"
+
+#define EXPRESSIONS 2000
+#define ROUNDS 200
+#define SOURCE_MAX 512
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// A random expression over small literals, depth levels deep.
+static int generate(char* out, int depth) {
+  if (depth == 0 || rand() % 4 == 0) {
+    return sprintf(out, "%d.%d", rand() % 100, rand() % 10);
+  }
+  static const char operators[] = "+-*/";
+  int length = sprintf(out, "(");
+  length += generate(out + length, depth - 1);
+  length += sprintf(out + length, " %c ", operators[rand() % 4]);
+  length += generate(out + length, depth - 1);
+  return length + sprintf(out + length, ")");
+}
+
+static void generic(Chunk* chunk, Chunk* out) {
+  initChunk(out);
+  for (int i = 0; i < chunk->constants.count; i++) {
+    addConstant(out, chunk->constants.values[i]);
+  }
+  for (int offset = 0; offset < chunk->count;) {
+    uint8_t op = chunk->code[offset];
+    if (op >= OP_ADD_CONSTANT && op <= OP_DIVIDE_CONSTANT) {
+      writeChunk(out, OP_CONSTANT, 1);
+      writeChunk(out, chunk->code[offset + 1], 1);
+      writeChunk(out, (uint8_t)(op - OP_ADD_CONSTANT + OP_ADD), 1);
+      offset += 2;
+    } else if (op == OP_CONSTANT || op == OP_SMALL_INT ||
+               op == OP_GET_TEMP || op == OP_RESULT) {
+      writeChunk(out, op, 1);
+      writeChunk(out, chunk->code[offset + 1], 1);
+      offset += 2;
+    } else {
+      writeChunk(out, op, 1);
+      offset++;
+    }
+  }
+}
+
+static void measure(const char* name, Chunk* chunks) {
+  double best = 1e9;
+  double sum = 0;
+  for (int round = 0; round < 5; round++) {
+    double start = now();
+    sum = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+      for (int i = 0; i < EXPRESSIONS; i++) {
+        Value value;
+        runChunk(&chunks[i], &value);
+        sum += value;
+      }
+    }
+    double elapsed = now() - start;
+    if (elapsed < best) best = elapsed;
+  }
+
+  long bytes = 0;
+  for (int i = 0; i < EXPRESSIONS; i++) bytes += chunks[i].count;
+  printf("  %-12s %7.1f ns/expression  %6ld bytes of code  (sum %g)\n",
+         name, best / ((double)EXPRESSIONS * ROUNDS) * 1e9, bytes, sum);
+}
+
+static void measureDecoded(const char* name, Chunk* chunks,
+                           bool eachRun) {
+  static DecodedChunk decoded[EXPRESSIONS];
+  for (int i = 0; i < EXPRESSIONS; i++) {
+    initDecodedChunk(&decoded[i]);
+    decodeChunk(&decoded[i], &chunks[i], 0);
+  }
+
+  double best = 1e9;
+  double sum = 0;
+  for (int round = 0; round < 5; round++) {
+    double start = now();
+    sum = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+      for (int i = 0; i < EXPRESSIONS; i++) {
+        Value value;
+        if (eachRun) decodeChunk(&decoded[i], &chunks[i], 0);
+        runDecoded(&decoded[i], &value);
+        sum += value;
+      }
+    }
+    double elapsed = now() - start;
+    if (elapsed < best) best = elapsed;
+  }
+
+  long bytes = 0;
+  for (int i = 0; i < EXPRESSIONS; i++) {
+    bytes += decoded[i].count * (long)sizeof(DecodedInstruction);
+    freeDecodedChunk(&decoded[i]);
+  }
+  printf("  %-12s %7.1f ns/expression  %6ld bytes decoded  (sum %g)\n",
+         name, best / ((double)EXPRESSIONS * ROUNDS) * 1e9, bytes, sum);
+}
+
+int main() {
+  static Chunk compiled[EXPRESSIONS];
+  static Chunk expanded[EXPRESSIONS];
+  static Chunk fast[EXPRESSIONS];
+  char source[SOURCE_MAX];
+
+  initVM();
+  srand(5);
+  for (int i = 0; i < EXPRESSIONS; i++) {
+    int length = generate(source, 5);
+    initChunk(&compiled[i]);
+    compile(source, (size_t)length, &compiled[i]);
+    generic(&compiled[i], &expanded[i]);
+
+    compilerOptions.fastMath = true;
+    initChunk(&fast[i]);
+    compile(source, (size_t)length, &fast[i]);
+    compilerOptions.fastMath = false;
+  }
+
+  printf("vm: %d expressions, %d runs each\n", EXPRESSIONS, ROUNDS);
+  measure("generic", expanded);
+  measure("specialized", compiled);
+  measure("fast-math", fast);
+  measureDecoded("predecoded", compiled, false);
+  measureDecoded("decode+run", compiled, true);
+
+  for (int i = 0; i < EXPRESSIONS; i++) {
+    freeChunk(&compiled[i]);
+    freeChunk(&expanded[i]);
+    freeChunk(&fast[i]);
+  }
+  freeVM();
+  return 0;
+}
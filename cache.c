@@ -0,0 +1,93 @@
+#include <string.h>
+
+#include "cache.h"
+#include "compiler.h"
+#include "memory.h"
+
+// 64-bit FNV-1a.
+uint64_t hashSource(const char* source, size_t length) {
+  uint64_t hash = 14695981039346656037u;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (uint8_t)source[i];
+    hash *= 1099511628211u;
+  }
+  return hash;
+}
+
+void initChunkCache(ChunkCache* cache) {
+  cache->entries = GROW_ARRAY(CacheEntry, NULL, 0, CACHE_SLOTS);
+  for (int i = 0; i < CACHE_SLOTS; i++) {
+    cache->entries[i].source = NULL;
+    cache->entries[i].length = 0;
+    initDecodedChunk(&cache->entries[i].decoded);
+  }
+  cache->hits = 0;
+  cache->misses = 0;
+}
+
+static void clearEntry(CacheEntry* entry) {
+  if (entry->source == NULL) return;
+  FREE_ARRAY(char, entry->source, entry->length);
+  freeChunk(&entry->chunk);
+  entry->decoded.count = 0;
+  entry->source = NULL;
+  entry->length = 0;
+}
+
+void freeChunkCache(ChunkCache* cache) {
+  for (int i = 0; i < CACHE_SLOTS; i++) {
+    clearEntry(&cache->entries[i]);
+    freeDecodedChunk(&cache->entries[i].decoded);
+  }
+  FREE_ARRAY(CacheEntry, cache->entries, CACHE_SLOTS);
+  cache->entries = NULL;
+}
+
+// Returns the entry for source, compiling it on a miss, or NULL if it
+// doesn't compile. Failures aren't cached. The source is compared in
+// full on a hit, so a hash collision costs a recompile, never a wrong
+// answer. The entry stays valid until a later miss replaces it.
+CacheEntry* cachedEntry(ChunkCache* cache, const char* source,
+                        size_t length) {
+  uint64_t hash = hashSource(source, length);
+  CacheEntry* entry = &cache->entries[hash & (CACHE_SLOTS - 1)];
+  if (entry->source != NULL && entry->hash == hash &&
+      entry->length == length &&
+      memcmp(entry->source, source, length) == 0) {
+    cache->hits++;
+    return entry;
+  }
+
+  cache->misses++;
+  clearEntry(entry);
+
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, length, &chunk)) {
+    freeChunk(&chunk);
+    return NULL;
+  }
+
+  entry->hash = hash;
+  entry->length = length;
+  entry->source = GROW_ARRAY(char, NULL, 0, length);
+  memcpy(entry->source, source, length);
+  entry->chunk = chunk;
+  return entry;
+}
+
+Chunk* cachedChunk(ChunkCache* cache, const char* source,
+                   size_t length) {
+  CacheEntry* entry = cachedEntry(cache, source, length);
+  return entry != NULL ? &entry->chunk : NULL;
+}
+
+// Runs the entry's chunk. With predecodeChunks set it's decoded on the
+// first run only, and later runs go straight to runDecoded().
+InterpretResult runCacheEntry(CacheEntry* entry, Value* result) {
+  if (!predecodeChunks) return runChunk(&entry->chunk, result);
+  if (entry->decoded.count == 0) {
+    decodeChunk(&entry->decoded, &entry->chunk, 0);
+  }
+  return runDecoded(&entry->decoded, result);
+}
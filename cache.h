@@ -0,0 +1,36 @@
+#ifndef clox_cache_h
+#define clox_cache_h
+
+#include "chunk.h"
+#include "vm.h"
+
+#define CACHE_SLOTS 4096
+
+typedef struct {
+  uint64_t hash;
+  char* source;
+  size_t length;
+  Chunk chunk;
+  // chunk translated for runDecoded(), on its first run with
+  // predecodeChunks set, and kept as long as chunk is.
+  DecodedChunk decoded;
+} CacheEntry;
+
+// Compiled chunks keyed by a hash of their source. Direct-mapped, so
+// a miss simply replaces whatever shared the slot.
+typedef struct {
+  CacheEntry* entries;
+  uint64_t hits;
+  uint64_t misses;
+} ChunkCache;
+
+uint64_t hashSource(const char* source, size_t length);
+void initChunkCache(ChunkCache* cache);
+void freeChunkCache(ChunkCache* cache);
+CacheEntry* cachedEntry(ChunkCache* cache, const char* source,
+                        size_t length);
+Chunk* cachedChunk(ChunkCache* cache, const char* source,
+                   size_t length);
+InterpretResult runCacheEntry(CacheEntry* entry, Value* result);
+
+#endif
@@ -1,3 +1,4 @@
+#include <math.h>
 #include <stdlib.h>
 
 #include "chunk.h"
@@ -18,6 +19,13 @@ void freeChunk(Chunk* chunk) {
   initChunk(chunk);
 }
 
+// Drops code and constants past the given counts but keeps the memory
+// for what gets written next.
+void truncateChunk(Chunk* chunk, int count, int constantCount) {
+  chunk->count = count;
+  chunk->constants.count = constantCount;
+}
+
 void writeChunk(Chunk* chunk, uint8_t byte, int line) {
   if (chunk->capacity < chunk->count + 1) {
     int oldCapacity = chunk->capacity;
@@ -37,3 +45,22 @@ int addConstant(Chunk* chunk, Value value) {
   writeValueArray(&chunk->constants, value);
   return chunk->constants.count - 1;
 }
+
+// Writes the instruction that pushes value without a constant, if it
+// is a small enough integer. Returns false, writing nothing, if not.
+bool writeImmediate(Chunk* chunk, Value value, int line) {
+  if (value == 0 && signbit(value)) return false;
+
+  if (value == 0) {
+    writeChunk(chunk, OP_ZERO, line);
+  } else if (value == 1) {
+    writeChunk(chunk, OP_ONE, line);
+  } else if (value >= INT8_MIN && value <= INT8_MAX &&
+             value == (int8_t)value) {
+    writeChunk(chunk, OP_SMALL_INT, line);
+    writeChunk(chunk, (uint8_t)(int8_t)value, line);
+  } else {
+    return false;
+  }
+  return true;
+}
@@ -6,11 +6,30 @@
 
 typedef enum {
   OP_CONSTANT,
+  // Literals carried in the code instead of the constant pool: 0, 1
+  // and a signed byte. Never -0, which needs OP_CONSTANT.
+  OP_ZERO,
+  OP_ONE,
+  OP_SMALL_INT,
   OP_ADD,
   OP_SUBTRACT,
   OP_MULTIPLY,
   OP_DIVIDE,
+  // The four above with a constant right operand, in the same order.
+  OP_ADD_CONSTANT,
+  OP_SUBTRACT_CONSTANT,
+  OP_MULTIPLY_CONSTANT,
+  OP_DIVIDE_CONSTANT,
+  // a * b + c and a * b - c rounded once, for --fast-math.
+  OP_MULTIPLY_ADD,
+  OP_MULTIPLY_SUBTRACT,
   OP_NEGATE,
+  // Pushes a copy of the given stack slot.
+  OP_GET_TEMP,
+  // Writes out a statement's result, popping its value if the operand,
+  // an InterpretResult, is INTERPRET_OK, and empties the stack for the
+  // next statement in the chunk.
+  OP_RESULT,
   OP_RETURN,
 } OpCode;
 
@@ -24,7 +43,9 @@ typedef struct {
 
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
+void truncateChunk(Chunk* chunk, int count, int constantCount);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 int addConstant(Chunk* chunk, Value value);
+bool writeImmediate(Chunk* chunk, Value value, int line);
 
 #endif
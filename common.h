@@ -5,7 +5,10 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Benchmarks build with NDEBUG so they time the VM, not the tracing.
+#ifndef NDEBUG
 #define DEBUG_PRINT_CODE
 #define DEBUG_TRACE_EXECUTION
+#endif
 
 #endif
@@ -1,9 +1,14 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
 #include "compiler.h"
+#include "number.h"
+#include "perf.h"
 #include "scanner.h"
+#include "trace.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
@@ -14,6 +19,14 @@ typedef struct {
   Token previous;
   bool hadError;
   bool panicMode;
+  // When set, tokens come from here by index instead of scanToken().
+  TokenArray* tokens;
+  int next;
+  // Set while a --batch statement could start over in a fresh chunk,
+  // so running out of constants marks the chunk full instead of
+  // being an error.
+  bool canRestart;
+  bool chunkFull;
 } Parser;
 
 typedef enum {
@@ -40,6 +53,20 @@ typedef struct {
 
 Parser parser;
 Chunk* compilingChunk;
+CompilerOptions compilerOptions;
+CseStats cseStats;
+SimplifyStats simplifyStats;
+// Where the parser builds the expression when compilerOptions.cse is
+// set. Its memory is kept from one expression to the next.
+static ExprDag dag;
+// Offsets of the last OP_MULTIPLY and the last OP_*_CONSTANT emitted,
+// so binary() can tell whether its left operand ends with one.
+static int lastProduct;
+static int lastFolded;
+// Offsets of the last literal, however it was encoded, and the last
+// OP_NEGATE, so unary() can tell whether its operand ends with one.
+static int lastLiteral;
+static int lastNegate;
 
 static Chunk* currentChunk() {
   return compilingChunk;
@@ -74,7 +101,11 @@ static void advance() {
   parser.previous = parser.current;
 
   for (;;) {
-    parser.current = scanToken();
+    if (parser.tokens != NULL) {
+      parser.current = tokenAt(parser.tokens, parser.next++);
+    } else {
+      parser.current = scanToken();
+    }
     if (parser.current.type != TOKEN_ERROR) break;
 
     errorAtCurrent(parser.current.start);
@@ -90,6 +121,16 @@ static void consume(TokenType type, const char* message) {
   errorAtCurrent(message);
 }
 
+static bool check(TokenType type) {
+  return parser.current.type == type;
+}
+
+static bool match(TokenType type) {
+  if (!check(type)) return false;
+  advance();
+  return true;
+}
+
 static void emitByte(uint8_t byte) {
   writeChunk(currentChunk(), byte, parser.previous.line);
 }
@@ -103,10 +144,23 @@ static void emitReturn() {
   emitByte(OP_RETURN);
 }
 
+static void constantsFull() {
+  // A statement that already reported an error isn't compiled again,
+  // or the error would be reported twice; its code is dropped anyway.
+  if (parser.canRestart && !parser.hadError) {
+    // Quietly give up on the statement; it is compiled again.
+    parser.chunkFull = true;
+    parser.hadError = true;
+    parser.panicMode = true;
+  } else {
+    error("Too many constants in one chunk.");
+  }
+}
+
 static uint8_t makeConstant(Value value) {
   int constant = addConstant(currentChunk(), value);
   if (constant > UINT8_MAX) {
-    error("Too many constants in one chunk.");
+    constantsFull();
     return 0;
   }
 
@@ -117,7 +171,63 @@ static void emitConstant(Value value) {
   emitBytes(OP_CONSTANT, makeConstant(value));
 }
 
+// Small integers go in the code itself, everything else in the pool.
+static void emitLiteral(Value value) {
+  lastLiteral = currentChunk()->count;
+  if (!writeImmediate(currentChunk(), value, parser.previous.line)) {
+    emitConstant(value);
+  }
+}
+
+static int literalSize(uint8_t instruction) {
+  return instruction == OP_ZERO || instruction == OP_ONE ? 1 : 2;
+}
+
+static Value literalValue(int offset) {
+  uint8_t* code = currentChunk()->code + offset;
+  switch (code[0]) {
+    case OP_ZERO:      return 0;
+    case OP_ONE:       return 1;
+    case OP_SMALL_INT: return (int8_t)code[1];
+    default:           return currentChunk()->constants.values[code[1]];
+  }
+}
+
+// Whether the code from offset on is a single literal. Every
+// expression starts with one, so only the length needs checking.
+static bool isLoneLiteral(int offset) {
+  Chunk* chunk = currentChunk();
+  return lastLiteral >= 0 && lastLiteral == offset &&
+         chunk->count == offset + literalSize(chunk->code[offset]);
+}
+
+// Drops the lone literal at offset, and its constant if it had one of
+// its own, and hands back its value.
+static Value removeLiteral(int offset) {
+  Chunk* chunk = currentChunk();
+  Value value = literalValue(offset);
+  if (chunk->code[offset] == OP_CONSTANT &&
+      chunk->code[offset + 1] == chunk->constants.count - 1) {
+    chunk->constants.count--;
+  }
+  chunk->count = offset;
+  lastLiteral = -1;
+  return value;
+}
+
+static void beginExpression() {
+  if (compilerOptions.cse) resetExprDag(&dag);
+  lastProduct = -1;
+  lastFolded = -1;
+  lastLiteral = -1;
+  lastNegate = -1;
+}
+
 static void endCompiler() {
+  if (compilerOptions.cse && !parser.hadError &&
+      !emitExprDag(&dag, currentChunk(), &cseStats)) {
+    constantsFull();
+  }
 #ifdef DEBUG_PRINT_CODE
   if (!parser.hadError) {
     disassembleChunk(currentChunk(), "code");
@@ -130,18 +240,188 @@ static void expression();
 static ParseRule* getRule(TokenType type);
 static void parsePrecedence(Precedence precedence);
 
+// Fast math only. When the left operand ends in a multiply, leaves
+// both factors on the stack instead and has op round a * b + c or
+// a * b - c once through fma(). An OP_MULTIPLY is dropped, sliding the
+// right operand's code down a byte; an OP_MULTIPLY_CONSTANT becomes
+// the OP_CONSTANT it was folded from.
+static bool fuseMultiply(OpCode op, int rightStart, bool leftProduct,
+                         bool leftFolded) {
+  Chunk* chunk = currentChunk();
+  if (op != OP_ADD && op != OP_SUBTRACT) return false;
+
+  if (leftProduct) {
+    int product = rightStart - 1;
+    int tail = chunk->count - rightStart;
+    memmove(chunk->code + product, chunk->code + rightStart,
+            (size_t)tail);
+    memmove(chunk->lines + product, chunk->lines + rightStart,
+            sizeof(int) * (size_t)tail);
+    chunk->count--;
+  } else if (leftFolded &&
+             chunk->code[rightStart - 2] == OP_MULTIPLY_CONSTANT) {
+    chunk->code[rightStart - 2] = OP_CONSTANT;
+  } else {
+    return false;
+  }
+
+  // Offsets recorded inside the right operand may have moved.
+  lastProduct = -1;
+  lastFolded = -1;
+  lastLiteral = -1;
+  lastNegate = -1;
+  emitByte(op == OP_ADD ? OP_MULTIPLY_ADD : OP_MULTIPLY_SUBTRACT);
+  return true;
+}
+
+// Fast math only. Rewrites (e op1 k1) op2 k2, both literals, as one
+// instruction on a combined constant: additions and subtractions
+// become a single addition, and repeated multiplies or divides one of
+// the same. The constant for k1 is reused and k2's is dropped.
+static bool reassociate(OpCode op, int folded, uint8_t right) {
+  Chunk* chunk = currentChunk();
+  OpCode first = (OpCode)(chunk->code[folded] - OP_ADD_CONSTANT + OP_ADD);
+  uint8_t left = chunk->code[folded + 1];
+  Value* values = chunk->constants.values;
+
+  Value combined;
+  OpCode combinedOp;
+  if ((first == OP_ADD || first == OP_SUBTRACT) &&
+      (op == OP_ADD || op == OP_SUBTRACT)) {
+    combined = (first == OP_ADD ? values[left] : -values[left]) +
+               (op == OP_ADD ? values[right] : -values[right]);
+    combinedOp = OP_ADD;
+  } else if (first == op && (op == OP_MULTIPLY || op == OP_DIVIDE)) {
+    combined = values[left] * values[right];
+    combinedOp = op;
+  } else {
+    return false;
+  }
+
+  values[left] = combined;
+  if (right == chunk->constants.count - 1) chunk->constants.count--;
+  chunk->code[folded] = (uint8_t)(combinedOp + OP_ADD_CONSTANT - OP_ADD);
+  chunk->count = folded + 2;
+  return true;
+}
+
+// x + -0, x - 0, x * 1 and x / 1 are x exactly, -0, NaN and infinities
+// included. x + 0 is not: -0 + 0 is +0.
+static bool isIdentity(OpCode op, Value value) {
+  switch (op) {
+    case OP_ADD:      return value == 0 && signbit(value);
+    case OP_SUBTRACT: return value == 0 && !signbit(value);
+    case OP_MULTIPLY:
+    case OP_DIVIDE:   return value == 1;
+    default:          return false;
+  }
+}
+
+// Rewrites x op k, k a literal, for --simplify. Returns true if the
+// operation is an identity and can go; otherwise a division by a power
+// of two may become a multiply by its reciprocal, which is exact, so
+// both round the same and the cheaper instruction runs.
+static bool simplifyLiteral(OpCode* op, uint8_t constant) {
+  Value* value = &currentChunk()->constants.values[constant];
+  if (isIdentity(*op, *value)) {
+    simplifyStats.identities++;
+    return true;
+  }
+
+  int exponent;
+  double fraction = frexp(*value, &exponent);
+  if (*op == OP_DIVIDE && (fraction == 0.5 || fraction == -0.5) &&
+      isfinite(1 / *value)) {
+    *value = 1 / *value;
+    *op = OP_MULTIPLY;
+    simplifyStats.reciprocals++;
+  }
+  return false;
+}
+
+// For --simplify: -(-x) is x, and a negated literal is the negative
+// literal. Either way no OP_NEGATE is needed. Not x * -1 to -x, nor
+// x + -y to x - y: those can flip the sign of a NaN, which prints.
+static bool simplifyNegate() {
+  Chunk* chunk = currentChunk();
+  if (lastNegate >= 0 && lastNegate == chunk->count - 1) {
+    chunk->count--;
+    lastNegate = -1;
+  } else if (lastLiteral >= 0 && isLoneLiteral(lastLiteral)) {
+    emitLiteral(-removeLiteral(lastLiteral));
+  } else {
+    return false;
+  }
+  simplifyStats.negations++;
+  return true;
+}
+
 static void binary() {
   TokenType operatorType = parser.previous.type;
   ParseRule* rule = getRule(operatorType);
+  int rightStart = currentChunk()->count;
+  int line = parser.previous.line;
+  // Whether the left operand ends in a multiply or a folded constant,
+  // checked before the right operand emits its own.
+  bool leftProduct = lastProduct >= 0 && lastProduct == rightStart - 1;
+  bool leftFolded = lastFolded >= 0 && lastFolded == rightStart - 2;
+  int leftLiteral = lastLiteral;
   parsePrecedence((Precedence)(rule->precedence + 1));
 
+  OpCode op;
   switch (operatorType) {
-    case TOKEN_PLUS:          emitByte(OP_ADD); break;
-    case TOKEN_MINUS:         emitByte(OP_SUBTRACT); break;
-    case TOKEN_STAR:          emitByte(OP_MULTIPLY); break;
-    case TOKEN_SLASH:         emitByte(OP_DIVIDE); break;
+    case TOKEN_PLUS:          op = OP_ADD; break;
+    case TOKEN_MINUS:         op = OP_SUBTRACT; break;
+    case TOKEN_STAR:          op = OP_MULTIPLY; break;
+    case TOKEN_SLASH:         op = OP_DIVIDE; break;
     default: return; // Unreachable.
   }
+
+  if (compilerOptions.cse) {
+    dagBinary(&dag, op, line);
+    return;
+  }
+
+  if (compilerOptions.fastMath &&
+      fuseMultiply(op, rightStart, leftProduct, leftFolded)) {
+    return;
+  }
+
+  // When the right operand is a lone literal, its OP_CONSTANT folds
+  // into the operator: one dispatch instead of two.
+  Chunk* chunk = currentChunk();
+  if (isLoneLiteral(rightStart)) {
+    uint8_t constant;
+    if (chunk->code[rightStart] == OP_CONSTANT) {
+      constant = chunk->code[rightStart + 1];
+      chunk->count = rightStart;
+      lastLiteral = -1;
+    } else {
+      constant = makeConstant(removeLiteral(rightStart));
+    }
+    // Out of constants, constant is a stand-in that earlier code in a
+    // batch may still read, so nothing rewrites it.
+    bool owned = !parser.hadError;
+    if (compilerOptions.simplify && owned &&
+        simplifyLiteral(&op, constant)) {
+      // Only the left operand is left.
+      if (constant == chunk->constants.count - 1) {
+        chunk->constants.count--;
+      }
+      lastLiteral = leftLiteral;
+      return;
+    }
+    if (compilerOptions.fastMath && leftFolded && owned &&
+        reassociate(op, rightStart - 2, constant)) {
+      return;
+    }
+    lastFolded = chunk->count;
+    emitBytes((uint8_t)(op + OP_ADD_CONSTANT - OP_ADD), constant);
+  } else {
+    lastLiteral = -1;
+    if (op == OP_MULTIPLY) lastProduct = chunk->count;
+    emitByte(op);
+  }
 }
 
 static void grouping() {
@@ -150,19 +430,33 @@ static void grouping() {
 }
 
 static void number() {
-  double value = strtod(parser.previous.start, NULL);
-  emitConstant(value);
+  double value = parseNumber(parser.previous.start,
+                             parser.previous.length);
+  if (compilerOptions.cse) {
+    dagLiteral(&dag, value, parser.previous.line);
+  } else {
+    emitLiteral(value);
+  }
 }
 
 static void unary() {
   TokenType operatorType = parser.previous.type;
+  int line = parser.previous.line;
 
   // Compile the operand.
   parsePrecedence(PREC_UNARY);
 
   // Emit the operator instruction.
   switch (operatorType) {
-    case TOKEN_MINUS: emitByte(OP_NEGATE); break;
+    case TOKEN_MINUS:
+      if (compilerOptions.cse) {
+        dagUnary(&dag, OP_NEGATE, line);
+      } else if (!compilerOptions.simplify || !simplifyNegate()) {
+        lastLiteral = -1;
+        lastNegate = currentChunk()->count;
+        emitByte(OP_NEGATE);
+      }
+      break;
     default: return; // Unreachable.
   }
 }
@@ -235,16 +529,240 @@ static void expression() {
   parsePrecedence(PREC_ASSIGNMENT);
 }
 
-bool compile(const char* source, Chunk* chunk) {
-  initScanner(source);
+static void synchronize() {
+  parser.panicMode = false;
+
+  while (parser.current.type != TOKEN_EOF) {
+    if (parser.previous.type == TOKEN_SEMICOLON) return;
+    advance();
+  }
+}
+
+static bool compileExpression(Chunk* chunk) {
   compilingChunk = chunk;
 
   parser.hadError = false;
   parser.panicMode = false;
 
   advance();
+  beginExpression();
   expression();
   consume(TOKEN_EOF, "Expect end of expression.");
   endCompiler();
   return !parser.hadError;
 }
+
+static bool scanTokens(const char* source, size_t length,
+                       TokenArray* tokens) {
+  TRACE_BEGIN("scan");
+  perfBegin(PERF_SCAN);
+  bool scanned = scanAllParallel(source, length, tokens,
+                                 compilerOptions.lexThreads);
+  perfEnd(PERF_SCAN);
+  TRACE_END();
+  return scanned;
+}
+
+bool compile(const char* source, size_t length, Chunk* chunk) {
+  TRACE_BEGIN("compile");
+  perfBegin(PERF_COMPILE);
+  bool compiled;
+  TokenArray tokens;
+  if (compilerOptions.pretokenize &&
+      scanTokens(source, length, &tokens)) {
+    compiled = compileTokens(&tokens, chunk);
+    freeTokenArray(&tokens);
+  } else {
+    initScannerRange(source, length);
+    parser.tokens = NULL;
+    compiled = compileExpression(chunk);
+  }
+  perfEnd(PERF_COMPILE);
+  TRACE_END();
+  return compiled;
+}
+
+bool compileTokens(TokenArray* tokens, Chunk* chunk) {
+  parser.tokens = tokens;
+  parser.next = 0;
+  bool compiled = compileExpression(chunk);
+  parser.tokens = NULL;
+  return compiled;
+}
+
+void beginStatements() {
+  parser.tokens = NULL;
+  parser.hadError = false;
+  parser.panicMode = false;
+  advance();
+}
+
+bool atEndOfStatements() {
+  return check(TOKEN_EOF);
+}
+
+// Compiles the next ';'-terminated expression from wherever the
+// scanner is reading. The last one in the stream may omit the ';'.
+bool compileStatement(Chunk* chunk) {
+  TRACE_BEGIN("compile");
+  perfBegin(PERF_COMPILE);
+  compilingChunk = chunk;
+  parser.hadError = false;
+
+  beginExpression();
+  expression();
+  if (!match(TOKEN_SEMICOLON) && !check(TOKEN_EOF)) {
+    errorAtCurrent("Expect ';' after expression.");
+  }
+
+  if (parser.panicMode) synchronize();
+  endCompiler();
+  perfEnd(PERF_COMPILE);
+  TRACE_END();
+  return !parser.hadError;
+}
+
+// Starts compileBatch() on source, which stays in memory so that it
+// can go back to the start of a statement.
+// The index of the batch's next statement, for its trace span.
+static int batchStatement = 0;
+
+void beginBatch(const char* source, size_t length) {
+  initScannerRange(source, length);
+  beginStatements();
+  batchStatement = 0;
+}
+
+// The constants already interned into the batch's chunk, by a hash of
+// their bits, so 0 and -0 stay apart. Twice as many slots as a pool
+// can hold keeps probes short.
+#define INTERN_BITS 9
+#define INTERN_SLOTS (1 << INTERN_BITS)
+
+static int16_t interned[INTERN_SLOTS];
+
+static int16_t* internSlot(ValueArray* constants, Value value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  // The product's top bits, which every bit of the value reaches: round
+  // numbers have nothing but zeros in their low ones.
+  uint32_t slot = (uint32_t)((bits * 0x9e3779b97f4a7c15u) >>
+                             (64 - INTERN_BITS));
+  for (;;) {
+    int16_t* entry = &interned[slot];
+    if (*entry < 0 || memcmp(&constants->values[*entry], &value,
+                             sizeof(Value)) == 0) {
+      return entry;
+    }
+    slot = (slot + 1) % INTERN_SLOTS;
+  }
+}
+
+// Points the constant operands of the code from codeStart on at equal
+// constants already in the pool, and drops the copies. Done once the
+// statement is compiled: until then, folding may still rewrite or
+// drop its own constants, which must not be shared yet.
+static void internConstants(int codeStart, int constantStart) {
+  Chunk* chunk = currentChunk();
+  ValueArray* constants = &chunk->constants;
+  if (constantStart == 0) {
+    for (int i = 0; i < INTERN_SLOTS; i++) interned[i] = -1;
+  }
+
+  uint8_t moved[UINT8_MAX + 1];
+  int count = constantStart;
+  for (int i = constantStart; i < constants->count; i++) {
+    Value value = constants->values[i];
+    int16_t* entry = internSlot(constants, value);
+    if (*entry < 0) {
+      constants->values[count] = value;
+      *entry = (int16_t)count++;
+    }
+    moved[i] = (uint8_t)*entry;
+  }
+  constants->count = count;
+
+  for (int offset = codeStart; offset < chunk->count;) {
+    uint8_t op = chunk->code[offset];
+    if (op == OP_CONSTANT ||
+        (op >= OP_ADD_CONSTANT && op <= OP_DIVIDE_CONSTANT)) {
+      uint8_t* constant = &chunk->code[offset + 1];
+      if (*constant >= constantStart) *constant = moved[*constant];
+    }
+    offset += op == OP_CONSTANT || op == OP_SMALL_INT ||
+              op == OP_GET_TEMP || op == OP_RESULT ||
+              (op >= OP_ADD_CONSTANT && op <= OP_DIVIDE_CONSTANT)
+              ? 2 : 1;
+  }
+}
+
+// Compiles the ';'-separated statements after beginBatch() into chunk,
+// each ending in an OP_RESULT, for as long as their constants fit in
+// its one shared pool. The statement that doesn't fit is left for the
+// next chunk. One that fails to compile becomes an OP_RESULT with a
+// compile error, so every statement gets its result in order. Returns
+// false if any failed.
+bool compileBatch(Chunk* chunk) {
+  TRACE_BEGIN("compile");
+  perfBegin(PERF_COMPILE);
+  compilingChunk = chunk;
+  bool compiled = true;
+
+  while (!check(TOKEN_EOF)) {
+    TRACE_BEGIN_ITEM("statement", batchStatement);
+    // Enough to go back to this statement's first token.
+    Token first = parser.current;
+    ScannerMark mark = markScanner();
+    // And to count it only once.
+    CseStats cse = cseStats;
+    SimplifyStats simplify = simplifyStats;
+
+    int codeStart = chunk->count;
+    int constantStart = chunk->constants.count;
+    parser.hadError = false;
+    parser.panicMode = false;
+    parser.canRestart = codeStart > 0;
+    parser.chunkFull = false;
+
+    beginExpression();
+    expression();
+    if (!match(TOKEN_SEMICOLON) && !check(TOKEN_EOF)) {
+      errorAtCurrent("Expect ';' after expression.");
+    }
+    if (parser.panicMode) synchronize();
+    if (compilerOptions.cse && !parser.hadError &&
+        !emitExprDag(&dag, chunk, &cseStats)) {
+      constantsFull();
+    }
+
+    if (parser.hadError) truncateChunk(chunk, codeStart, constantStart);
+    if (parser.chunkFull) {
+      parser.current = first;
+      rewindScanner(mark);
+      cseStats = cse;
+      simplifyStats = simplify;
+      TRACE_END();
+      break;
+    }
+    if (parser.hadError) {
+      compiled = false;
+      emitBytes(OP_RESULT, INTERPRET_COMPILE_ERROR);
+    } else {
+      internConstants(codeStart, constantStart);
+      emitBytes(OP_RESULT, INTERPRET_OK);
+    }
+    batchStatement++;
+    TRACE_END();
+  }
+  parser.canRestart = false;
+
+  // The results are all written; OP_RETURN needs something to pop.
+  emitByte(OP_ZERO);
+  emitReturn();
+#ifdef DEBUG_PRINT_CODE
+  disassembleChunk(chunk, "batch");
+#endif
+  perfEnd(PERF_COMPILE);
+  TRACE_END();
+  return compiled;
+}
@@ -1,8 +1,45 @@
 #ifndef clox_compiler_h
 #define clox_compiler_h
 
+#include "dag.h"
+#include "tokens.h"
 #include "vm.h"
 
-bool compile(const char* source, Chunk* chunk);
+typedef struct {
+  // Lex the whole source into a TokenArray before parsing it.
+  bool pretokenize;
+  // Threads to split that lexing across.
+  int lexThreads;
+  // Build each expression as a DAG and compute repeated subexpressions
+  // only once.
+  bool cse;
+  // Let results differ from strict IEEE evaluation in the last bits:
+  // fuse a * b + c into one fma() and combine chained constants.
+  bool fastMath;
+  // Drop identities such as x * 1, turn divisions by powers of two
+  // into multiplies and fold away negations, all without changing any
+  // result.
+  bool simplify;
+} CompilerOptions;
+
+// How often each rewrite of compilerOptions.simplify fired.
+typedef struct {
+  int64_t identities;
+  int64_t reciprocals;
+  int64_t negations;
+} SimplifyStats;
+
+extern CompilerOptions compilerOptions;
+// What the DAG stage saved, summed over everything compiled with cse.
+extern CseStats cseStats;
+extern SimplifyStats simplifyStats;
+
+bool compile(const char* source, size_t length, Chunk* chunk);
+bool compileTokens(TokenArray* tokens, Chunk* chunk);
+void beginStatements();
+bool atEndOfStatements();
+bool compileStatement(Chunk* chunk);
+void beginBatch(const char* source, size_t length);
+bool compileBatch(Chunk* chunk);
 
 #endif
@@ -0,0 +1,258 @@
+#include <string.h>
+
+#include "dag.h"
+#include "memory.h"
+
+void initExprDag(ExprDag* dag) {
+  dag->count = 0;
+  dag->capacity = 0;
+  dag->nodes = NULL;
+  dag->table = NULL;
+  dag->tableCapacity = 0;
+  dag->operands = NULL;
+  dag->operandCount = 0;
+  dag->operandCapacity = 0;
+}
+
+void freeExprDag(ExprDag* dag) {
+  FREE_ARRAY(DagNode, dag->nodes, dag->capacity);
+  FREE_ARRAY(int, dag->table, dag->tableCapacity);
+  FREE_ARRAY(int, dag->operands, dag->operandCapacity);
+  initExprDag(dag);
+}
+
+// Empties the DAG but keeps its memory for the next expression.
+void resetExprDag(ExprDag* dag) {
+  dag->count = 0;
+  dag->operandCount = 0;
+  for (int i = 0; i < dag->tableCapacity; i++) dag->table[i] = -1;
+}
+
+// Literals are keyed by their bits, so 0 and -0 stay apart and a NaN
+// only matches itself.
+static uint64_t hashNode(uint8_t op, int left, int right, Value value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint64_t hash = bits ^ ((uint64_t)op << 56);
+  hash = (hash ^ (uint32_t)left) * 0x9E3779B97F4A7C15u;
+  hash = (hash ^ (uint32_t)right) * 0x9E3779B97F4A7C15u;
+  return hash ^ (hash >> 29);
+}
+
+static bool sameNode(DagNode* node, uint8_t op, int left, int right,
+                     Value value) {
+  return node->op == op && node->left == left && node->right == right &&
+         memcmp(&node->value, &value, sizeof(Value)) == 0;
+}
+
+static void growTable(ExprDag* dag) {
+  int oldCapacity = dag->tableCapacity;
+  dag->tableCapacity = GROW_CAPACITY(oldCapacity);
+  dag->table = GROW_ARRAY(int, dag->table, oldCapacity,
+                          dag->tableCapacity);
+  for (int i = 0; i < dag->tableCapacity; i++) dag->table[i] = -1;
+
+  int mask = dag->tableCapacity - 1;
+  for (int i = 0; i < dag->count; i++) {
+    DagNode* node = &dag->nodes[i];
+    int slot = (int)(hashNode(node->op, node->left, node->right,
+                              node->value) & (uint64_t)mask);
+    while (dag->table[slot] != -1) slot = (slot + 1) & mask;
+    dag->table[slot] = i;
+  }
+}
+
+static void pushOperand(ExprDag* dag, int index) {
+  if (dag->operandCapacity < dag->operandCount + 1) {
+    int oldCapacity = dag->operandCapacity;
+    dag->operandCapacity = GROW_CAPACITY(oldCapacity);
+    dag->operands = GROW_ARRAY(int, dag->operands, oldCapacity,
+                               dag->operandCapacity);
+  }
+  dag->operands[dag->operandCount++] = index;
+}
+
+// After a syntax error there may be nothing to pop. The DAG is never
+// emitted then, so -1 only has to be harmless.
+static int popOperand(ExprDag* dag) {
+  if (dag->operandCount == 0) return -1;
+  return dag->operands[--dag->operandCount];
+}
+
+// Returns the node for the given operator and operands, adding it
+// only if an identical one isn't already there. Only a new node adds
+// a use to its operands: a repeated subtree shares its children, so
+// they gain no extra edge.
+static int addNode(ExprDag* dag, uint8_t op, int left, int right,
+                   Value value, int line) {
+  if ((dag->count + 1) * 4 > dag->tableCapacity * 3) growTable(dag);
+
+  int mask = dag->tableCapacity - 1;
+  int slot = (int)(hashNode(op, left, right, value) & (uint64_t)mask);
+  for (;;) {
+    int index = dag->table[slot];
+    if (index == -1) break;
+    if (sameNode(&dag->nodes[index], op, left, right, value)) {
+      return index;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  if (dag->capacity < dag->count + 1) {
+    int oldCapacity = dag->capacity;
+    dag->capacity = GROW_CAPACITY(oldCapacity);
+    dag->nodes = GROW_ARRAY(DagNode, dag->nodes, oldCapacity,
+                            dag->capacity);
+  }
+
+  int index = dag->count++;
+  DagNode* node = &dag->nodes[index];
+  node->op = op;
+  node->left = left;
+  node->right = right;
+  node->value = value;
+  node->line = line;
+  node->uses = 0;
+  node->temp = -1;
+  node->constant = -1;
+  if (left >= 0) dag->nodes[left].uses++;
+  if (right >= 0) dag->nodes[right].uses++;
+  dag->table[slot] = index;
+  return index;
+}
+
+void dagLiteral(ExprDag* dag, Value value, int line) {
+  pushOperand(dag, addNode(dag, OP_CONSTANT, -1, -1, value, line));
+}
+
+void dagUnary(ExprDag* dag, OpCode op, int line) {
+  int operand = popOperand(dag);
+  pushOperand(dag, addNode(dag, (uint8_t)op, operand, -1, 0, line));
+}
+
+void dagBinary(ExprDag* dag, OpCode op, int line) {
+  int right = popOperand(dag);
+  int left = popOperand(dag);
+  pushOperand(dag, addNode(dag, (uint8_t)op, left, right, 0, line));
+}
+
+static bool isLiteral(ExprDag* dag, int index) {
+  return dag->nodes[index].op == OP_CONSTANT;
+}
+
+// A literal right operand folds into the operator, as compiler.c's
+// binary() does, unless it was made a temp.
+static bool foldsRight(ExprDag* dag, DagNode* node) {
+  return node->right >= 0 && isLiteral(dag, node->right) &&
+         dag->nodes[node->right].temp < 0;
+}
+
+static int64_t operandCost(ExprDag* dag, int index) {
+  DagNode* node = &dag->nodes[index];
+  return node->temp >= 0 ? 1 : node->cost;
+}
+
+// Walks the nodes children first, sizing each and deciding whether it
+// is worth a temp. Defining a temp costs the node once plus one
+// OP_GET_TEMP per use, against the node in full at every use.
+static void planTemps(ExprDag* dag) {
+  int temps = 0;
+  for (int i = 0; i < dag->count; i++) {
+    DagNode* node = &dag->nodes[i];
+    if (node->op == OP_CONSTANT) {
+      node->treeSize = 1;
+      node->cost = 1;
+      continue;
+    }
+
+    node->treeSize = dag->nodes[node->left].treeSize + 1;
+    node->cost = operandCost(dag, node->left) + 1;
+    if (node->right >= 0 && !isLiteral(dag, node->right)) {
+      node->treeSize += dag->nodes[node->right].treeSize;
+    }
+    if (node->right >= 0 && !foldsRight(dag, node)) {
+      node->cost += operandCost(dag, node->right);
+    }
+
+    if (node->uses > 1 && temps < DAG_MAX_TEMPS &&
+        node->cost * (node->uses - 1) > node->uses) {
+      node->temp = temps++;
+    }
+  }
+}
+
+static bool emitOperand(ExprDag* dag, Chunk* chunk, int index,
+                        int64_t* emitted);
+
+static bool emitConstantOf(Chunk* chunk, DagNode* node, uint8_t op) {
+  if (node->constant < 0) {
+    node->constant = addConstant(chunk, node->value);
+    if (node->constant > UINT8_MAX) return false;
+  }
+  writeChunk(chunk, op, node->line);
+  writeChunk(chunk, (uint8_t)node->constant, node->line);
+  return true;
+}
+
+// Emits the node's own computation, reading any operands that are
+// temps back from their slots.
+static bool emitNode(ExprDag* dag, Chunk* chunk, int index,
+                     int64_t* emitted) {
+  DagNode* node = &dag->nodes[index];
+  (*emitted)++;
+  if (node->op == OP_CONSTANT) {
+    if (writeImmediate(chunk, node->value, node->line)) return true;
+    return emitConstantOf(chunk, node, OP_CONSTANT);
+  }
+
+  if (!emitOperand(dag, chunk, node->left, emitted)) return false;
+  if (node->right < 0) {
+    writeChunk(chunk, node->op, node->line);
+    return true;
+  }
+
+  if (foldsRight(dag, node)) {
+    return emitConstantOf(chunk, &dag->nodes[node->right],
+        (uint8_t)(node->op + OP_ADD_CONSTANT - OP_ADD));
+  }
+  if (!emitOperand(dag, chunk, node->right, emitted)) return false;
+  writeChunk(chunk, node->op, node->line);
+  return true;
+}
+
+static bool emitOperand(ExprDag* dag, Chunk* chunk, int index,
+                        int64_t* emitted) {
+  DagNode* node = &dag->nodes[index];
+  if (node->temp < 0) return emitNode(dag, chunk, index, emitted);
+
+  (*emitted)++;
+  writeChunk(chunk, OP_GET_TEMP, node->line);
+  writeChunk(chunk, (uint8_t)node->temp, node->line);
+  return true;
+}
+
+// Emits code leaving the expression's value on top of the stack. The
+// temps are computed first, in order, so temp n ends up in stack slot
+// n beneath everything else. Returns false if the chunk runs out of
+// constants.
+bool emitExprDag(ExprDag* dag, Chunk* chunk, CseStats* stats) {
+  if (dag->operandCount == 0) return true;
+
+  int root = dag->operands[dag->operandCount - 1];
+  dag->nodes[root].uses++;
+  planTemps(dag);
+
+  int64_t emitted = 0;
+  for (int i = 0; i < dag->count; i++) {
+    if (dag->nodes[i].temp < 0) continue;
+    if (!emitNode(dag, chunk, i, &emitted)) return false;
+  }
+
+  if (!emitOperand(dag, chunk, root, &emitted)) return false;
+
+  if (stats != NULL) {
+    stats->treeInstructions += dag->nodes[root].treeSize;
+    stats->emittedInstructions += emitted;
+  }
+  return true;
+}
@@ -0,0 +1,57 @@
+#ifndef clox_dag_h
+#define clox_dag_h
+
+#include "chunk.h"
+
+#define DAG_MAX_TEMPS 128
+
+typedef struct {
+  // OP_CONSTANT for a literal, otherwise the operator.
+  uint8_t op;
+  int left;
+  int right;
+  Value value;
+  int line;
+  // Edges into this node from distinct parents, plus one for the root.
+  int uses;
+  // Set while emitting: the stack slot holding the node's value, and
+  // the constant a literal was given. -1 until assigned.
+  int temp;
+  int constant;
+  // Instructions to compute the node as a tree, and as emitted given
+  // which of its operands are temps.
+  int64_t treeSize;
+  int64_t cost;
+} DagNode;
+
+// An expression as a DAG: the parser pushes literals and operators in
+// postfix order, and identical subtrees are hash-consed to one node.
+// Nodes only ever refer to earlier ones, so index order is a
+// topological order.
+typedef struct {
+  int count;
+  int capacity;
+  DagNode* nodes;
+  int* table;
+  int tableCapacity;
+  int* operands;
+  int operandCount;
+  int operandCapacity;
+} ExprDag;
+
+// Instructions a plain tree walk would have emitted, and how many the
+// DAG actually did, not counting OP_RETURN.
+typedef struct {
+  int64_t treeInstructions;
+  int64_t emittedInstructions;
+} CseStats;
+
+void initExprDag(ExprDag* dag);
+void freeExprDag(ExprDag* dag);
+void resetExprDag(ExprDag* dag);
+void dagLiteral(ExprDag* dag, Value value, int line);
+void dagUnary(ExprDag* dag, OpCode op, int line);
+void dagBinary(ExprDag* dag, OpCode op, int line);
+bool emitExprDag(ExprDag* dag, Chunk* chunk, CseStats* stats);
+
+#endif
@@ -6,6 +6,9 @@
 static int constantInstruction(const char* name, Chunk* chunk,
                                int offset);
 static int simpleInstruction(const char* name, int offset);
+static int byteInstruction(const char* name, Chunk* chunk, int offset);
+static int immediateInstruction(const char* name, Chunk* chunk,
+                                int offset);
 
 void disassembleChunk(Chunk* chunk, const char* name) {
   printf("== %s ==\n", name);
@@ -15,6 +18,30 @@ void disassembleChunk(Chunk* chunk, const char* name) {
   }
 }
 
+const char* opcodeName(uint8_t instruction) {
+  switch (instruction) {
+    case OP_CONSTANT:          return "OP_CONSTANT";
+    case OP_ZERO:              return "OP_ZERO";
+    case OP_ONE:               return "OP_ONE";
+    case OP_SMALL_INT:         return "OP_SMALL_INT";
+    case OP_ADD:               return "OP_ADD";
+    case OP_SUBTRACT:          return "OP_SUBTRACT";
+    case OP_MULTIPLY:          return "OP_MULTIPLY";
+    case OP_DIVIDE:            return "OP_DIVIDE";
+    case OP_ADD_CONSTANT:      return "OP_ADD_CONSTANT";
+    case OP_SUBTRACT_CONSTANT: return "OP_SUBTRACT_CONSTANT";
+    case OP_MULTIPLY_CONSTANT: return "OP_MULTIPLY_CONSTANT";
+    case OP_DIVIDE_CONSTANT:   return "OP_DIVIDE_CONSTANT";
+    case OP_MULTIPLY_ADD:      return "OP_MULTIPLY_ADD";
+    case OP_MULTIPLY_SUBTRACT: return "OP_MULTIPLY_SUBTRACT";
+    case OP_NEGATE:            return "OP_NEGATE";
+    case OP_GET_TEMP:          return "OP_GET_TEMP";
+    case OP_RESULT:            return "OP_RESULT";
+    case OP_RETURN:            return "OP_RETURN";
+  }
+  return "OP_UNKNOWN";
+}
+
 int disassembleInstruction(Chunk* chunk, int offset) {
   printf("%04d ", offset);
 
@@ -29,6 +56,12 @@ int disassembleInstruction(Chunk* chunk, int offset) {
   switch (instruction) {
     case OP_CONSTANT:
       return constantInstruction("OP_CONSTANT", chunk, offset);
+    case OP_ZERO:
+      return simpleInstruction("OP_ZERO", offset);
+    case OP_ONE:
+      return simpleInstruction("OP_ONE", offset);
+    case OP_SMALL_INT:
+      return immediateInstruction("OP_SMALL_INT", chunk, offset);
     case OP_ADD:
       return simpleInstruction("OP_ADD", offset);
     case OP_SUBTRACT:
@@ -37,8 +70,24 @@ int disassembleInstruction(Chunk* chunk, int offset) {
       return simpleInstruction("OP_MULTIPLY", offset);
     case OP_DIVIDE:
       return simpleInstruction("OP_DIVIDE", offset);
+    case OP_ADD_CONSTANT:
+      return constantInstruction("OP_ADD_CONSTANT", chunk, offset);
+    case OP_SUBTRACT_CONSTANT:
+      return constantInstruction("OP_SUBTRACT_CONSTANT", chunk, offset);
+    case OP_MULTIPLY_CONSTANT:
+      return constantInstruction("OP_MULTIPLY_CONSTANT", chunk, offset);
+    case OP_DIVIDE_CONSTANT:
+      return constantInstruction("OP_DIVIDE_CONSTANT", chunk, offset);
+    case OP_MULTIPLY_ADD:
+      return simpleInstruction("OP_MULTIPLY_ADD", offset);
+    case OP_MULTIPLY_SUBTRACT:
+      return simpleInstruction("OP_MULTIPLY_SUBTRACT", offset);
     case OP_NEGATE:
       return simpleInstruction("OP_NEGATE", offset);
+    case OP_GET_TEMP:
+      return byteInstruction("OP_GET_TEMP", chunk, offset);
+    case OP_RESULT:
+      return byteInstruction("OP_RESULT", chunk, offset);
     case OP_RETURN:
       return simpleInstruction("OP_RETURN", offset);
     default:
@@ -60,3 +109,17 @@ static int simpleInstruction(const char* name, int offset) {
   printf("%s\n", name);
   return offset + 1;
 }
+
+static int byteInstruction(const char* name, Chunk* chunk,
+                           int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  printf("%-16s %4d\n", name, slot);
+  return offset + 2;
+}
+
+static int immediateInstruction(const char* name, Chunk* chunk,
+                                int offset) {
+  int8_t value = (int8_t)chunk->code[offset + 1];
+  printf("%-16s %4d\n", name, value);
+  return offset + 2;
+}
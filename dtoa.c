@@ -0,0 +1,207 @@
+#include <string.h>
+
+#include "dtoa.h"
+#include "pow10.h"
+
+// Double to the shortest decimal that reads back as the same double,
+// closest to the exact value when several are that short. The digits
+// come from Giulietti's Schubfach: scale the value and the two ends of
+// its rounding interval by one 126-bit power of ten, then pick the
+// shortest candidate that stays inside the interval.
+
+#define MANTISSA_BITS 52
+#define SMALLEST_Q (-1074)
+#define HIDDEN_BIT ((uint64_t)1 << MANTISSA_BITS)
+#define MASK_63 (((uint64_t)1 << 63) - 1)
+
+typedef struct {
+  uint64_t digits;
+  int exponent;
+} Decimal;
+
+// floor(log10(2^q)), floor(log10(3/4 * 2^q)) and floor(log2(10^e)),
+// exact over the range of doubles.
+static int floorLog10Pow2(int q) {
+  return (int)(((int64_t)q * 661971961083) >> 41);
+}
+
+static int floorLog10ThreeQuartersPow2(int q) {
+  return (int)(((int64_t)q * 661971961083 - 274743187321) >> 41);
+}
+
+static int floorLog2Pow10(int e) {
+  return (int)(((int64_t)e * 913124641741) >> 38);
+}
+
+// g * cp / 2^127 rounded to odd: the low bit is set if anything was
+// shifted out, so comparisons against the interval stay exact.
+static uint64_t roundToOdd(const uint64_t* g, uint64_t cp) {
+  unsigned __int128 low = (unsigned __int128)g[1] * cp;
+  unsigned __int128 high = (unsigned __int128)g[0] * cp;
+  uint64_t z = ((uint64_t)high >> 1) + (uint64_t)(low >> 64);
+  uint64_t result = (uint64_t)(high >> 64) + (z >> 63);
+  return result | (((z & MASK_63) + MASK_63) >> 63);
+}
+
+static Decimal toDecimal(int q, uint64_t c) {
+  // Odd significands exclude the ends of their interval.
+  uint64_t out = c & 1;
+  uint64_t cb = c << 2;
+  uint64_t cbr = cb + 2;
+  uint64_t cbl;
+  int k;
+  // At a power of two the gap below is half the gap above.
+  if (c != HIDDEN_BIT || q == SMALLEST_Q) {
+    cbl = cb - 2;
+    k = floorLog10Pow2(q);
+  } else {
+    cbl = cb - 1;
+    k = floorLog10ThreeQuartersPow2(q);
+  }
+  int h = q + floorLog2Pow10(-k) + 2;
+
+  const uint64_t* g = pow10[k - POW10_MIN];
+  uint64_t vb = roundToOdd(g, cb << h);
+  uint64_t vbl = roundToOdd(g, cbl << h);
+  uint64_t vbr = roundToOdd(g, cbr << h);
+
+  uint64_t s = vb >> 2;
+  Decimal result;
+  if (s >= 10) {
+    // Try one digit fewer first: s rounded down and up to tens.
+    uint64_t sp10 = s / 10 * 10;
+    uint64_t tp10 = sp10 + 10;
+    bool upin = vbl + out <= sp10 << 2;
+    bool wpin = (tp10 << 2) + out <= vbr;
+    if (upin != wpin) {
+      result.digits = upin ? sp10 : tp10;
+      result.exponent = k;
+      return result;
+    }
+  }
+
+  uint64_t t = s + 1;
+  bool uin = vbl + out <= s << 2;
+  bool win = (t << 2) + out <= vbr;
+  result.exponent = k;
+  if (uin != win) {
+    result.digits = uin ? s : t;
+    return result;
+  }
+
+  // Both or neither fit: take the closer, the even one on a tie.
+  int64_t cmp = (int64_t)(vb - ((s + t) << 1));
+  result.digits = cmp < 0 || (cmp == 0 && (s & 1) == 0) ? s : t;
+  return result;
+}
+
+static int writeDigits(uint64_t digits, char* buffer) {
+  char reversed[20];
+  int count = 0;
+  do {
+    reversed[count++] = (char)('0' + digits % 10);
+    digits /= 10;
+  } while (digits != 0);
+
+  for (int i = 0; i < count; i++) buffer[i] = reversed[count - 1 - i];
+  return count;
+}
+
+// Lays the digits out the way JavaScript's Number.toString() does:
+// plain decimals from 1e-6 up to 1e21, exponents outside that.
+static int writeDecimal(Decimal decimal, char* buffer) {
+  while (decimal.digits % 10 == 0) {
+    decimal.digits /= 10;
+    decimal.exponent++;
+  }
+
+  char digits[20];
+  int count = writeDigits(decimal.digits, digits);
+  int point = count + decimal.exponent;
+  char* out = buffer;
+
+  if (decimal.exponent >= 0 && point <= 21) {
+    memcpy(out, digits, count);
+    out += count;
+    memset(out, '0', decimal.exponent);
+    out += decimal.exponent;
+  } else if (point > 0 && point <= 21) {
+    memcpy(out, digits, point);
+    out += point;
+    *out++ = '.';
+    memcpy(out, digits + point, count - point);
+    out += count - point;
+  } else if (point > -6 && point <= 0) {
+    *out++ = '0';
+    *out++ = '.';
+    memset(out, '0', -point);
+    out += -point;
+    memcpy(out, digits, count);
+    out += count;
+  } else {
+    *out++ = digits[0];
+    if (count > 1) {
+      *out++ = '.';
+      memcpy(out, digits + 1, count - 1);
+      out += count - 1;
+    }
+    *out++ = 'e';
+    int exponent = point - 1;
+    if (exponent < 0) {
+      *out++ = '-';
+      exponent = -exponent;
+    } else {
+      *out++ = '+';
+    }
+    out += writeDigits((uint64_t)exponent, out);
+  }
+
+  *out = '\0';
+  return (int)(out - buffer);
+}
+
+// Writes value's shortest round-trip form and a '\0' into buffer,
+// which must hold DTOA_BUFFER_SIZE bytes, and returns its length.
+// Zeros, infinities and NaNs are spelled the way printf("%g") does.
+int formatDouble(double value, char* buffer) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  char* out = buffer;
+  if (bits >> 63) *out++ = '-';
+
+  uint64_t t = bits & (HIDDEN_BIT - 1);
+  int biased = (int)(bits >> MANTISSA_BITS) & 0x7FF;
+
+  if (biased == 0x7FF) {
+    memcpy(out, t == 0 ? "inf" : "nan", 4);
+    return (int)(out - buffer) + 3;
+  }
+
+  if (biased == 0 && t == 0) {
+    memcpy(out, "0", 2);
+    return (int)(out - buffer) + 1;
+  }
+
+  Decimal decimal;
+  if (biased != 0) {
+    int mq = -SMALLEST_Q + 1 - biased;
+    uint64_t c = HIDDEN_BIT | t;
+    if (mq > 0 && mq < MANTISSA_BITS + 1 && (c >> mq) << mq == c) {
+      // A whole number below 2^53 is already its own shortest form.
+      decimal.digits = c >> mq;
+      decimal.exponent = 0;
+    } else {
+      decimal = toDecimal(-mq, c);
+    }
+  } else if (t < 3) {
+    // The two smallest subnormals have too few bits for the interval
+    // arithmetic; their shortest forms are 5e-324 and 1e-323.
+    decimal.digits = t == 1 ? 5 : 1;
+    decimal.exponent = t == 1 ? -324 : -323;
+  } else {
+    decimal = toDecimal(SMALLEST_Q, t);
+  }
+
+  return (int)(out - buffer) + writeDecimal(decimal, out);
+}
@@ -0,0 +1,11 @@
+#ifndef clox_dtoa_h
+#define clox_dtoa_h
+
+#include "common.h"
+
+// Longest output, "-1.2345678901234567e-308", plus room to spare.
+#define DTOA_BUFFER_SIZE 32
+
+int formatDouble(double value, char* buffer);
+
+#endif
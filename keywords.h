@@ -0,0 +1,73 @@
+// Generated by tools/gen_keywords.py. Do not edit.
+
+#ifndef clox_keywords_h
+#define clox_keywords_h
+
+#include <string.h>
+
+#include "scanner.h"
+
+#define KEYWORD_HASH_SIZE 32
+#define KEYWORD_MAX_LENGTH 6
+
+#define KEYWORD_HASH(first, last, length) \
+    (((unsigned)(unsigned char)(first) * 1u + \
+      (unsigned)(unsigned char)(last) * 5u + \
+      (unsigned)(length)) & 31u)
+
+typedef struct {
+  const char* name;
+  int length;
+  TokenType type;
+} Keyword;
+
+static const Keyword keywords[KEYWORD_HASH_SIZE] = {
+  [0] = {"", 0, TOKEN_IDENTIFIER},
+  [1] = {"", 0, TOKEN_IDENTIFIER},
+  [2] = {"else", 4, TOKEN_ELSE},
+  [3] = {"for", 3, TOKEN_FOR},
+  [4] = {"false", 5, TOKEN_FALSE},
+  [5] = {"", 0, TOKEN_IDENTIFIER},
+  [6] = {"", 0, TOKEN_IDENTIFIER},
+  [7] = {"class", 5, TOKEN_CLASS},
+  [8] = {"", 0, TOKEN_IDENTIFIER},
+  [9] = {"if", 2, TOKEN_IF},
+  [10] = {"", 0, TOKEN_IDENTIFIER},
+  [11] = {"or", 2, TOKEN_OR},
+  [12] = {"", 0, TOKEN_IDENTIFIER},
+  [13] = {"nil", 3, TOKEN_NIL},
+  [14] = {"", 0, TOKEN_IDENTIFIER},
+  [15] = {"fun", 3, TOKEN_FUN},
+  [16] = {"", 0, TOKEN_IDENTIFIER},
+  [17] = {"true", 4, TOKEN_TRUE},
+  [18] = {"super", 5, TOKEN_SUPER},
+  [19] = {"var", 3, TOKEN_VAR},
+  [20] = {"", 0, TOKEN_IDENTIFIER},
+  [21] = {"while", 5, TOKEN_WHILE},
+  [22] = {"", 0, TOKEN_IDENTIFIER},
+  [23] = {"this", 4, TOKEN_THIS},
+  [24] = {"and", 3, TOKEN_AND},
+  [25] = {"print", 5, TOKEN_PRINT},
+  [26] = {"", 0, TOKEN_IDENTIFIER},
+  [27] = {"", 0, TOKEN_IDENTIFIER},
+  [28] = {"", 0, TOKEN_IDENTIFIER},
+  [29] = {"", 0, TOKEN_IDENTIFIER},
+  [30] = {"return", 6, TOKEN_RETURN},
+  [31] = {"", 0, TOKEN_IDENTIFIER},
+};
+
+// Empty slots have length 0, which no identifier has.
+static inline TokenType lookupKeyword(const char* start,
+                                      int length) {
+  if (length > KEYWORD_MAX_LENGTH) return TOKEN_IDENTIFIER;
+
+  const Keyword* keyword = &keywords[
+      KEYWORD_HASH(start[0], start[length - 1], length)];
+  if (keyword->length == length &&
+      memcmp(start, keyword->name, length) == 0) {
+    return keyword->type;
+  }
+  return TOKEN_IDENTIFIER;
+}
+
+#endif
@@ -1,25 +1,70 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "aot.h"
 #include "common.h"
+#include "compiler.h"
+#include "memo.h"
+#include "perf.h"
+#include "profiler.h"
+#include "server.h"
+#include "trace.h"
 #include "vm.h"
 
+// Lines can be any length. Every line's code goes onto the end of one
+// chunk that lives as long as the session. ":time" toggles printing
+// how long each line took to compile and run.
 static void repl() {
-  char line[1024];
+  Chunk chunk;
+  initChunk(&chunk);
+  char* line = NULL;
+  size_t capacity = 0;
+  bool timing = false;
+
   for (;;) {
     printf("> ");
 
-    if (!fgets(line, sizeof(line), stdin)) {
+    ssize_t length = getline(&line, &capacity, stdin);
+    if (length < 0) {
       printf("\n");
       break;
     }
 
-    interpret(line);
+    if (strcmp(line, ":time\n") == 0 || strcmp(line, ":time") == 0) {
+      timing = !timing;
+      printf("Timing %s.\n", timing ? "on" : "off");
+      continue;
+    }
+
+    InterpretTimes times;
+    interpretAppend(&chunk, line, (size_t)length,
+                    timing ? &times : NULL);
+    if (timing) {
+      printf("compile %.1f us, run %.1f us\n", times.compile * 1e6,
+             times.run * 1e6);
+    }
   }
+
+  free(line);
+  freeChunk(&chunk);
 }
 
-static char* readFile(const char* path) {
+typedef struct {
+  const char* start;
+  size_t length;
+  bool mapped;
+} Source;
+
+static char* readFile(const char* path, size_t* length) {
   FILE* file = fopen(path, "rb");
 
   if (file == NULL) {
@@ -44,32 +89,311 @@ static char* readFile(const char* path) {
   }
 
   buffer[bytesRead] = '\0';
+  *length = bytesRead;
 
   fclose(file);
   return buffer;
 }
 
-static void runFile(const char* path) {
-  char* source = readFile(path);
-  InterpretResult result = interpret(source);
-  free(source);
+// Maps the file read-only so the scanner's tokens point straight into
+// the page cache. Empty files and anything else mmap() refuses fall
+// back to reading a private copy.
+static Source loadFile(const char* path) {
+  Source source;
+  source.mapped = false;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    exit(74);
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) &&
+      info.st_size > 0) {
+    void* data = mmap(NULL, (size_t)info.st_size, PROT_READ,
+                      MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      posix_madvise(data, (size_t)info.st_size,
+                    POSIX_MADV_SEQUENTIAL);
+      source.start = data;
+      source.length = (size_t)info.st_size;
+      source.mapped = true;
+    }
+  }
+  close(fd);
+
+  if (!source.mapped) source.start = readFile(path, &source.length);
+  return source;
+}
 
-  if (result == INTERPRET_COMPILE_ERROR) exit(65);
-  if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+static void unloadFile(Source* source) {
+  if (source->mapped) {
+    munmap((void*)source->start, source->length);
+  } else {
+    free((void*)source->start);
+  }
+}
+
+// The exit status for a run's result, as sysexits.h numbers them.
+static int exitStatus(InterpretResult result) {
+  if (result == INTERPRET_COMPILE_ERROR) return 65;
+  if (result == INTERPRET_RUNTIME_ERROR) return 70;
+  return 0;
+}
+
+static int runFile(const char* path, bool batch) {
+  TRACE_BEGIN("load");
+  Source source = loadFile(path);
+  TRACE_END();
+  InterpretResult result =
+      batch ? interpretBatch(source.start, source.length)
+            : interpretRange(source.start, source.length);
+  unloadFile(&source);
+  return exitStatus(result);
+}
+
+static int runStream() {
+  return exitStatus(interpretStream(STDIN_FILENO));
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: clox [options] [path | -]\n");
+  exit(64);
+}
+
+// $XDG_CACHE_HOME/clox, or ~/.cache/clox.
+static const char* defaultCacheDir() {
+  static char path[4096];
+  const char* cache = getenv("XDG_CACHE_HOME");
+  if (cache != NULL && cache[0] != '\0') {
+    snprintf(path, sizeof(path), "%s/clox", cache);
+  } else {
+    const char* home = getenv("HOME");
+    snprintf(path, sizeof(path), "%s/.cache/clox",
+             home != NULL ? home : ".");
+  }
+  return path;
+}
+
+// A positive whole number, all of text, or usage().
+static int parseCount(const char* text) {
+  char* end;
+  errno = 0;
+  long count = strtol(text, &end, 10);
+  if (end == text || *end != '\0' || errno != 0 || count < 1 ||
+      count > INT_MAX) {
+    usage();
+  }
+  return (int)count;
+}
+
+static OutputFormat parseOutputFormat(const char* name) {
+  if (strcmp(name, "text") == 0) return OUTPUT_TEXT;
+  if (strcmp(name, "raw") == 0) return OUTPUT_RAW;
+  if (strcmp(name, "framed") == 0) return OUTPUT_FRAMED;
+  usage();
+  return OUTPUT_TEXT;
+}
+
+static FILE* openOutput(const char* path) {
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    exit(74);
+  }
+  return file;
+}
+
+static FILE* profileFile = NULL;
+
+// Registered with atexit() so a script that fails still gets its
+// profile written.
+static void finishProfile() {
+  stopProfiler();
+  writeProfile(profileFile);
+  if (profileFile != stderr) fclose(profileFile);
+}
+
+typedef enum {
+  PERF_REPORT_NONE,
+  PERF_REPORT_TEXT,
+  PERF_REPORT_JSON,
+} PerfReport;
+
+static PerfReport perfReport = PERF_REPORT_NONE;
+
+static void reportPerf() {
+  if (perfReport == PERF_REPORT_JSON) {
+    writePerfJson(stderr);
+  } else {
+    writePerfText(stderr);
+  }
+  closePerfCounters();
+}
+
+static FILE* traceFile = NULL;
+
+static void finishTrace() {
+  writeTrace(traceFile);
+  fclose(traceFile);
+}
+
+static void reportCse() {
+  int64_t tree = cseStats.treeInstructions;
+  int64_t eliminated = tree - cseStats.emittedInstructions;
+  fprintf(stderr, "cse: %lld of %lld instructions eliminated (%.1f%%)\n",
+          (long long)eliminated, (long long)tree,
+          tree > 0 ? 100.0 * (double)eliminated / (double)tree : 0.0);
+}
+
+static void reportMemo() {
+  fprintf(stderr, "memo: %llu hits (%llu from disk), %llu misses, "
+          "%llu stored, %llu impure\n",
+          (unsigned long long)memoStats.hits,
+          (unsigned long long)memoStats.diskHits,
+          (unsigned long long)memoStats.misses,
+          (unsigned long long)memoStats.stored,
+          (unsigned long long)memoStats.impure);
+}
+
+static void reportSimplify() {
+  fprintf(stderr, "simplify: %lld identities removed, %lld divisions "
+          "made multiplies, %lld negations folded\n",
+          (long long)simplifyStats.identities,
+          (long long)simplifyStats.reciprocals,
+          (long long)simplifyStats.negations);
 }
 
 int main(int argc, const char* argv[]) {
   initVM();
 
-  if (argc == 1) {
+  const char* path = NULL;
+  const char* socketPath = NULL;
+  const char* sharedName = NULL;
+  bool batch = false;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strcmp(arg, "--pretokenize") == 0) {
+      compilerOptions.pretokenize = true;
+    } else if (strcmp(arg, "--profile") == 0) {
+      profileFile = stderr;
+    } else if (strncmp(arg, "--profile=", 10) == 0) {
+      profileFile = openOutput(arg + 10);
+    } else if (strncmp(arg, "--trace=", 8) == 0) {
+#ifdef TRACE_PHASES
+      traceFile = openOutput(arg + 8);
+#else
+      fprintf(stderr, "--trace needs a build with TRACE_PHASES "
+                      "(make TRACE=1).\n");
+      exit(64);
+#endif
+    } else if (strcmp(arg, "--perf-counters") == 0 ||
+               strcmp(arg, "--perf-counters=text") == 0) {
+      perfReport = PERF_REPORT_TEXT;
+    } else if (strcmp(arg, "--perf-counters=json") == 0) {
+      perfReport = PERF_REPORT_JSON;
+    } else if (strcmp(arg, "--fast-math") == 0) {
+      compilerOptions.fastMath = true;
+    } else if (strcmp(arg, "--emit-c") == 0) {
+      nativeCacheDir = defaultCacheDir();
+    } else if (strncmp(arg, "--emit-c=", 9) == 0) {
+      nativeCacheDir = arg + 9;
+    } else if (strcmp(arg, "--memoize") == 0) {
+      memoizeResults = true;
+      resultCacheDir = defaultCacheDir();
+    } else if (strncmp(arg, "--memoize=", 10) == 0) {
+      memoizeResults = true;
+      resultCacheDir = arg + 10;
+    } else if (strcmp(arg, "--batch") == 0) {
+      batch = true;
+    } else if (strcmp(arg, "--predecode") == 0) {
+      predecodeChunks = true;
+    } else if (strcmp(arg, "--simplify") == 0) {
+      compilerOptions.simplify = true;
+    } else if (strcmp(arg, "--cse") == 0) {
+      compilerOptions.cse = true;
+    } else if (strncmp(arg, "--lex-threads=", 14) == 0) {
+      compilerOptions.pretokenize = true;
+      compilerOptions.lexThreads = parseCount(arg + 14);
+    } else if (strcmp(arg, "--number-format=g") == 0) {
+      numberFormat = NUMBER_G;
+    } else if (strcmp(arg, "--number-format=shortest") == 0) {
+      numberFormat = NUMBER_SHORTEST;
+    } else if (strncmp(arg, "--output-format=", 16) == 0) {
+      vm.outputFormat = parseOutputFormat(arg + 16);
+    } else if (strncmp(arg, "--serve=", 8) == 0) {
+      socketPath = arg + 8;
+    } else if (strncmp(arg, "--shared-cache=", 15) == 0) {
+      sharedName = arg + 15;
+    } else if (strncmp(arg, "--output=", 9) == 0) {
+      if (vm.outputFile != stdout) fclose(vm.outputFile);
+      vm.outputFile = openOutput(arg + 9);
+    } else if (path == NULL &&
+               (arg[0] != '-' || strcmp(arg, "-") == 0)) {
+      path = arg;
+    } else {
+      usage();
+    }
+  }
+
+  if (sharedName != NULL && socketPath == NULL) usage();
+  // Only a whole script is built as native code.
+  if (nativeCacheDir != NULL &&
+      (path == NULL || strcmp(path, "-") == 0 || socketPath != NULL)) {
+    usage();
+  }
+  // So is a batch, which is a script of statements.
+  if (batch && (path == NULL || strcmp(path, "-") == 0 ||
+                socketPath != NULL || nativeCacheDir != NULL)) {
+    usage();
+  }
+
+  // Results are kept for whole scripts and --serve requests.
+  if (memoizeResults && socketPath == NULL &&
+      (path == NULL || strcmp(path, "-") == 0 || batch)) {
+    usage();
+  }
+
+  if (profileFile != NULL) {
+    if (!startProfiler(PROFILE_HZ)) {
+      fprintf(stderr, "Could not start the profiler.\n");
+      exit(71);
+    }
+    atexit(finishProfile);
+  }
+
+  if (perfReport != PERF_REPORT_NONE) {
+    // Without counters the run still goes ahead; the report shows n/a.
+    if (!openPerfCounters()) {
+      fprintf(stderr, "Could not open perf counters (%s); check "
+              "/proc/sys/kernel/perf_event_paranoid.\n", strerror(errno));
+    }
+    atexit(reportPerf);
+  }
+
+  if (traceFile != NULL) {
+    startTrace();
+    atexit(finishTrace);
+  }
+
+  // A failed run still gets its reports below.
+  int status = 0;
+  if (socketPath != NULL) {
+    if (path != NULL) usage();
+    if (!runServer(socketPath, sharedName)) status = 74;
+  } else if (path == NULL) {
     repl();
-  } else if (argc == 2) {
-    runFile(argv[1]);
+  } else if (strcmp(path, "-") == 0) {
+    status = runStream();
   } else {
-    fprintf(stderr, "Usage: clox [path]\n");
-    exit(64);
+    status = runFile(path, batch);
   }
 
+  if (compilerOptions.cse) reportCse();
+  if (compilerOptions.simplify) reportSimplify();
+  if (memoizeResults) reportMemo();
   freeVM();
-  return 0;
+  if (vm.outputFile != stdout) fclose(vm.outputFile);
+  return status;
 }
@@ -0,0 +1,271 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aot.h"
+#include "compiler.h"
+#include "memo.h"
+
+// Whole-script results. A script is pure arithmetic, so its value
+// depends on nothing but its source, and a script seen before needn't
+// be compiled or run again. Results are kept in memory, MEMO_SETS sets
+// of MEMO_WAYS entries each evicting its least recently used, and, with
+// resultCacheDir set, on disk as
+//
+//   <sha256>-<version>[f].result    the value's 8 bytes
+//
+// Unlike the chunk caches, there's no source stored to check a hit
+// against: the key is a SHA-256, so a collision is out of reach. Files
+// are written under a temporary name and renamed into place.
+
+#define MEMO_PATH_MAX 4096
+
+typedef struct {
+  ResultKey key;
+  Value value;
+  uint64_t lastUsed;
+  bool used;
+} MemoEntry;
+
+bool memoizeResults = false;
+const char* resultCacheDir = NULL;
+MemoStats memoStats;
+
+static MemoEntry entries[MEMO_SETS][MEMO_WAYS];
+static uint64_t useClock = 0;
+
+static const uint32_t roundConstants[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t rotate(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+static void compress(uint32_t state[8], const uint8_t* block) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+           (uint32_t)block[4 * i + 2] << 8 | (uint32_t)block[4 * i + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^
+                  (w[i - 15] >> 3);
+    uint32_t s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^
+                  (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int i = 0; i < 64; i++) {
+    uint32_t s1 = rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25);
+    uint32_t choice = (e & f) ^ (~e & g);
+    uint32_t t1 = h + s1 + choice + roundConstants[i] + w[i];
+    uint32_t s0 = rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22);
+    uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = s0 + majority;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+  state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void sha256(const char* data, size_t length, uint8_t digest[32]) {
+  uint32_t state[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+  const uint8_t* bytes = (const uint8_t*)data;
+  size_t whole = length / 64 * 64;
+  for (size_t i = 0; i < whole; i += 64) compress(state, bytes + i);
+
+  // The last partial block, a 1 bit, zeros and the length in bits,
+  // spilling into a second block if the length doesn't fit.
+  uint8_t tail[128] = {0};
+  size_t rest = length - whole;
+  memcpy(tail, bytes + whole, rest);
+  tail[rest] = 0x80;
+  size_t tailLength = rest + 9 <= 64 ? 64 : 128;
+  uint64_t bits = (uint64_t)length * 8;
+  for (int i = 0; i < 8; i++) {
+    tail[tailLength - 1 - i] = (uint8_t)(bits >> (8 * i));
+  }
+  compress(state, tail);
+  if (tailLength == 128) compress(state, tail + 64);
+
+  for (int i = 0; i < 8; i++) {
+    digest[4 * i] = (uint8_t)(state[i] >> 24);
+    digest[4 * i + 1] = (uint8_t)(state[i] >> 16);
+    digest[4 * i + 2] = (uint8_t)(state[i] >> 8);
+    digest[4 * i + 3] = (uint8_t)state[i];
+  }
+}
+
+void resultKey(const char* source, size_t length, ResultKey* key) {
+  memset(key, 0, sizeof(ResultKey));
+  sha256(source, length, key->digest);
+  key->fastMath = compilerOptions.fastMath;
+}
+
+// Whether running the chunk does nothing but compute its value, so
+// that the value can stand in for running it. An opcode only counts if
+// it's listed here: one added later that reads input, keeps state
+// between runs or writes output, as OP_RESULT does, keeps its chunks
+// out of the cache without anyone having to remember this file.
+bool chunkIsPure(Chunk* chunk) {
+  for (int i = 0; i < chunk->count;) {
+    switch (chunk->code[i]) {
+      case OP_CONSTANT:
+      case OP_SMALL_INT:
+      case OP_ADD_CONSTANT:
+      case OP_SUBTRACT_CONSTANT:
+      case OP_MULTIPLY_CONSTANT:
+      case OP_DIVIDE_CONSTANT:
+      case OP_GET_TEMP:
+        i += 2;
+        break;
+      case OP_ZERO:
+      case OP_ONE:
+      case OP_ADD:
+      case OP_SUBTRACT:
+      case OP_MULTIPLY:
+      case OP_DIVIDE:
+      case OP_MULTIPLY_ADD:
+      case OP_MULTIPLY_SUBTRACT:
+      case OP_NEGATE:
+      case OP_RETURN:
+        i += 1;
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+static MemoEntry* setFor(ResultKey* key) {
+  return entries[key->digest[0] % MEMO_SETS];
+}
+
+static bool sameKey(ResultKey* a, ResultKey* b) {
+  return memcmp(a->digest, b->digest, sizeof(a->digest)) == 0 &&
+         a->fastMath == b->fastMath;
+}
+
+static void remember(ResultKey* key, Value value) {
+  MemoEntry* set = setFor(key);
+  MemoEntry* victim = &set[0];
+  for (int way = 0; way < MEMO_WAYS; way++) {
+    MemoEntry* entry = &set[way];
+    if (entry->used && sameKey(&entry->key, key)) {
+      victim = entry;
+      break;
+    }
+    if (!entry->used ||
+        (victim->used && entry->lastUsed < victim->lastUsed)) {
+      victim = entry;
+    }
+  }
+  victim->key = *key;
+  victim->value = value;
+  victim->lastUsed = ++useClock;
+  victim->used = true;
+}
+
+static bool resultPath(ResultKey* key, char* path, size_t size) {
+  char hex[65];
+  for (int i = 0; i < 32; i++) {
+    snprintf(hex + 2 * i, 3, "%02x", key->digest[i]);
+  }
+  int length = snprintf(path, size, "%s/%s-%d%s.result", resultCacheDir,
+                        hex, MEMO_VERSION, key->fastMath ? "f" : "");
+  return length >= 0 && (size_t)length < size;
+}
+
+static bool readResult(const char* path, Value* value) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  uint8_t bytes[sizeof(Value) + 1];
+  bool complete = read(fd, bytes, sizeof(bytes)) == (ssize_t)sizeof(Value);
+  close(fd);
+  if (complete) memcpy(value, bytes, sizeof(Value));
+  return complete;
+}
+
+// Looks in memory, then on disk, for the result of the script key
+// names.
+bool findResult(ResultKey* key, Value* value) {
+  MemoEntry* set = setFor(key);
+  for (int way = 0; way < MEMO_WAYS; way++) {
+    MemoEntry* entry = &set[way];
+    if (entry->used && sameKey(&entry->key, key)) {
+      entry->lastUsed = ++useClock;
+      *value = entry->value;
+      memoStats.hits++;
+      return true;
+    }
+  }
+
+  char path[MEMO_PATH_MAX];
+  if (resultCacheDir != NULL && resultPath(key, path, sizeof(path)) &&
+      readResult(path, value)) {
+    remember(key, *value);
+    memoStats.hits++;
+    memoStats.diskHits++;
+    return true;
+  }
+  memoStats.misses++;
+  return false;
+}
+
+// Caches value as the result of the script key names, if running
+// chunk, its compiled code, had no effect but computing it.
+void storeResult(ResultKey* key, Chunk* chunk, Value value) {
+  if (!chunkIsPure(chunk)) {
+    memoStats.impure++;
+    return;
+  }
+  remember(key, value);
+  memoStats.stored++;
+
+  char path[MEMO_PATH_MAX];
+  if (resultCacheDir == NULL || !resultPath(key, path, sizeof(path)) ||
+      !makeDirectories(resultCacheDir)) {
+    return;
+  }
+  char temporary[MEMO_PATH_MAX + 32];
+  snprintf(temporary, sizeof(temporary), "%s.%ld", path, (long)getpid());
+  FILE* file = fopen(temporary, "wb");
+  if (file == NULL) return;
+  bool written = fwrite(&value, sizeof(Value), 1, file) == 1;
+  if (fclose(file) != 0 || !written || rename(temporary, path) < 0) {
+    remove(temporary);
+  }
+}
+
+// Forgets what's in memory; results on disk stay.
+void clearResults() {
+  memset(entries, 0, sizeof(entries));
+  useClock = 0;
+}
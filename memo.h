@@ -0,0 +1,40 @@
+#ifndef clox_memo_h
+#define clox_memo_h
+
+#include "chunk.h"
+
+// Bump with any change that could give a script a different result.
+#define MEMO_VERSION 1
+
+#define MEMO_SETS 256
+#define MEMO_WAYS 4
+
+// A script's identity: the SHA-256 of its source, and whether it was
+// compiled with --fast-math, which can change the result.
+typedef struct {
+  uint8_t digest[32];
+  bool fastMath;
+} ResultKey;
+
+typedef struct {
+  uint64_t hits;
+  uint64_t diskHits;
+  uint64_t misses;
+  uint64_t stored;
+  uint64_t impure;
+} MemoStats;
+
+// Whether interpretRange() looks results up before compiling.
+extern bool memoizeResults;
+// Where results are kept across runs, or NULL to keep them in memory.
+extern const char* resultCacheDir;
+extern MemoStats memoStats;
+
+void sha256(const char* data, size_t length, uint8_t digest[32]);
+void resultKey(const char* source, size_t length, ResultKey* key);
+bool chunkIsPure(Chunk* chunk);
+bool findResult(ResultKey* key, Value* value);
+void storeResult(ResultKey* key, Chunk* chunk, Value value);
+void clearResults();
+
+#endif
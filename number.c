@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "number.h"
+#include "pow5.h"
+
+// Decimal to double for the scanner's number tokens (digits with an
+// optional fraction), correctly rounded. Most literals are exact in
+// double arithmetic; the rest go through Eisel-Lemire on the first 19
+// significant digits. The rare inputs that can't be settled from those
+// digits fall back to strtod().
+
+#define MAX_DIGITS 19
+#define MANTISSA_BITS 52
+#define INFINITE_POWER 0x7FF
+
+static const double exactPowers[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+typedef struct {
+  uint64_t high;
+  uint64_t low;
+} Product;
+
+static Product multiply(uint64_t a, uint64_t b) {
+  unsigned __int128 product = (unsigned __int128)a * b;
+  Product result = {(uint64_t)(product >> 64), (uint64_t)product};
+  return result;
+}
+
+static double fromBits(uint64_t bits) {
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// w * 10^q rounded to nearest, even on ties, for w != 0.
+static double eiselLemire(uint64_t w, int64_t q) {
+  if (q < POW5_MIN) return 0.0;
+  if (q > POW5_MAX) return fromBits((uint64_t)INFINITE_POWER << 52);
+
+  int lz = __builtin_clzll(w);
+  w <<= lz;
+
+  // 55 good bits are enough to round; only when the bits below them
+  // are all ones might the low word of the power change the answer.
+  const uint64_t* power = pow5[q - POW5_MIN];
+  Product product = multiply(w, power[0]);
+  if ((product.high & 0x1FF) == 0x1FF) {
+    Product second = multiply(w, power[1]);
+    product.low += second.high;
+    if (second.high > product.low) product.high++;
+  }
+
+  int upperBit = (int)(product.high >> 63);
+  int shift = upperBit + 64 - MANTISSA_BITS - 3;
+  uint64_t mantissa = product.high >> shift;
+  // floor(log2(10^q)) + 63, plus the bias.
+  int64_t power2 = (((152170 + 65536) * q) >> 16) + 63 + upperBit - lz +
+                   1023;
+
+  if (power2 <= 0) {
+    // Subnormal.
+    if (-power2 + 1 >= 64) return 0.0;
+    mantissa >>= -power2 + 1;
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    power2 = mantissa < ((uint64_t)1 << MANTISSA_BITS) ? 0 : 1;
+    return fromBits(mantissa | ((uint64_t)power2 << MANTISSA_BITS));
+  }
+
+  // An exact tie between two doubles rounds to even, not up. Exact
+  // products only happen for small q.
+  if (product.low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 &&
+      (mantissa << shift) == product.high) {
+    mantissa &= ~(uint64_t)1;
+  }
+
+  mantissa += mantissa & 1;
+  mantissa >>= 1;
+  if (mantissa >= ((uint64_t)2 << MANTISSA_BITS)) {
+    mantissa = (uint64_t)1 << MANTISSA_BITS;
+    power2++;
+  }
+  mantissa &= ~((uint64_t)1 << MANTISSA_BITS);
+
+  if (power2 >= INFINITE_POWER) {
+    return fromBits((uint64_t)INFINITE_POWER << MANTISSA_BITS);
+  }
+  return fromBits(mantissa | ((uint64_t)power2 << MANTISSA_BITS));
+}
+
+static double parseSlow(const char* start, int length) {
+  char buffer[64];
+  char* text = buffer;
+  if (length >= (int)sizeof(buffer)) {
+    text = GROW_ARRAY(char, NULL, 0, length + 1);
+  }
+
+  memcpy(text, start, length);
+  text[length] = '\0';
+  double value = strtod(text, NULL);
+
+  if (text != buffer) FREE_ARRAY(char, text, length + 1);
+  return value;
+}
+
+static bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+double parseNumber(const char* start, int length) {
+  const char* p = start;
+  const char* end = start + length;
+
+  // Gather up to 19 significant digits into w, so the value is
+  // w * 10^exponent plus whatever nonzero digits were dropped.
+  uint64_t w = 0;
+  int digits = 0;
+  int64_t exponent = 0;
+  bool truncated = false;
+
+  while (p < end && *p == '0') p++;
+  for (; p < end && isDigit(*p); p++) {
+    if (digits < MAX_DIGITS) {
+      w = w * 10 + (uint64_t)(*p - '0');
+      digits++;
+    } else {
+      exponent++;
+      if (*p != '0') truncated = true;
+    }
+  }
+
+  if (p < end && *p == '.') {
+    p++;
+    if (digits == 0) {
+      for (; p < end && *p == '0'; p++) exponent--;
+    }
+    for (; p < end && isDigit(*p); p++) {
+      if (digits < MAX_DIGITS) {
+        w = w * 10 + (uint64_t)(*p - '0');
+        digits++;
+        exponent--;
+      } else if (*p != '0') {
+        truncated = true;
+      }
+    }
+  }
+
+  if (w == 0) return 0.0;
+
+  // Clinger's fast path: both operands exact, so one rounding.
+  if (!truncated && exponent >= -22 && exponent <= 22 &&
+      w <= ((uint64_t)1 << 53)) {
+    double value = (double)w;
+    return exponent < 0 ? value / exactPowers[-exponent]
+                        : value * exactPowers[exponent];
+  }
+
+  double value = eiselLemire(w, exponent);
+  if (truncated && eiselLemire(w + 1, exponent) != value) {
+    // The dropped digits decide the rounding.
+    return parseSlow(start, length);
+  }
+  return value;
+}
@@ -0,0 +1,8 @@
+#ifndef clox_number_h
+#define clox_number_h
+
+#include "common.h"
+
+double parseNumber(const char* start, int length);
+
+#endif
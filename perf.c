@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "perf.h"
+
+typedef struct {
+  const char* name;
+  uint32_t type;
+  uint64_t config;
+} CounterSpec;
+
+// Hardware counters first so one of them leads the group when the
+// kernel has any. Containers and VMs often have none, in which case
+// only the task clock is left.
+#ifdef __linux__
+static const CounterSpec specs[PERF_COUNTERS] = {
+  [PERF_CYCLES] = {"cycles", PERF_TYPE_HARDWARE,
+                   PERF_COUNT_HW_CPU_CYCLES},
+  [PERF_INSTRUCTIONS] = {"instructions", PERF_TYPE_HARDWARE,
+                         PERF_COUNT_HW_INSTRUCTIONS},
+  [PERF_BRANCH_MISSES] = {"branch-misses", PERF_TYPE_HARDWARE,
+                          PERF_COUNT_HW_BRANCH_MISSES},
+  [PERF_CACHE_MISSES] = {"cache-misses", PERF_TYPE_HARDWARE,
+                         PERF_COUNT_HW_CACHE_MISSES},
+  [PERF_TASK_CLOCK] = {"task-clock", PERF_TYPE_SOFTWARE,
+                       PERF_COUNT_SW_TASK_CLOCK},
+};
+#else
+static const CounterSpec specs[PERF_COUNTERS] = {
+  [PERF_CYCLES] = {"cycles", 0, 0},
+  [PERF_INSTRUCTIONS] = {"instructions", 0, 0},
+  [PERF_BRANCH_MISSES] = {"branch-misses", 0, 0},
+  [PERF_CACHE_MISSES] = {"cache-misses", 0, 0},
+  [PERF_TASK_CLOCK] = {"task-clock", 0, 0},
+};
+#endif
+
+static const char* phaseNames[PERF_PHASES] = {
+  [PERF_SCAN] = "scan",
+  [PERF_COMPILE] = "compile",
+  [PERF_RUN] = "run",
+};
+
+// What one read() of the group returns: the time it was enabled and
+// running, for scaling when the kernel multiplexes counters, then one
+// value per member in the order they were opened.
+typedef struct {
+  uint64_t count;
+  uint64_t enabled;
+  uint64_t running;
+  uint64_t values[PERF_COUNTERS];
+} GroupRead;
+
+// Counters opened together on one thread, read with a single read().
+typedef struct {
+  int leader;
+  int fds[PERF_COUNTERS];
+  // Which counter each value in a GroupRead is.
+  PerfCounter members[PERF_COUNTERS];
+  int memberCount;
+  bool opened[PERF_COUNTERS];
+} CounterGroup;
+
+typedef struct {
+  CounterGroup group;
+  // Phases begun and not yet ended, as bits.
+  unsigned active;
+
+  GroupRead starts[PERF_PHASES];
+  uint64_t totals[PERF_PHASES][PERF_COUNTERS];
+  uint64_t calls[PERF_PHASES];
+} PerfState;
+
+static PerfState perf = {.group.leader = -1};
+
+// A worker thread's own group, between perfWorkerBegin() and
+// perfWorkerEnd(), and the phases it counts towards.
+typedef struct {
+  CounterGroup group;
+  GroupRead start;
+  unsigned phases;
+} WorkerCounters;
+
+static _Thread_local WorkerCounters worker = {.group.leader = -1};
+// Workers end at once; the calling thread only reads the totals
+// after joining them.
+static pthread_mutex_t totalsLock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef __linux__
+static int openCounter(const CounterSpec* spec, int group) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = spec->type;
+  attr.config = spec->config;
+  attr.read_format = PERF_FORMAT_GROUP |
+                     PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  // User space only, which perf_event_paranoid 2 still allows.
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+// Opens what counters it can for the calling thread, only those in
+// wanted. Returns false, with errno from the last failure, if the
+// kernel gave none.
+static bool openGroup(CounterGroup* group, const bool* wanted) {
+#ifdef __linux__
+  int error = 0;
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    if (wanted != NULL && !wanted[i]) continue;
+    group->fds[i] = openCounter(&specs[i], group->leader);
+    if (group->fds[i] < 0) {
+      error = errno;
+      continue;
+    }
+    if (group->leader < 0) group->leader = group->fds[i];
+    group->opened[i] = true;
+    group->members[group->memberCount++] = (PerfCounter)i;
+  }
+  if (group->leader < 0) {
+    errno = error;
+    return false;
+  }
+  return true;
+#else
+  (void)group;
+  (void)wanted;
+  errno = ENOSYS;
+  return false;
+#endif
+}
+
+static void closeGroup(CounterGroup* group) {
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    if (group->opened[i]) close(group->fds[i]);
+    group->opened[i] = false;
+  }
+  group->leader = -1;
+  group->memberCount = 0;
+}
+
+static bool readGroup(CounterGroup* group, GroupRead* values) {
+  ssize_t size = (ssize_t)(sizeof(uint64_t) * (3 + group->memberCount));
+  return read(group->leader, values, (size_t)size) == size;
+}
+
+// Adds what the group's counters moved between start and end to each
+// of phases, scaled up if the group was only on the PMU part of the
+// time.
+static void addCounts(CounterGroup* group, unsigned phases,
+                      GroupRead* start, GroupRead* end) {
+  double enabled = (double)(end->enabled - start->enabled);
+  double running = (double)(end->running - start->running);
+  double scale = running > 0 && running < enabled
+                 ? enabled / running : 1.0;
+  for (int phase = 0; phase < PERF_PHASES; phase++) {
+    if (!(phases & 1u << phase)) continue;
+    for (int i = 0; i < group->memberCount; i++) {
+      uint64_t delta = end->values[i] - start->values[i];
+      perf.totals[phase][group->members[i]] +=
+          (uint64_t)((double)delta * scale);
+    }
+  }
+}
+
+// Opens what counters it can for this thread. Returns false, with
+// errno from the last failure, if the kernel gave none; the run goes
+// on and the report just says so.
+bool openPerfCounters() {
+  return openGroup(&perf.group, NULL);
+}
+
+void closePerfCounters() {
+  closeGroup(&perf.group);
+}
+
+void perfBegin(PerfPhase phase) {
+  if (perf.group.leader < 0) return;
+  readGroup(&perf.group, &perf.starts[phase]);
+  perf.active |= 1u << phase;
+}
+
+void perfEnd(PerfPhase phase) {
+  if (perf.group.leader < 0) return;
+  perf.active &= ~(1u << phase);
+  GroupRead end;
+  if (!readGroup(&perf.group, &end)) return;
+  addCounts(&perf.group, 1u << phase, &perf.starts[phase], &end);
+  perf.calls[phase]++;
+}
+
+// Counts the calling worker thread towards whichever phases are open
+// on the thread that started it, which must not end them until
+// perfWorkerEnd() has returned. Opens the same counters the main
+// thread has, for this thread only.
+void perfWorkerBegin() {
+  if (perf.group.leader < 0 || perf.active == 0) return;
+  if (!openGroup(&worker.group, perf.group.opened)) return;
+  worker.phases = perf.active;
+  if (!readGroup(&worker.group, &worker.start)) closeGroup(&worker.group);
+}
+
+void perfWorkerEnd() {
+  if (worker.group.leader < 0) return;
+  GroupRead end;
+  if (readGroup(&worker.group, &end)) {
+    pthread_mutex_lock(&totalsLock);
+    addCounts(&worker.group, worker.phases, &worker.start, &end);
+    pthread_mutex_unlock(&totalsLock);
+  }
+  closeGroup(&worker.group);
+}
+
+static bool hasIpc() {
+  return perf.group.opened[PERF_CYCLES] &&
+         perf.group.opened[PERF_INSTRUCTIONS];
+}
+
+static double ipc(PerfPhase phase) {
+  uint64_t cycles = perf.totals[phase][PERF_CYCLES];
+  if (cycles == 0) return 0;
+  return (double)perf.totals[phase][PERF_INSTRUCTIONS] /
+         (double)cycles;
+}
+
+// A table with one row per phase, "n/a" for counters the kernel
+// refused. Compile includes scan when --pretokenize splits it out.
+void writePerfText(FILE* out) {
+  fprintf(out, "%-8s %10s", "phase", "calls");
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    fprintf(out, " %15s", specs[i].name);
+  }
+  fprintf(out, " %6s\n", "IPC");
+
+  for (int phase = 0; phase < PERF_PHASES; phase++) {
+    fprintf(out, "%-8s %10llu", phaseNames[phase],
+            (unsigned long long)perf.calls[phase]);
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+      if (perf.group.opened[i]) {
+        fprintf(out, " %15llu",
+                (unsigned long long)perf.totals[phase][i]);
+      } else {
+        fprintf(out, " %15s", "n/a");
+      }
+    }
+    if (hasIpc()) {
+      fprintf(out, " %6.2f\n", ipc((PerfPhase)phase));
+    } else {
+      fprintf(out, " %6s\n", "n/a");
+    }
+  }
+}
+
+// The same as one JSON object keyed by phase, with null for counters
+// the kernel refused.
+void writePerfJson(FILE* out) {
+  fprintf(out, "{");
+  for (int phase = 0; phase < PERF_PHASES; phase++) {
+    fprintf(out, "%s\"%s\":{\"calls\":%llu", phase == 0 ? "" : ",",
+            phaseNames[phase], (unsigned long long)perf.calls[phase]);
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+      if (perf.group.opened[i]) {
+        fprintf(out, ",\"%s\":%llu", specs[i].name,
+                (unsigned long long)perf.totals[phase][i]);
+      } else {
+        fprintf(out, ",\"%s\":null", specs[i].name);
+      }
+    }
+    if (hasIpc()) {
+      fprintf(out, ",\"ipc\":%.4f}", ipc((PerfPhase)phase));
+    } else {
+      fprintf(out, ",\"ipc\":null}");
+    }
+  }
+  fprintf(out, "}\n");
+}
@@ -0,0 +1,33 @@
+#ifndef clox_perf_h
+#define clox_perf_h
+
+#include <stdio.h>
+
+#include "common.h"
+
+typedef enum {
+  PERF_SCAN,
+  PERF_COMPILE,
+  PERF_RUN,
+  PERF_PHASES,
+} PerfPhase;
+
+typedef enum {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_BRANCH_MISSES,
+  PERF_CACHE_MISSES,
+  PERF_TASK_CLOCK,
+  PERF_COUNTERS,
+} PerfCounter;
+
+bool openPerfCounters();
+void closePerfCounters();
+void perfBegin(PerfPhase phase);
+void perfEnd(PerfPhase phase);
+void perfWorkerBegin();
+void perfWorkerEnd();
+void writePerfText(FILE* out);
+void writePerfJson(FILE* out);
+
+#endif
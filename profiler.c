@@ -0,0 +1,153 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "debug.h"
+#include "memory.h"
+#include "profiler.h"
+#include "vm.h"
+
+_Thread_local ProfileSite profileSite;
+
+// Sample counts by line and opcode, keyed as (line << 8 | opcode) + 1
+// so that 0 marks an empty slot. Only the signal handler writes here
+// while the timer runs, so it needs no locking, but it can't allocate
+// either: once the table is three-quarters full, new keys go to
+// dropped.
+typedef struct {
+  uint64_t key;
+  uint64_t count;
+} ProfileEntry;
+
+static ProfileEntry* entries = NULL;
+static int used = 0;
+static uint64_t outside = 0;
+static uint64_t dropped = 0;
+static struct sigaction previous;
+
+static void record(int line, uint8_t op) {
+  uint64_t key = (((uint64_t)(uint32_t)line << 8) | op) + 1;
+  uint32_t slot = (uint32_t)(key * 0x9E3779B97F4A7C15u >> 40) &
+                  (PROFILE_SLOTS - 1);
+  for (;;) {
+    ProfileEntry* entry = &entries[slot];
+    if (entry->key == key) {
+      entry->count++;
+      return;
+    }
+    if (entry->key == 0) break;
+    slot = (slot + 1) & (PROFILE_SLOTS - 1);
+  }
+
+  if (used >= PROFILE_SLOTS / 4 * 3) {
+    dropped++;
+    return;
+  }
+  entries[slot].key = key;
+  entries[slot].count = 1;
+  used++;
+}
+
+// Runs on SIGPROF, so it only reads the published site and bumps
+// counters in memory allocated up front.
+static void sample(int signal) {
+  (void)signal;
+  uint8_t* ip = profileSite.ip;
+  Chunk* chunk = profileSite.chunk;
+  const DecodedInstruction* pc = profileSite.pc;
+  if (pc != NULL) {
+    const DecodedChunk* decoded = profileSite.decoded;
+    ptrdiff_t index = pc - decoded->code;
+    if (index < 0 || index >= decoded->count) {
+      outside++;
+      return;
+    }
+    chunk = decoded->chunk;
+    ip = chunk->code + decoded->offsets[index];
+  }
+  if (ip == NULL) {
+    outside++;
+    return;
+  }
+
+  ptrdiff_t offset = ip - chunk->code;
+  if (offset < 0 || offset >= chunk->count) {
+    outside++;
+    return;
+  }
+  record(chunk->lines[offset], chunk->code[offset]);
+}
+
+// Samples whatever this process is running hz times per second of CPU
+// time. Meant for a single-threaded clox: the signal lands on whichever
+// thread is running, and only that thread's site is read.
+bool startProfiler(int hz) {
+  if (entries == NULL) {
+    entries = GROW_ARRAY(ProfileEntry, NULL, 0, PROFILE_SLOTS);
+  }
+  memset(entries, 0, sizeof(ProfileEntry) * PROFILE_SLOTS);
+  used = 0;
+  outside = 0;
+  dropped = 0;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = sample;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, &previous) < 0) return false;
+
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = 1000000 / hz;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, NULL) < 0) {
+    sigaction(SIGPROF, &previous, NULL);
+    return false;
+  }
+  return true;
+}
+
+void stopProfiler() {
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  sigaction(SIGPROF, &previous, NULL);
+}
+
+static int compareEntries(const void* a, const void* b) {
+  uint64_t left = ((const ProfileEntry*)a)->key;
+  uint64_t right = ((const ProfileEntry*)b)->key;
+  return left < right ? -1 : left > right;
+}
+
+// Writes the samples as folded stacks, one "frames count" line each,
+// ready for flamegraph.pl or speedscope. There are no calls yet, so a
+// stack is just the line and the instruction on it.
+void writeProfile(FILE* out) {
+  if (entries == NULL) return;
+
+  ProfileEntry* sorted = GROW_ARRAY(ProfileEntry, NULL, 0, used);
+  int count = 0;
+  for (int i = 0; i < PROFILE_SLOTS; i++) {
+    if (entries[i].key != 0) sorted[count++] = entries[i];
+  }
+  qsort(sorted, (size_t)count, sizeof(ProfileEntry), compareEntries);
+
+  for (int i = 0; i < count; i++) {
+    uint64_t key = sorted[i].key - 1;
+    fprintf(out, "clox;line %u;%s %llu\n", (uint32_t)(key >> 8),
+            opcodeName((uint8_t)key), (unsigned long long)sorted[i].count);
+  }
+  if (outside > 0) {
+    fprintf(out, "clox;[not in bytecode] %llu\n",
+            (unsigned long long)outside);
+  }
+  if (dropped > 0) {
+    fprintf(out, "clox;[dropped] %llu\n", (unsigned long long)dropped);
+  }
+  FREE_ARRAY(ProfileEntry, sorted, used);
+}
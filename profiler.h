@@ -0,0 +1,31 @@
+#ifndef clox_profiler_h
+#define clox_profiler_h
+
+#include <stdio.h>
+
+#include "chunk.h"
+
+#define PROFILE_HZ 1000
+#define PROFILE_SLOTS 65536
+
+struct DecodedChunk;
+struct DecodedInstruction;
+
+// Where run() is, for the SIGPROF handler. ip is NULL whenever no
+// bytecode is running, and chunk is only read while ip isn't.
+// runDecoded() sets pc instead, and decoded once per run, leaving the
+// handler to map pc back to the bytecode.
+typedef struct {
+  Chunk* volatile chunk;
+  uint8_t* volatile ip;
+  const struct DecodedChunk* volatile decoded;
+  const struct DecodedInstruction* volatile pc;
+} ProfileSite;
+
+extern _Thread_local ProfileSite profileSite;
+
+bool startProfiler(int hz);
+void stopProfiler();
+void writeProfile(FILE* out);
+
+#endif
@@ -1,25 +1,155 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "common.h"
+#include "keywords.h"
+#include "memory.h"
+#include "perf.h"
 #include "scanner.h"
+#include "simd.h"
+#include "tokens.h"
+
+#define STREAM_WINDOW 65536
+#define MIN_SEGMENT (1024 * 1024)
+#define MAX_SEGMENTS 64
 
 typedef struct {
   const char* start;
   const char* current;
+  const char* end;
   int line;
+
+  // Streaming input. fd is -1 when the whole source is in memory.
+  int fd;
+  bool drained;
+  bool handedOut;
+  int active;
+  char* windows[2];
+  size_t capacities[2];
 } Scanner;
 
-Scanner scanner;
+// One per thread so segments of a file can be lexed in parallel.
+_Thread_local Scanner scanner;
 
 void initScanner(const char* source) {
+  initScannerRange(source, strlen(source));
+}
+
+// The source does not need a trailing '\0', so a memory-mapped file
+// can be scanned in place.
+void initScannerRange(const char* source, size_t length) {
   scanner.start = source;
   scanner.current = source;
+  scanner.end = source + length;
   scanner.line = 1;
+  scanner.fd = -1;
+  initSimd();
+}
+
+void initScannerStream(int fd) {
+  initScannerRange("", 0);
+  scanner.fd = fd;
+  scanner.drained = false;
+  scanner.handedOut = false;
+  scanner.active = 0;
+}
+
+ScannerMark markScanner() {
+  ScannerMark mark;
+  mark.current = scanner.current;
+  mark.line = scanner.line;
+  return mark;
+}
+
+// Only for a source in memory: a stream's window may have moved on.
+void rewindScanner(ScannerMark mark) {
+  scanner.current = mark.current;
+  scanner.line = mark.line;
+}
+
+void freeScanner() {
+  for (int i = 0; i < 2; i++) {
+    FREE_ARRAY(char, scanner.windows[i], scanner.capacities[i]);
+    scanner.windows[i] = NULL;
+    scanner.capacities[i] = 0;
+  }
+  initScannerRange("", 0);
+}
+
+// Pulls more of the stream in behind the token being scanned. The
+// parser may still hold the last token handed out, so once one has
+// been, the unscanned tail moves to the other window and the active
+// one is left alone until the next refill. A token longer than a
+// window keeps refilling the same window, growing it as it goes.
+static bool refill() {
+  if (scanner.fd < 0 || scanner.drained) return false;
+
+  // Whether the tail lives in the other window rather than this one.
+  bool flipped = scanner.handedOut || scanner.windows[scanner.active] == NULL;
+  if (scanner.handedOut) {
+    scanner.active ^= 1;
+    scanner.handedOut = false;
+  }
+
+  int active = scanner.active;
+  size_t kept = (size_t)(scanner.end - scanner.start);
+  size_t scanned = (size_t)(scanner.current - scanner.start);
+  size_t needed = kept + STREAM_WINDOW;
+
+  if (flipped) {
+    // Nothing in this window is needed, so it's made big enough
+    // before the tail is copied in.
+    if (scanner.capacities[active] < needed) {
+      FREE_ARRAY(char, scanner.windows[active], scanner.capacities[active]);
+      scanner.windows[active] = GROW_ARRAY(char, NULL, 0, needed);
+      scanner.capacities[active] = needed;
+    }
+    memcpy(scanner.windows[active], scanner.start, kept);
+  } else {
+    // The tail is already here, so it moves down before growing.
+    memmove(scanner.windows[active], scanner.start, kept);
+    if (scanner.capacities[active] < needed) {
+      scanner.windows[active] = GROW_ARRAY(char, scanner.windows[active],
+          scanner.capacities[active], needed);
+      scanner.capacities[active] = needed;
+    }
+  }
+
+  char* window = scanner.windows[active];
+  ssize_t bytesRead;
+  do {
+    bytesRead = read(scanner.fd, window + kept,
+                     scanner.capacities[active] - kept);
+  } while (bytesRead < 0 && errno == EINTR);
+
+  scanner.start = window;
+  scanner.current = window + scanned;
+  scanner.end = window + kept;
+
+  if (bytesRead <= 0) {
+    scanner.drained = true;
+    return false;
+  }
+
+  scanner.end += bytesRead;
+  return true;
+}
+
+// Makes sure at least count bytes past current are buffered.
+static bool available(int count) {
+  while (scanner.end - scanner.current < count) {
+    if (!refill()) return false;
+  }
+  return true;
 }
 
 static bool isAtEnd() {
-  return *scanner.current == '\0';
+  return !available(1);
 }
 
 static char advance() {
@@ -28,11 +158,12 @@ static char advance() {
 }
 
 static char peek() {
+  if (isAtEnd()) return '\0';
   return *scanner.current;
 }
 
 static char peekNext() {
-  if (isAtEnd()) return '\0';
+  if (!available(2)) return '\0';
   return scanner.current[1];
 }
 
@@ -59,6 +190,7 @@ static Token makeToken(TokenType type) {
   token.start = scanner.start;
   token.length = (int)(scanner.current - scanner.start);
   token.line = scanner.line;
+  scanner.handedOut = true;
   return token;
 }
 
@@ -68,25 +200,34 @@ static Token errorToken(const char* message) {
   token.start = message;
   token.length = (int)strlen(message);
   token.line = scanner.line;
+  scanner.handedOut = true;
   return token;
 }
 
+// Moves start along with current so a stream refill never has to keep
+// the whitespace or comments already skipped. The runs themselves are
+// skipped a vector at a time; each kernel stops at the end of the
+// buffered window, and peek() refills it before the switch looks.
 static void skipWhitespace() {
   for (;;) {
+    scanner.current = simd.skipBlanks(scanner.current, scanner.end,
+                                      &scanner.line);
+    scanner.start = scanner.current;
     char c = peek();
     switch (c) {
       case ' ':
       case '\r':
       case '\t':
-        advance();
-        break;
       case '\n':
-        scanner.line++;
-        advance();
+        // A refill brought in more whitespace.
         break;
       case '/':
         if (peekNext() == '/') {
-          while (peek() != '\n' && !isAtEnd()) advance();
+          do {
+            scanner.current = simd.skipToNewline(scanner.current,
+                                                 scanner.end);
+            scanner.start = scanner.current;
+          } while (!isAtEnd() && peek() != '\n');
         } else {
           return;
         }
@@ -97,6 +238,12 @@ static void skipWhitespace() {
   }
 }
 
+static void skipDigits() {
+  do {
+    scanner.current = simd.skipDigits(scanner.current, scanner.end);
+  } while (isDigit(peek()));
+}
+
 static Token string() {
   while (peek() != '"' && !isAtEnd()) {
     if (peek() == '\n') scanner.line++;
@@ -110,62 +257,27 @@ static Token string() {
 }
 
 static Token number() {
-  while (isDigit(peek())) advance();
+  skipDigits();
 
   if (peek() == '.' && isDigit(peekNext())) {
     advance();
-    while (isDigit(peek())) advance();
+    skipDigits();
   }
 
   return makeToken(TOKEN_NUMBER);
 }
 
-static TokenType checkKeyword(int start, int length,
-    const char* rest, TokenType type) {
-  if (scanner.current - scanner.start == start + length &&
-      memcmp(scanner.start + start, rest, length) == 0) {
-    return type;
-  }
-  return TOKEN_IDENTIFIER;
-}
-
+// A single probe into the generated perfect hash in keywords.h.
 static TokenType identifierType() {
-  switch (scanner.start[0]) {
-    case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-    case 'c': return checkKeyword(1, 4, "lass", TOKEN_CLASS);
-    case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
-    case 'f':
-      if (scanner.current - scanner.start > 1) {
-        switch (scanner.start[1]) {
-          case 'a': return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-          case 'o': return checkKeyword(2, 1, "r", TOKEN_FOR);
-          case 'u': return checkKeyword(2, 1, "n", TOKEN_FUN);
-        }
-      }
-      break;
-    case 'i': return checkKeyword(1, 1, "f", TOKEN_IF);
-    case 'n': return checkKeyword(1, 2, "il", TOKEN_NIL);
-    case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
-    case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-    case 'r': return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-    case 's': return checkKeyword(1, 4, "uper", TOKEN_SUPER);
-    case 't':
-      if (scanner.current - scanner.start > 1) {
-        switch (scanner.start[1]) {
-          case 'h': return checkKeyword(2, 2, "is", TOKEN_THIS);
-          case 'r': return checkKeyword(2, 2, "ue", TOKEN_TRUE);
-        }
-      }
-      break;
-    case 'v': return checkKeyword(1, 2, "ar", TOKEN_VAR);
-    case 'w': return checkKeyword(1, 4, "hile", TOKEN_WHILE);
-  }
-
-  return TOKEN_IDENTIFIER;
+  return lookupKeyword(scanner.start,
+                       (int)(scanner.current - scanner.start));
 }
 
 static Token identifier() {
-  while (isAlpha(peek()) || isDigit(peek())) advance();
+  do {
+    scanner.current = simd.skipIdentifier(scanner.current,
+                                          scanner.end);
+  } while (isAlpha(peek()) || isDigit(peek()));
   return makeToken(identifierType());
 }
 
@@ -209,3 +321,141 @@ Token scanToken() {
 
   return errorToken("Unexpected character.");
 }
+
+// Lexes the array's source from offset from up to to, appending every
+// token but the EOF. If the range ends inside a string, the string's
+// error token is left off as well and the offset of its opening quote
+// goes in *openString.
+static bool scanRange(TokenArray* tokens, uint32_t from, uint32_t to,
+                      uint32_t* openString) {
+  const char* source = tokens->source;
+  initScannerRange(source + from, to - from);
+
+  for (;;) {
+    Token token = scanToken();
+    if (token.type == TOKEN_EOF) return false;
+
+    if (token.type == TOKEN_ERROR) {
+      if (*scanner.start == '"') {
+        *openString = (uint32_t)(scanner.start - source);
+        return true;
+      }
+      writeErrorToken(tokens, (uint32_t)(scanner.current - source),
+                      token.start);
+    } else {
+      writeTokenArray(tokens, token.type,
+                      (uint32_t)(token.start - source),
+                      (uint32_t)token.length);
+    }
+  }
+}
+
+static void endTokens(TokenArray* tokens, uint32_t length,
+                      bool inString) {
+  if (inString) writeErrorToken(tokens, length, "Unterminated string.");
+  writeTokenArray(tokens, TOKEN_EOF, length, 0);
+}
+
+// Lexes all of source into tokens, ending with TOKEN_EOF. Returns
+// false if the source is too big for the array's 32-bit offsets.
+bool scanAll(const char* source, size_t length, TokenArray* tokens) {
+  if (length > UINT32_MAX) return false;
+
+  initTokenArray(tokens, source);
+  uint32_t openString;
+  bool inString = scanRange(tokens, 0, (uint32_t)length, &openString);
+  endTokens(tokens, (uint32_t)length, inString);
+  return true;
+}
+
+typedef struct {
+  TokenArray tokens;
+  uint32_t from;
+  uint32_t to;
+  bool inString;
+  uint32_t openString;
+} Segment;
+
+static void* scanSegment(void* arg) {
+  Segment* segment = (Segment*)arg;
+  segment->inString = scanRange(&segment->tokens, segment->from,
+                                segment->to, &segment->openString);
+  return NULL;
+}
+
+// A segment on a thread of its own, counted towards the phases open on
+// the caller, which joins it before ending them.
+static void* scanSegmentThread(void* arg) {
+  perfWorkerBegin();
+  scanSegment(arg);
+  perfWorkerEnd();
+  return NULL;
+}
+
+// Splits source into up to threads segments that each start at the
+// beginning of a line and lexes them at once. Only strings span lines,
+// so a segment is lexed correctly unless the one before it ended
+// inside a string. Such a segment is lexed again, serially, from that
+// string's opening quote. Lines need no fixing up because tokenAt()
+// derives them from offsets.
+bool scanAllParallel(const char* source, size_t length,
+                     TokenArray* tokens, int threads) {
+  if (length > UINT32_MAX) return false;
+
+  int count = threads;
+  if (count > MAX_SEGMENTS) count = MAX_SEGMENTS;
+  if ((size_t)count > length / MIN_SEGMENT) {
+    count = (int)(length / MIN_SEGMENT);
+  }
+  if (count <= 1) return scanAll(source, length, tokens);
+
+  // The SIMD kernels are picked before any thread can race to do it.
+  initSimd();
+
+  Segment segments[MAX_SEGMENTS];
+  pthread_t workers[MAX_SEGMENTS];
+  bool started[MAX_SEGMENTS];
+  uint32_t from = 0;
+  int used = 0;
+  for (int i = 0; i < count && from < length; i++) {
+    size_t to = length;
+    if (i < count - 1) {
+      const char* split = source + length / count * (i + 1);
+      if (split < source + from) split = source + from;
+      const char* newline = memchr(split, '\n',
+                                   (size_t)(source + length - split));
+      if (newline != NULL) to = (size_t)(newline + 1 - source);
+    }
+
+    Segment* segment = &segments[used];
+    initTokenArray(&segment->tokens, source);
+    segment->from = from;
+    segment->to = (uint32_t)to;
+    started[used] = pthread_create(&workers[used], NULL,
+                                   scanSegmentThread, segment) == 0;
+    if (!started[used]) scanSegment(segment);
+    used++;
+    from = (uint32_t)to;
+  }
+
+  initTokenArray(tokens, source);
+  bool inString = false;
+  uint32_t openString = 0;
+  for (int i = 0; i < used; i++) {
+    Segment* segment = &segments[i];
+    if (started[i]) pthread_join(workers[i], NULL);
+
+    if (inString) {
+      inString = scanRange(tokens, openString, segment->to,
+                           &openString);
+    } else {
+      appendTokenArray(tokens, &segment->tokens);
+      inString = segment->inString;
+      openString = segment->openString;
+    }
+    freeTokenArray(&segment->tokens);
+  }
+
+  endTokens(tokens, (uint32_t)length, inString);
+  return true;
+}
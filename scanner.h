@@ -1,6 +1,8 @@
 #ifndef clox_scanner_h
 #define clox_scanner_h
 
+#include "common.h"
+
 typedef enum {
   // Single-character tokens
   TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
@@ -30,7 +32,18 @@ typedef struct {
   int line;
 } Token;
 
+// How far a scanner reading from memory has got, to go back to.
+typedef struct {
+  const char* current;
+  int line;
+} ScannerMark;
+
 void initScanner(const char* source);
+void initScannerRange(const char* source, size_t length);
+void initScannerStream(int fd);
+void freeScanner();
+ScannerMark markScanner();
+void rewindScanner(ScannerMark mark);
 Token scanToken();
 
 #endif
@@ -0,0 +1,188 @@
+#include <pthread.h>
+
+#include "scheduler.h"
+
+#define MAX_WORKERS 64
+
+// A FIFO of runnable tasks shared by the workers. A task that uses up
+// its slice goes to the back, so a long one can hold a thread for at
+// most one slice before everything queued behind it gets a turn.
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  Task* head;
+  Task* tail;
+  int remaining;
+  int64_t slice;
+  // Where the caller's results go, so a task's go there too whichever
+  // thread runs it.
+  OutputFormat outputFormat;
+  FILE* outputFile;
+} RunQueue;
+
+// Worker threads, started as runTasks() first needs them and kept for
+// the life of the process, each with a VM of its own. They sleep until
+// runTasks() hands them a queue.
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t done;
+  // Only one runTasks() at a time gets the pool.
+  pthread_mutex_t running;
+  RunQueue* queue;
+  // Workers still to join the queue, and those working on it.
+  int wanted;
+  int busy;
+  int size;
+} Pool;
+
+static Pool pool = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .wake = PTHREAD_COND_INITIALIZER,
+  .done = PTHREAD_COND_INITIALIZER,
+  .running = PTHREAD_MUTEX_INITIALIZER,
+};
+
+void initTask(Task* task, Chunk* chunk) {
+  task->state.chunk = chunk;
+  task->state.ip = 0;
+  task->state.stackCount = 0;
+  task->status = INTERPRET_YIELD;
+  task->result = 0;
+  task->slices = 0;
+  task->finished = NULL;
+  task->data = NULL;
+  task->next = NULL;
+}
+
+static void enqueue(RunQueue* queue, Task* task) {
+  task->next = NULL;
+  if (queue->tail == NULL) {
+    queue->head = task;
+  } else {
+    queue->tail->next = task;
+  }
+  queue->tail = task;
+}
+
+// Returns NULL once every task has finished.
+static Task* dequeue(RunQueue* queue) {
+  pthread_mutex_lock(&queue->lock);
+  while (queue->head == NULL && queue->remaining > 0) {
+    pthread_cond_wait(&queue->ready, &queue->lock);
+  }
+
+  Task* task = queue->head;
+  if (task != NULL) {
+    queue->head = task->next;
+    if (queue->head == NULL) queue->tail = NULL;
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return task;
+}
+
+static void work(RunQueue* queue) {
+  Task* task;
+  while ((task = dequeue(queue)) != NULL) {
+    restoreVM(&task->state);
+    vm.fuel = queue->slice;
+    task->status = resumeVM(&task->result);
+    task->slices++;
+
+    if (task->status == INTERPRET_YIELD) {
+      saveVM(&task->state);
+      pthread_mutex_lock(&queue->lock);
+      enqueue(queue, task);
+      pthread_cond_signal(&queue->ready);
+      pthread_mutex_unlock(&queue->lock);
+      continue;
+    }
+
+    if (task->finished != NULL) task->finished(task);
+    pthread_mutex_lock(&queue->lock);
+    if (--queue->remaining == 0) pthread_cond_broadcast(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+  }
+}
+
+static void* poolWorker(void* arg) {
+  (void)arg;
+  initVM();
+  pthread_mutex_lock(&pool.lock);
+  for (;;) {
+    while (pool.wanted == 0) pthread_cond_wait(&pool.wake, &pool.lock);
+    RunQueue* queue = pool.queue;
+    pool.wanted--;
+    pool.busy++;
+    pthread_mutex_unlock(&pool.lock);
+
+    vm.outputFormat = queue->outputFormat;
+    vm.outputFile = queue->outputFile;
+    work(queue);
+    // Nothing is left behind for a later batch to write.
+    flushOutput();
+
+    pthread_mutex_lock(&pool.lock);
+    if (--pool.busy == 0) pthread_cond_signal(&pool.done);
+  }
+  return NULL;
+}
+
+// Runs every task to completion on threads threads, the caller's
+// included, switching tasks whenever one has executed slice
+// instructions. The chunks must be
+// compiled beforehand; the compiler is not thread-safe, but running a
+// chunk only reads it.
+void runTasks(Task* tasks, int count, int threads, int64_t slice) {
+  RunQueue queue;
+  pthread_mutex_init(&queue.lock, NULL);
+  pthread_cond_init(&queue.ready, NULL);
+  queue.head = NULL;
+  queue.tail = NULL;
+  queue.remaining = count;
+  queue.slice = slice > 0 ? slice : FUEL_UNLIMITED;
+  queue.outputFormat = vm.outputFormat;
+  queue.outputFile = vm.outputFile;
+  for (int i = 0; i < count; i++) enqueue(&queue, &tasks[i]);
+
+  if (threads > MAX_WORKERS) threads = MAX_WORKERS;
+  pthread_mutex_lock(&pool.running);
+  pthread_mutex_lock(&pool.lock);
+  pthread_t thread;
+  while (pool.size < threads - 1 &&
+         pthread_create(&thread, NULL, poolWorker, NULL) == 0) {
+    pthread_detach(thread);
+    pool.size++;
+  }
+  pool.queue = &queue;
+  pool.wanted = threads - 1 < pool.size ? threads - 1 : pool.size;
+  if (pool.wanted > 0) pthread_cond_broadcast(&pool.wake);
+  pthread_mutex_unlock(&pool.lock);
+
+  // The calling thread works too, which also covers any worker that
+  // couldn't be started. Tasks leave its VM pointing into their
+  // chunks, so where it was is put back as it was, without looking
+  // into a chunk that may be long gone. Its fuel is too, or its next
+  // run would yield on the last slice's leftover.
+  Chunk* chunk = vm.chunk;
+  uint8_t* ip = vm.ip;
+  Value* stackTop = vm.stackTop;
+  int64_t fuel = vm.fuel;
+  work(&queue);
+  vm.chunk = chunk;
+  vm.ip = ip;
+  vm.stackTop = stackTop;
+  vm.fuel = fuel;
+
+  // Every task has finished, but a worker may still be on its way out
+  // of the queue, or yet to notice it.
+  pthread_mutex_lock(&pool.lock);
+  pool.wanted = 0;
+  pool.queue = NULL;
+  while (pool.busy > 0) pthread_cond_wait(&pool.done, &pool.lock);
+  pthread_mutex_unlock(&pool.lock);
+  pthread_mutex_unlock(&pool.running);
+
+  pthread_cond_destroy(&queue.ready);
+  pthread_mutex_destroy(&queue.lock);
+}
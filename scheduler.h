@@ -0,0 +1,21 @@
+#ifndef clox_scheduler_h
+#define clox_scheduler_h
+
+#include "vm.h"
+
+typedef struct Task {
+  VMState state;
+  InterpretResult status;
+  Value result;
+  // Time slices the task has had so far.
+  int slices;
+  // Called on the worker thread as soon as the task finishes.
+  void (*finished)(struct Task* task);
+  void* data;
+  struct Task* next;
+} Task;
+
+void initTask(Task* task, Chunk* chunk);
+void runTasks(Task* tasks, int count, int threads, int64_t slice);
+
+#endif
@@ -0,0 +1,301 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "memo.h"
+#include "memory.h"
+#include "perf.h"
+#include "server.h"
+#include "shmcache.h"
+#include "trace.h"
+#include "vm.h"
+
+#define READ_SIZE 65536
+
+typedef struct {
+  int fd;
+  // The peer has shut down its end; close once the results are out.
+  bool eof;
+  char* input;
+  size_t inputLength;
+  size_t inputCapacity;
+  char* output;
+  size_t outputLength;
+  size_t outputCapacity;
+} Client;
+
+typedef struct {
+  int listener;
+  Client clients[MAX_CLIENTS];
+  int clientCount;
+  ChunkCache cache;
+  // Used instead of cache when the server was given a segment name.
+  bool useShared;
+  SharedCache shared;
+} Server;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int signal) {
+  (void)signal;
+  stopping = 1;
+}
+
+static uint32_t readUint32(const char* bytes) {
+  const uint8_t* in = (const uint8_t*)bytes;
+  return (uint32_t)in[0] | (uint32_t)in[1] << 8 |
+         (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static void reserve(char** buffer, size_t* capacity, size_t needed) {
+  if (*capacity >= needed) return;
+  size_t oldCapacity = *capacity;
+  while (*capacity < needed) *capacity = GROW_CAPACITY(*capacity);
+  *buffer = GROW_ARRAY(char, *buffer, oldCapacity, *capacity);
+}
+
+static int listenOn(const char* path) {
+  struct sockaddr_un address;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path \"%s\" is too long.\n", path);
+    return -1;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  unlink(path);
+  if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    fprintf(stderr, "Could not listen on \"%s\".\n", path);
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  return fd;
+}
+
+static void acceptClients(Server* server) {
+  while (server->clientCount < MAX_CLIENTS) {
+    int fd = accept(server->listener, NULL, NULL);
+    if (fd < 0) return;
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    Client* client = &server->clients[server->clientCount++];
+    memset(client, 0, sizeof(Client));
+    client->fd = fd;
+  }
+}
+
+static void closeClient(Server* server, int index) {
+  Client* client = &server->clients[index];
+  close(client->fd);
+  FREE_ARRAY(char, client->input, client->inputCapacity);
+  FREE_ARRAY(char, client->output, client->outputCapacity);
+  server->clients[index] = server->clients[--server->clientCount];
+}
+
+// Reads at most READ_SIZE bytes of whatever has arrived, which
+// serveRequests() then drains, so a client that never stops sending
+// can neither starve the others nor grow its buffer past a request
+// and a read. poll() reports the rest next round. Returns false if the
+// connection failed.
+static bool readClient(Client* client) {
+  reserve(&client->input, &client->inputCapacity,
+          client->inputLength + READ_SIZE);
+  ssize_t count;
+  do {
+    count = read(client->fd, client->input + client->inputLength,
+                 READ_SIZE);
+  } while (count < 0 && errno == EINTR);
+
+  if (count > 0) {
+    client->inputLength += (size_t)count;
+    return true;
+  }
+  if (count == 0) {
+    client->eof = true;
+    return true;
+  }
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+// Returns false if the peer is gone.
+static bool writeClient(Client* client) {
+  size_t written = 0;
+  while (written < client->outputLength) {
+    ssize_t count = write(client->fd, client->output + written,
+                          client->outputLength - written);
+    if (count > 0) {
+      written += (size_t)count;
+    } else if (count < 0 && errno == EINTR) {
+      continue;
+    } else if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else {
+      return false;
+    }
+  }
+
+  memmove(client->output, client->output + written,
+          client->outputLength - written);
+  client->outputLength -= written;
+  return true;
+}
+
+// Runs one request's source. With memoizeResults set, a source whose
+// result is cached is neither compiled nor run, and a new result is
+// cached before the chunk it came from can be evicted.
+static InterpretResult evaluate(Server* server, const char* source,
+                                size_t length, Value* value) {
+  ResultKey key;
+  if (memoizeResults) {
+    resultKey(source, length, &key);
+    if (findResult(&key, value)) return INTERPRET_OK;
+  }
+
+  InterpretResult status = INTERPRET_COMPILE_ERROR;
+  if (server->useShared) {
+    SharedChunk shared;
+    if (acquireSharedChunk(&server->shared, source, length, &shared)) {
+      TRACE_BEGIN("run");
+      perfBegin(PERF_RUN);
+      status = runChunk(&shared.chunk, value);
+      perfEnd(PERF_RUN);
+      TRACE_END();
+      if (memoizeResults && status == INTERPRET_OK) {
+        storeResult(&key, &shared.chunk, *value);
+      }
+      releaseSharedChunk(&shared);
+    }
+  } else {
+    CacheEntry* entry = cachedEntry(&server->cache, source, length);
+    if (entry != NULL) {
+      TRACE_BEGIN("run");
+      perfBegin(PERF_RUN);
+      status = runCacheEntry(entry, value);
+      perfEnd(PERF_RUN);
+      TRACE_END();
+      if (memoizeResults && status == INTERPRET_OK) {
+        storeResult(&key, &entry->chunk, *value);
+      }
+    }
+  }
+  return status;
+}
+
+// Evaluates every complete request the client has sent, queueing the
+// results for one write. Returns false on a malformed request.
+static bool serveRequests(Server* server, Client* client) {
+  size_t offset = 0;
+  while (client->inputLength - offset >= REQUEST_HEADER) {
+    const char* header = client->input + offset;
+    uint32_t id = readUint32(header);
+    uint32_t length = readUint32(header + 4);
+    if (length > REQUEST_MAX) return false;
+    if (client->inputLength - offset - REQUEST_HEADER < length) break;
+
+    const char* source = header + REQUEST_HEADER;
+    TRACE_BEGIN_ITEM("request", id);
+    Value value = 0;
+    InterpretResult status = evaluate(server, source, length, &value);
+
+    reserve(&client->output, &client->outputCapacity,
+            client->outputLength + RECORD_SIZE);
+    encodeRecord(client->output + client->outputLength, id, status,
+                 value);
+    client->outputLength += RECORD_SIZE;
+    offset += REQUEST_HEADER + length;
+    TRACE_END();
+  }
+
+  memmove(client->input, client->input + offset,
+          client->inputLength - offset);
+  client->inputLength -= offset;
+  return true;
+}
+
+// Serves requests on a Unix socket at path until SIGINT or SIGTERM.
+// Each pass of the loop reads from every client with data waiting,
+// runs all the complete requests that turned up as one batch, and
+// answers each client with a single write. Compiled chunks are reused
+// across requests and clients through a ChunkCache, or, given the name
+// of a shared memory segment, across every server using that segment.
+bool runServer(const char* path, const char* sharedName) {
+  Server server;
+  server.useShared = sharedName != NULL;
+  if (server.useShared && !openSharedCache(&server.shared, sharedName)) {
+    fprintf(stderr, "Could not open shared cache \"%s\".\n", sharedName);
+    return false;
+  }
+
+  server.listener = listenOn(path);
+  if (server.listener < 0) {
+    if (server.useShared) closeSharedCache(&server.shared);
+    return false;
+  }
+  server.clientCount = 0;
+  initChunkCache(&server.cache);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  action.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &action, NULL);
+
+  struct pollfd fds[MAX_CLIENTS + 1];
+  while (!stopping) {
+    // With every slot taken, new connections wait in the backlog;
+    // polling the listener would only wake the loop straight back up.
+    fds[0].fd = server.listener;
+    fds[0].events = server.clientCount < MAX_CLIENTS ? POLLIN : 0;
+    for (int i = 0; i < server.clientCount; i++) {
+      Client* client = &server.clients[i];
+      fds[i + 1].fd = client->fd;
+      fds[i + 1].events = client->eof ? 0 : POLLIN;
+      if (client->outputLength > 0) fds[i + 1].events |= POLLOUT;
+    }
+
+    int polled = server.clientCount;
+    if (poll(fds, (nfds_t)polled + 1, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    // Walk backwards so closing a client, which moves the last one
+    // into its place, doesn't skip anyone.
+    for (int i = polled - 1; i >= 0; i--) {
+      Client* client = &server.clients[i];
+      short events = fds[i + 1].revents;
+      bool open = true;
+      if (!client->eof && (events & (POLLIN | POLLHUP | POLLERR))) {
+        open = readClient(client) && serveRequests(&server, client);
+      }
+      if (client->outputLength > 0 && !writeClient(client)) open = false;
+      if (client->eof && client->outputLength == 0) open = false;
+      if (!open) closeClient(&server, i);
+    }
+
+    if (fds[0].revents & POLLIN) acceptClients(&server);
+  }
+
+  while (server.clientCount > 0) closeClient(&server, 0);
+  freeChunkCache(&server.cache);
+  if (server.useShared) closeSharedCache(&server.shared);
+  close(server.listener);
+  unlink(path);
+  return true;
+}
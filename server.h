@@ -0,0 +1,16 @@
+#ifndef clox_server_h
+#define clox_server_h
+
+#include "common.h"
+
+// Requests are a little-endian uint32 id and uint32 length followed by
+// that many bytes of source. Each gets back a framed result record
+// (see OutputFormat) carrying the request's id as its index.
+#define REQUEST_HEADER 8
+#define REQUEST_MAX (1024 * 1024)
+// Connections served at once; any more wait to be accepted.
+#define MAX_CLIENTS 256
+
+bool runServer(const char* path, const char* sharedName);
+
+#endif
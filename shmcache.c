@@ -0,0 +1,262 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "compiler.h"
+#include "shmcache.h"
+
+// The segment is a header followed by SHARED_SETS sets of SHARED_WAYS
+// fixed-size slots; a source hashes to a set and may sit in any of its
+// ways. A slot holds one chunk as offsets from its own data, never as
+// pointers, so every process can run it wherever the segment is mapped
+// in its address space:
+//
+//   constants  Value[constantCount]
+//   code       uint8_t[count]
+//   lines      int[count], 4-byte aligned
+//   source     char[sourceLength], to check hits against
+//
+// Nothing takes a lock to read. A slot's seq is odd while a writer owns
+// it. A reader pins the slot and then checks that seq hasn't moved; a
+// writer makes seq odd and then checks there are no pins. Whichever
+// goes second sees the other and backs off, so a pinned chunk is never
+// overwritten. Eviction takes the least recently used unpinned way.
+// A process that dies while holding a pin or mid-write leaves that one
+// slot unusable until the segment is removed.
+
+// Bump with any change to this layout or to the bytecode.
+#define SHARED_VERSION 6
+#define SHARED_SETS 1024
+#define SHARED_WAYS 8
+#define SHARED_SLOTS (SHARED_SETS * SHARED_WAYS)
+#define SLOT_DATA 1024
+
+struct SharedSlot {
+  _Atomic uint64_t hash;
+  _Atomic uint64_t lastUsed;
+  _Atomic uint32_t seq;
+  _Atomic uint32_t pins;
+  uint32_t sourceLength;
+  uint32_t count;
+  uint32_t constantCount;
+  uint32_t padding;
+  uint64_t data[SLOT_DATA / sizeof(uint64_t)];
+};
+
+struct SharedHeader {
+  _Atomic uint32_t version;
+  _Atomic uint64_t clock;
+  SharedSlot slots[];
+};
+
+typedef struct {
+  size_t code;
+  size_t lines;
+  size_t source;
+  size_t end;
+} SlotLayout;
+
+// Fast-math chunks compute different results, so they get a segment
+// of their own.
+static uint32_t segmentVersion() {
+  return SHARED_VERSION << 1 | (compilerOptions.fastMath ? 1 : 0);
+}
+
+static SlotLayout layoutFor(size_t count, size_t constantCount,
+                            size_t sourceLength) {
+  SlotLayout layout;
+  layout.code = sizeof(Value) * constantCount;
+  layout.lines = (layout.code + count + 3) & ~(size_t)3;
+  layout.source = layout.lines + sizeof(int) * count;
+  layout.end = layout.source + sourceLength;
+  return layout;
+}
+
+bool openSharedCache(SharedCache* cache, const char* name) {
+  size_t size = sizeof(SharedHeader) + sizeof(SharedSlot) * SHARED_SLOTS;
+  int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+  if (fd < 0) return false;
+
+  // A new segment is all zeros, which is a valid empty cache. Whoever
+  // gets here first sizes it; a size we don't expect is some other
+  // build's layout.
+  struct stat info;
+  bool usable = fstat(fd, &info) == 0 &&
+      ((size_t)info.st_size == size ||
+       (info.st_size == 0 && ftruncate(fd, (off_t)size) == 0));
+  void* segment = MAP_FAILED;
+  if (usable) {
+    segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (segment == MAP_FAILED) return false;
+
+  SharedHeader* header = segment;
+  uint32_t version = 0;
+  atomic_compare_exchange_strong(&header->version, &version,
+                                 segmentVersion());
+  if (atomic_load(&header->version) != segmentVersion()) {
+    munmap(segment, size);
+    return false;
+  }
+
+  cache->header = header;
+  cache->size = size;
+  cache->hits = 0;
+  cache->misses = 0;
+  return true;
+}
+
+void closeSharedCache(SharedCache* cache) {
+  munmap(cache->header, cache->size);
+  cache->header = NULL;
+}
+
+bool removeSharedCache(const char* name) {
+  return shm_unlink(name) == 0;
+}
+
+static void touch(SharedCache* cache, SharedSlot* slot) {
+  atomic_store(&slot->lastUsed,
+               atomic_fetch_add(&cache->header->clock, 1) + 1);
+}
+
+static void viewSlot(SharedSlot* slot, Chunk* chunk) {
+  char* data = (char*)slot->data;
+  SlotLayout layout = layoutFor(slot->count, slot->constantCount, 0);
+  chunk->count = (int)slot->count;
+  chunk->capacity = 0;
+  chunk->code = (uint8_t*)(data + layout.code);
+  chunk->lines = (int*)(data + layout.lines);
+  chunk->constants.count = (int)slot->constantCount;
+  chunk->constants.capacity = (int)slot->constantCount;
+  chunk->constants.values = (Value*)data;
+}
+
+// Pins the slot if it holds source.
+static bool pinSlot(SharedSlot* slot, uint64_t hash, const char* source,
+                    size_t length) {
+  if (atomic_load(&slot->hash) != hash) return false;
+  uint32_t seq = atomic_load(&slot->seq);
+  if (seq & 1) return false;
+
+  atomic_fetch_add(&slot->pins, 1);
+  if (atomic_load(&slot->seq) == seq &&
+      atomic_load(&slot->hash) == hash && slot->sourceLength == length) {
+    SlotLayout layout = layoutFor(slot->count, slot->constantCount, 0);
+    if (memcmp((char*)slot->data + layout.source, source, length) == 0) {
+      return true;
+    }
+  }
+  atomic_fetch_sub(&slot->pins, 1);
+  return false;
+}
+
+// Copies chunk into the set's empty or least recently used unpinned
+// way and returns it pinned, or NULL if the chunk is too big or every
+// way is busy.
+static SharedSlot* publish(SharedCache* cache, SharedSlot* set,
+                           uint64_t hash, const char* source,
+                           size_t length, Chunk* chunk) {
+  SlotLayout layout = layoutFor((size_t)chunk->count,
+                                (size_t)chunk->constants.count, length);
+  if (layout.end > SLOT_DATA) return NULL;
+
+  for (int attempt = 0; attempt < SHARED_WAYS; attempt++) {
+    SharedSlot* victim = NULL;
+    uint64_t oldest = UINT64_MAX;
+    for (int way = 0; way < SHARED_WAYS; way++) {
+      SharedSlot* slot = &set[way];
+      uint64_t lastUsed = atomic_load(&slot->lastUsed);
+      if (atomic_load(&slot->pins) == 0 &&
+          (atomic_load(&slot->seq) & 1) == 0 && lastUsed < oldest) {
+        victim = slot;
+        oldest = lastUsed;
+      }
+    }
+    if (victim == NULL) return NULL;
+
+    uint32_t seq = atomic_load(&victim->seq);
+    if ((seq & 1) ||
+        !atomic_compare_exchange_strong(&victim->seq, &seq, seq + 1)) {
+      continue;
+    }
+    if (atomic_load(&victim->pins) != 0) {
+      atomic_store(&victim->seq, seq + 2);
+      continue;
+    }
+
+    atomic_store(&victim->hash, 0);
+    char* data = (char*)victim->data;
+    memcpy(data, chunk->constants.values,
+           sizeof(Value) * (size_t)chunk->constants.count);
+    memcpy(data + layout.code, chunk->code, (size_t)chunk->count);
+    memcpy(data + layout.lines, chunk->lines,
+           sizeof(int) * (size_t)chunk->count);
+    memcpy(data + layout.source, source, length);
+    victim->sourceLength = (uint32_t)length;
+    victim->count = (uint32_t)chunk->count;
+    victim->constantCount = (uint32_t)chunk->constants.count;
+    touch(cache, victim);
+    atomic_store(&victim->pins, 1);
+    atomic_store(&victim->hash, hash);
+    atomic_store(&victim->seq, seq + 2);
+    return victim;
+  }
+  return NULL;
+}
+
+// Finds or compiles source's chunk and pins it until
+// releaseSharedChunk(). Returns false if it doesn't compile. A chunk
+// that can't be published, because it's too big for a slot or its set
+// is pinned solid, is handed back as a private compile instead.
+bool acquireSharedChunk(SharedCache* cache, const char* source,
+                        size_t length, SharedChunk* shared) {
+  // Zero marks an empty slot.
+  uint64_t hash = hashSource(source, length);
+  if (hash == 0) hash = 1;
+  SharedSlot* set = &cache->header->slots[
+      (hash % SHARED_SETS) * SHARED_WAYS];
+
+  for (int way = 0; way < SHARED_WAYS; way++) {
+    if (pinSlot(&set[way], hash, source, length)) {
+      cache->hits++;
+      touch(cache, &set[way]);
+      shared->slot = &set[way];
+      viewSlot(shared->slot, &shared->chunk);
+      return true;
+    }
+  }
+
+  cache->misses++;
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, length, &chunk)) {
+    freeChunk(&chunk);
+    return false;
+  }
+
+  shared->slot = publish(cache, set, hash, source, length, &chunk);
+  if (shared->slot == NULL) {
+    shared->chunk = chunk;
+    return true;
+  }
+  freeChunk(&chunk);
+  viewSlot(shared->slot, &shared->chunk);
+  return true;
+}
+
+void releaseSharedChunk(SharedChunk* shared) {
+  if (shared->slot != NULL) {
+    atomic_fetch_sub(&shared->slot->pins, 1);
+    shared->slot = NULL;
+  } else {
+    freeChunk(&shared->chunk);
+  }
+}
@@ -0,0 +1,33 @@
+#ifndef clox_shmcache_h
+#define clox_shmcache_h
+
+#include "chunk.h"
+
+typedef struct SharedHeader SharedHeader;
+typedef struct SharedSlot SharedSlot;
+
+// A compiled chunk cache in POSIX shared memory, so worker processes
+// reuse each other's compiles. See shmcache.c for the layout.
+typedef struct {
+  SharedHeader* header;
+  size_t size;
+  uint64_t hits;
+  uint64_t misses;
+} SharedCache;
+
+// A chunk handed out by acquireSharedChunk(). When slot is set, chunk
+// points straight into the segment and must not be written or freed;
+// otherwise it's a private compile that didn't fit.
+typedef struct {
+  Chunk chunk;
+  SharedSlot* slot;
+} SharedChunk;
+
+bool openSharedCache(SharedCache* cache, const char* name);
+void closeSharedCache(SharedCache* cache);
+bool removeSharedCache(const char* name);
+bool acquireSharedChunk(SharedCache* cache, const char* source,
+                        size_t length, SharedChunk* shared);
+void releaseSharedChunk(SharedChunk* shared);
+
+#endif
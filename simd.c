@@ -0,0 +1,217 @@
+#include "simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+static bool isBlankNewline(char c, int* lines) {
+  if (c == '\n') {
+    (*lines)++;
+    return true;
+  }
+  return c == ' ' || c == '\r' || c == '\t';
+}
+
+static bool isDigitChar(char c) {
+  return c >= '0' && c <= '9';
+}
+
+static bool isIdentifierChar(char c) {
+  return (c >= 'a' && c <= 'z') ||
+         (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') ||
+         c == '_';
+}
+
+static const char* skipBlanksScalar(const char* p, const char* end,
+                                    int* lines) {
+  while (p < end && isBlankNewline(*p, lines)) p++;
+  return p;
+}
+
+static const char* skipToNewlineScalar(const char* p,
+                                       const char* end) {
+  while (p < end && *p != '\n') p++;
+  return p;
+}
+
+static const char* skipDigitsScalar(const char* p, const char* end) {
+  while (p < end && isDigitChar(*p)) p++;
+  return p;
+}
+
+static const char* skipIdentifierScalar(const char* p,
+                                        const char* end) {
+  while (p < end && isIdentifierChar(*p)) p++;
+  return p;
+}
+
+#ifdef SIMD_X86
+
+// The 16- and 32-byte kernels are the same code at two widths. Each
+// builds a mask of the bytes in its class; the first zero bit is where
+// the run ends. Whatever is left after the last full block goes to the
+// scalar loop. Byte compares are signed, so bytes >= 0x80 fall outside
+// every range below, as they do in the scalar versions.
+
+#define DEFINE_KERNELS(suffix, isa, vec, width, full, \
+                       set1, loadu, cmpeq, cmpgt, cmplt, and, or, \
+                       movemask) \
+  __attribute__((target(isa))) \
+  static const char* skipBlanks##suffix(const char* p, \
+      const char* end, int* lines) { \
+    const vec space = set1(' '); \
+    const vec tab = set1('\t'); \
+    const vec cr = set1('\r'); \
+    const vec nl = set1('\n'); \
+    while (end - p >= width) { \
+      vec chunk = loadu((const vec*)p); \
+      vec newline = cmpeq(chunk, nl); \
+      vec blank = or(or(cmpeq(chunk, space), cmpeq(chunk, tab)), \
+                     or(cmpeq(chunk, cr), newline)); \
+      uint32_t mask = (uint32_t)movemask(blank); \
+      uint32_t newlines = (uint32_t)movemask(newline); \
+      if (mask != full) { \
+        int stop = __builtin_ctz(~mask); \
+        *lines += __builtin_popcount(newlines & ((1u << stop) - 1)); \
+        return p + stop; \
+      } \
+      *lines += __builtin_popcount(newlines); \
+      p += width; \
+    } \
+    return skipBlanksScalar(p, end, lines); \
+  } \
+  \
+  __attribute__((target(isa))) \
+  static const char* skipToNewline##suffix(const char* p, \
+      const char* end) { \
+    const vec nl = set1('\n'); \
+    while (end - p >= width) { \
+      uint32_t mask = (uint32_t)movemask( \
+          cmpeq(loadu((const vec*)p), nl)); \
+      if (mask != 0) return p + __builtin_ctz(mask); \
+      p += width; \
+    } \
+    return skipToNewlineScalar(p, end); \
+  } \
+  \
+  __attribute__((target(isa))) \
+  static const char* skipDigits##suffix(const char* p, \
+      const char* end) { \
+    const vec below = set1('0' - 1); \
+    const vec above = set1('9' + 1); \
+    while (end - p >= width) { \
+      vec chunk = loadu((const vec*)p); \
+      vec digit = and(cmpgt(chunk, below), cmplt(chunk, above)); \
+      uint32_t mask = (uint32_t)movemask(digit); \
+      if (mask != full) return p + __builtin_ctz(~mask); \
+      p += width; \
+    } \
+    return skipDigitsScalar(p, end); \
+  } \
+  \
+  __attribute__((target(isa))) \
+  static const char* skipIdentifier##suffix(const char* p, \
+      const char* end) { \
+    const vec digitBelow = set1('0' - 1); \
+    const vec digitAbove = set1('9' + 1); \
+    const vec alphaBelow = set1('a' - 1); \
+    const vec alphaAbove = set1('z' + 1); \
+    const vec caseBit = set1(0x20); \
+    const vec underscore = set1('_'); \
+    while (end - p >= width) { \
+      vec chunk = loadu((const vec*)p); \
+      vec lower = or(chunk, caseBit); \
+      vec alpha = and(cmpgt(lower, alphaBelow), \
+                      cmplt(lower, alphaAbove)); \
+      vec digit = and(cmpgt(chunk, digitBelow), \
+                      cmplt(chunk, digitAbove)); \
+      vec ident = or(or(alpha, digit), cmpeq(chunk, underscore)); \
+      uint32_t mask = (uint32_t)movemask(ident); \
+      if (mask != full) return p + __builtin_ctz(~mask); \
+      p += width; \
+    } \
+    return skipIdentifierScalar(p, end); \
+  }
+
+#define CMPLT_EPI8_AVX2(a, b) _mm256_cmpgt_epi8(b, a)
+
+DEFINE_KERNELS(Sse2, "sse2", __m128i, 16, 0xFFFFu,
+               _mm_set1_epi8, _mm_loadu_si128, _mm_cmpeq_epi8,
+               _mm_cmpgt_epi8, _mm_cmplt_epi8, _mm_and_si128,
+               _mm_or_si128, _mm_movemask_epi8)
+
+DEFINE_KERNELS(Avx2, "avx2,popcnt", __m256i, 32, 0xFFFFFFFFu,
+               _mm256_set1_epi8, _mm256_loadu_si256, _mm256_cmpeq_epi8,
+               _mm256_cmpgt_epi8, CMPLT_EPI8_AVX2, _mm256_and_si256,
+               _mm256_or_si256, _mm256_movemask_epi8)
+
+#endif
+
+SimdKernels simd = {
+  skipBlanksScalar,
+  skipToNewlineScalar,
+  skipDigitsScalar,
+  skipIdentifierScalar,
+};
+
+static bool simdReady = false;
+
+void initSimd() {
+  if (simdReady) return;
+  useSimd(detectSimd());
+}
+
+SimdLevel detectSimd() {
+#ifdef SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+  if (__builtin_cpu_supports("sse2")) return SIMD_SSE2;
+#endif
+  return SIMD_SCALAR;
+}
+
+// Returns false, leaving the kernels alone, if this CPU can't run the
+// requested level.
+bool useSimd(SimdLevel level) {
+  if (level > detectSimd()) return false;
+
+  switch (level) {
+    case SIMD_SCALAR:
+      simd.skipBlanks = skipBlanksScalar;
+      simd.skipToNewline = skipToNewlineScalar;
+      simd.skipDigits = skipDigitsScalar;
+      simd.skipIdentifier = skipIdentifierScalar;
+      break;
+#ifdef SIMD_X86
+    case SIMD_SSE2:
+      simd.skipBlanks = skipBlanksSse2;
+      simd.skipToNewline = skipToNewlineSse2;
+      simd.skipDigits = skipDigitsSse2;
+      simd.skipIdentifier = skipIdentifierSse2;
+      break;
+    case SIMD_AVX2:
+      simd.skipBlanks = skipBlanksAvx2;
+      simd.skipToNewline = skipToNewlineAvx2;
+      simd.skipDigits = skipDigitsAvx2;
+      simd.skipIdentifier = skipIdentifierAvx2;
+      break;
+#else
+    default:
+      return false;
+#endif
+  }
+
+  simdReady = true;
+  return true;
+}
+
+const char* simdName(SimdLevel level) {
+  switch (level) {
+    case SIMD_SCALAR: return "scalar";
+    case SIMD_SSE2:   return "sse2";
+    case SIMD_AVX2:   return "avx2";
+  }
+  return "unknown";
+}
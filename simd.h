@@ -0,0 +1,28 @@
+#ifndef clox_simd_h
+#define clox_simd_h
+
+#include "common.h"
+
+typedef enum {
+  SIMD_SCALAR,
+  SIMD_SSE2,
+  SIMD_AVX2,
+} SimdLevel;
+
+// Each returns the first byte in [p, end) outside the class it skips,
+// or end. skipBlanks() adds the newlines it passes to *lines.
+typedef struct {
+  const char* (*skipBlanks)(const char* p, const char* end, int* lines);
+  const char* (*skipToNewline)(const char* p, const char* end);
+  const char* (*skipDigits)(const char* p, const char* end);
+  const char* (*skipIdentifier)(const char* p, const char* end);
+} SimdKernels;
+
+extern SimdKernels simd;
+
+void initSimd();
+SimdLevel detectSimd();
+bool useSimd(SimdLevel level);
+const char* simdName(SimdLevel level);
+
+#endif
@@ -3,12 +3,15 @@
 Integration test runner for clox compiler.
 
 Runs .lox test files and validates output against expectations
-embedded in comments.
+embedded in comments. With --native, instead checks that each file,
+and each printed expression in it on its own, gives the same result
+compiled to native code with --emit-c as it does interpreted.
 """
 
 import subprocess
 import sys
 import os
+import tempfile
 from pathlib import Path
 import re
 
@@ -118,6 +121,59 @@ def run_test(test_file, interpreter='./clox'):
     return TestResult(test_name, True)
 
 
+def run_both(source_file, cache_dir, interpreter='./clox'):
+    """Run a file interpreted and native; return a mismatch or None."""
+    outcomes = []
+    for flags in ([], [f'--emit-c={cache_dir}']):
+        try:
+            result = subprocess.run(
+                [interpreter, *flags, str(source_file)],
+                capture_output=True,
+                text=True,
+                timeout=60
+            )
+        except subprocess.TimeoutExpired:
+            return "Timed out after 60 seconds"
+        if 'Could not build native code' in result.stderr:
+            return f"Native build failed:\n{result.stderr}"
+        # Debug builds trace to stdout first; the result is last.
+        lines = result.stdout.strip().split('\n')
+        outcomes.append((result.returncode, lines[-1]))
+
+    (interpreted_code, interpreted), (native_code, native) = outcomes
+    if interpreted_code != native_code:
+        return (f"Exit {interpreted_code} interpreted, "
+                f"{native_code} native")
+    if interpreted_code == 0 and interpreted != native:
+        return (f"Interpreted: {interpreted}\n"
+                f"Native:      {native}")
+    return None
+
+
+def run_native_test(test_file, cache_dir):
+    """Compare a file, and each of its printed expressions, both ways."""
+    test_name = str(test_file.relative_to('test/integration'))
+    message = run_both(test_file, cache_dir)
+    if message:
+        return TestResult(test_name, False, message)
+
+    with open(test_file) as f:
+        content = f.read()
+    with tempfile.TemporaryDirectory() as scratch:
+        expression_file = Path(scratch) / 'expression.lox'
+        for line in content.split('\n'):
+            match = re.match(r'\s*print\s+(.+?);', line)
+            if not match:
+                continue
+            expression_file.write_text(match.group(1))
+            message = run_both(expression_file, cache_dir)
+            if message:
+                return TestResult(test_name, False,
+                                f"{match.group(1)}\n{message}")
+
+    return TestResult(test_name, True)
+
+
 def find_tests(test_dir='test/integration'):
     """Find all .lox test files in the test directory."""
     test_path = Path(test_dir)
@@ -169,9 +225,14 @@ def main():
     print(f"Running {len(test_files)} integration tests...\n")
 
     results = []
-    for test_file in test_files:
-        result = run_test(test_file)
-        results.append(result)
+    if '--native' in sys.argv[1:]:
+        with tempfile.TemporaryDirectory() as cache_dir:
+            for test_file in test_files:
+                results.append(run_native_test(test_file, cache_dir))
+    else:
+        for test_file in test_files:
+            result = run_test(test_file)
+            results.append(result)
 
     # Print results
     success = print_results(results)
@@ -0,0 +1,188 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmocka.h>
+#include <string.h>
+#include "aot.h"
+#include "cache.h"
+#include "compiler.h"
+
+static Chunk chunk;
+static char directory[] = "/tmp/clox-aot-XXXXXX";
+
+static int setup_chunk(void **state) {
+    (void) state;
+    initVM();
+    initChunk(&chunk);
+    return 0;
+}
+
+static int teardown_chunk(void **state) {
+    (void) state;
+    freeChunk(&chunk);
+    freeVM();
+    compilerOptions.cse = false;
+    compilerOptions.fastMath = false;
+    return 0;
+}
+
+static int setup_directory(void **state) {
+    (void) state;
+    if (mkdtemp(directory) == NULL) return -1;
+    nativeCacheDir = directory;
+    return 0;
+}
+
+static int teardown_directory(void **state) {
+    (void) state;
+    char command[64];
+    snprintf(command, sizeof(command), "rm -rf %s", directory);
+    nativeCacheDir = NULL;
+    return system(command);
+}
+
+static void compile_source(const char *source) {
+    assert_true(compile(source, strlen(source), &chunk));
+}
+
+static char *emitted_c(char *buffer, size_t size) {
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    assert_true(emitC(&chunk, 0, file));
+    rewind(file);
+    size_t length = fread(buffer, 1, size - 1, file);
+    buffer[length] = '\0';
+    fclose(file);
+    return buffer;
+}
+
+static void test_stack_slots_become_locals(void **state) {
+    (void) state;
+    compile_source("1 - (2 + 0.5) * -3");
+    char buffer[1024];
+    emitted_c(buffer, sizeof(buffer));
+    assert_non_null(strstr(buffer, "double clox_expression(void) {\n"
+                                   "  double s0, s1, s2;\n"
+                                   "  s0 = literal(1.0);\n"
+                                   "  s1 = literal(2.0);\n"
+                                   "  s1 = s1 + literal(0x1p-1);\n"));
+    assert_non_null(strstr(buffer, "  s0 = s0 - s1;\n"
+                                   "  return s0;\n}\n"));
+}
+
+static void test_fused_and_temp_operations(void **state) {
+    (void) state;
+    compilerOptions.fastMath = true;
+    compile_source("0.1 * 0.1 - 0.01");
+    char buffer[1024];
+    emitted_c(buffer, sizeof(buffer));
+    assert_non_null(strstr(buffer, "  s0 = fma(s0, s1, -s2);\n"));
+    freeChunk(&chunk);
+
+    compilerOptions.fastMath = false;
+    compilerOptions.cse = true;
+    compile_source("(1.5 + 2) * (1.5 + 2) - (1.5 + 2)");
+    emitted_c(buffer, sizeof(buffer));
+    assert_non_null(strstr(buffer, "  s1 = s0;\n"));
+    assert_non_null(strstr(buffer, "  return s1;\n"));
+}
+
+static void test_partial_code_is_refused(void **state) {
+    (void) state;
+    compile_source("1.5 + 2.5");
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    assert_false(emitC(&chunk, 2, file));
+    assert_int_equal(ftell(file), 0);
+    fclose(file);
+}
+
+// Whatever the interpreter computes, the native build computes too,
+// to the bit, signed zeros and NaN signs included.
+static void test_native_matches_interpreter(void **state) {
+    (void) state;
+    const char *sources[] = {
+        "0.1 + 0.2",
+        "-0 * 1 - 0",
+        "(0 / 0) * -1",
+        "-(0 / 0)",
+        "1 / 0 - 1 / 0",
+        "(1.5 * 2.25 - 3 / 7) * -(2 - 0.5) / 3 + 0.1 * 0.1",
+        "(2 - 3) * (2 - 3) + (2 - 3) * (2 - 3) / 7",
+        "-128 + 127 * 1 - 0 / 1",
+    };
+    for (int mode = 0; mode < 3; mode++) {
+        compilerOptions.cse = mode == 1;
+        compilerOptions.fastMath = mode == 2;
+        for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]);
+             i++) {
+            size_t length = strlen(sources[i]);
+            compile_source(sources[i]);
+            Value interpreted;
+            assert_int_equal(runChunk(&chunk, &interpreted), INTERPRET_OK);
+
+            NativeFunction native = loadNative(sources[i], length, &chunk);
+            assert_non_null(native);
+            Value value = native();
+            assert_memory_equal(&interpreted, &value, sizeof(Value));
+            freeChunk(&chunk);
+        }
+    }
+}
+
+static void test_cache_hits_need_the_same_source(void **state) {
+    (void) state;
+    const char *source = "6 * 7";
+    const char *other = "6 * 8";
+    assert_null(loadNative(source, strlen(source), NULL));
+
+    // Another source's object under this one's name, as a hash
+    // collision or a racing build would leave it, is a miss.
+    compile_source(other);
+    assert_non_null(loadNative(other, strlen(other), &chunk));
+    freeChunk(&chunk);
+    char command[256];
+    snprintf(command, sizeof(command), "cp %s/%016llx-%d.so %s/%016llx-%d.so",
+             directory, (unsigned long long)hashSource(other, strlen(other)),
+             AOT_VERSION, directory,
+             (unsigned long long)hashSource(source, strlen(source)),
+             AOT_VERSION);
+    assert_int_equal(system(command), 0);
+    assert_null(loadNative(source, strlen(source), NULL));
+
+    // Given the chunk, it's rebuilt over the impostor.
+    compile_source(source);
+    assert_non_null(loadNative(source, strlen(source), &chunk));
+
+    // Found again without the chunk, in this process or the next.
+    NativeFunction native = loadNative(source, strlen(source), NULL);
+    assert_non_null(native);
+    assert_float_equal(native(), 42.0, 0);
+
+    // Fast math keeps its own builds.
+    compilerOptions.fastMath = true;
+    assert_null(loadNative(source, strlen(source), NULL));
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_stack_slots_become_locals,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_fused_and_temp_operations,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_partial_code_is_refused,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_native_matches_interpreter,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(
+            test_cache_hits_need_the_same_source,
+            setup_chunk, teardown_chunk),
+    };
+    return cmocka_run_group_tests(tests, setup_directory,
+                                  teardown_directory);
+}
@@ -0,0 +1,116 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <cmocka.h>
+#include <string.h>
+#include "cache.h"
+#include "vm.h"
+
+static int setup_cache(void **state) {
+    static ChunkCache cache;
+    initVM();
+    initChunkCache(&cache);
+    *state = &cache;
+    return 0;
+}
+
+static int teardown_cache(void **state) {
+    freeChunkCache((ChunkCache *)*state);
+    freeVM();
+    return 0;
+}
+
+static Value run_cached(ChunkCache *cache, const char *source) {
+    Chunk *chunk = cachedChunk(cache, source, strlen(source));
+    assert_non_null(chunk);
+    Value value;
+    assert_int_equal(runChunk(chunk, &value), INTERPRET_OK);
+    return value;
+}
+
+static void test_hash_is_fnv1a(void **state) {
+    (void) state;
+    assert_true(hashSource("", 0) == 14695981039346656037u);
+    assert_true(hashSource("a", 1) == 0xaf63dc4c8601ec8cu);
+}
+
+static void test_reuses_compiled_chunk(void **state) {
+    ChunkCache *cache = (ChunkCache *)*state;
+    Chunk *first = cachedChunk(cache, "1 + 2", 5);
+    Chunk *second = cachedChunk(cache, "1 + 2", 5);
+    assert_ptr_equal(first, second);
+    assert_int_equal(cache->misses, 1);
+    assert_int_equal(cache->hits, 1);
+}
+
+static void test_runs_cached_chunk_again(void **state) {
+    ChunkCache *cache = (ChunkCache *)*state;
+    assert_float_equal(run_cached(cache, "(1 + 2) * 4"), 12.0, 0);
+    assert_float_equal(run_cached(cache, "(1 + 2) * 4"), 12.0, 0);
+    assert_float_equal(run_cached(cache, "-(3 - 5)"), 2.0, 0);
+}
+
+// With --predecode the decoded form is kept with the entry, so only
+// the first run decodes.
+static void test_keeps_decoded_chunk(void **state) {
+    ChunkCache *cache = (ChunkCache *)*state;
+    predecodeChunks = true;
+    CacheEntry *entry = cachedEntry(cache, "(1 + 2) * 4", 11);
+    assert_non_null(entry);
+    assert_int_equal(entry->decoded.count, 0);
+
+    Value value;
+    assert_int_equal(runCacheEntry(entry, &value), INTERPRET_OK);
+    assert_float_equal(value, 12.0, 0);
+    DecodedInstruction *code = entry->decoded.code;
+    int count = entry->decoded.count;
+    assert_true(count > 0);
+
+    assert_ptr_equal(cachedEntry(cache, "(1 + 2) * 4", 11), entry);
+    entry->decoded.code[0].as.value = 5;
+    assert_int_equal(runCacheEntry(entry, &value), INTERPRET_OK);
+    assert_float_equal(value, 28.0, 0);
+    assert_ptr_equal(entry->decoded.code, code);
+    assert_int_equal(entry->decoded.count, count);
+    predecodeChunks = false;
+}
+
+static void test_does_not_cache_errors(void **state) {
+    ChunkCache *cache = (ChunkCache *)*state;
+    assert_null(cachedChunk(cache, "1 +", 3));
+    assert_null(cachedChunk(cache, "1 +", 3));
+    assert_int_equal(cache->misses, 2);
+}
+
+static void test_compares_source_on_hit(void **state) {
+    ChunkCache *cache = (ChunkCache *)*state;
+    // Far more sources than slots, so most lookups evict something.
+    char source[32];
+    for (int i = 0; i < CACHE_SLOTS * 2; i++) {
+        snprintf(source, sizeof(source), "%d + 0.5", i);
+        assert_float_equal(run_cached(cache, source), i + 0.5, 0);
+    }
+    for (int i = 0; i < CACHE_SLOTS * 2; i += 7) {
+        snprintf(source, sizeof(source), "%d + 0.5", i);
+        assert_float_equal(run_cached(cache, source), i + 0.5, 0);
+    }
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_hash_is_fnv1a),
+        cmocka_unit_test_setup_teardown(test_reuses_compiled_chunk,
+                                        setup_cache, teardown_cache),
+        cmocka_unit_test_setup_teardown(test_runs_cached_chunk_again,
+                                        setup_cache, teardown_cache),
+        cmocka_unit_test_setup_teardown(test_keeps_decoded_chunk,
+                                        setup_cache, teardown_cache),
+        cmocka_unit_test_setup_teardown(test_does_not_cache_errors,
+                                        setup_cache, teardown_cache),
+        cmocka_unit_test_setup_teardown(test_compares_source_on_hit,
+                                        setup_cache, teardown_cache),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
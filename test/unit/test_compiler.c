@@ -0,0 +1,469 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "compiler.h"
+
+static Chunk chunk;
+
+static int setup_chunk(void **state) {
+    (void) state;
+    initVM();
+    initChunk(&chunk);
+    return 0;
+}
+
+static int teardown_chunk(void **state) {
+    (void) state;
+    freeChunk(&chunk);
+    freeVM();
+    compilerOptions.cse = false;
+    compilerOptions.fastMath = false;
+    compilerOptions.simplify = false;
+    simplifyStats = (SimplifyStats){0};
+    cseStats.treeInstructions = 0;
+    cseStats.emittedInstructions = 0;
+    return 0;
+}
+
+static void compile_source(const char *source) {
+    assert_true(compile(source, strlen(source), &chunk));
+}
+
+// Checks the chunk's opcodes, skipping operands, against expected,
+// which ends with OP_RETURN.
+static void assert_opcodes(const uint8_t *expected) {
+    int offset = 0;
+    for (int i = 0;; i++) {
+        assert_true(offset < chunk.count);
+        uint8_t op = chunk.code[offset];
+        assert_int_equal(op, expected[i]);
+        if (op == OP_RETURN) break;
+        offset += op == OP_CONSTANT || op == OP_SMALL_INT ||
+                  op == OP_GET_TEMP || op == OP_RESULT ||
+                  (op >= OP_ADD_CONSTANT && op <= OP_DIVIDE_CONSTANT)
+                  ? 2 : 1;
+    }
+}
+
+static Value run_compiled(void) {
+    Value value;
+    assert_int_equal(runChunk(&chunk, &value), INTERPRET_OK);
+    return value;
+}
+
+static void test_literal_right_operand_folds(void **state) {
+    (void) state;
+    compile_source("1 + 2");
+    const uint8_t expected[] = {OP_ONE, OP_ADD_CONSTANT, OP_RETURN};
+    assert_opcodes(expected);
+    assert_float_equal(run_compiled(), 3.0, 0);
+}
+
+static void test_each_operator_folds(void **state) {
+    (void) state;
+    compile_source("((8 - 2) * 3) / 4");
+    const uint8_t expected[] = {
+        OP_SMALL_INT, OP_SUBTRACT_CONSTANT, OP_MULTIPLY_CONSTANT,
+        OP_DIVIDE_CONSTANT, OP_RETURN,
+    };
+    assert_opcodes(expected);
+    assert_float_equal(run_compiled(), 4.5, 0);
+}
+
+static void test_compound_right_operand_does_not_fold(void **state) {
+    (void) state;
+    compile_source("1 - -2");
+    const uint8_t expected[] = {
+        OP_ONE, OP_SMALL_INT, OP_NEGATE, OP_SUBTRACT, OP_RETURN,
+    };
+    assert_opcodes(expected);
+    assert_float_equal(run_compiled(), 3.0, 0);
+}
+
+static void test_left_literal_does_not_fold(void **state) {
+    (void) state;
+    compile_source("2 / (1 + 3)");
+    const uint8_t expected[] = {
+        OP_SMALL_INT, OP_ONE, OP_ADD_CONSTANT, OP_DIVIDE, OP_RETURN,
+    };
+    assert_opcodes(expected);
+    assert_float_equal(run_compiled(), 0.5, 0);
+}
+
+static void test_small_integers_skip_the_pool(void **state) {
+    (void) state;
+    compile_source("0 + 1 * 127 - 128 * 1.5");
+    const uint8_t expected[] = {
+        OP_ZERO, OP_ONE, OP_MULTIPLY_CONSTANT, OP_ADD, OP_CONSTANT,
+        OP_MULTIPLY_CONSTANT, OP_SUBTRACT, OP_RETURN,
+    };
+    assert_opcodes(expected);
+    assert_int_equal(chunk.constants.count, 3);
+    assert_float_equal(run_compiled(), -65.0, 0);
+}
+
+static void test_negative_zero_stays_in_the_pool(void **state) {
+    (void) state;
+    compilerOptions.simplify = true;
+    compile_source("-0");
+    const uint8_t zero[] = {OP_CONSTANT, OP_RETURN};
+    assert_opcodes(zero);
+    Value value = run_compiled();
+    assert_true(value == 0 && signbit(value));
+    freeChunk(&chunk);
+
+    compile_source("-128 - -(1 - 3)");
+    const uint8_t small[] = {
+        OP_SMALL_INT, OP_ONE, OP_SUBTRACT_CONSTANT, OP_NEGATE, OP_SUBTRACT,
+        OP_RETURN,
+    };
+    assert_opcodes(small);
+    assert_int_equal((int8_t)chunk.code[1], -128);
+    assert_float_equal(run_compiled(), -130.0, 0);
+}
+
+static void test_precedence_kept(void **state) {
+    (void) state;
+    compile_source("1 + 2 * 3 - 4 / 2");
+    assert_float_equal(run_compiled(), 5.0, 0);
+}
+
+static void test_cse_reuses_repeated_subexpression(void **state) {
+    (void) state;
+    compilerOptions.cse = true;
+    compile_source("(1 + 2) * (3 - 1) + (1 + 2) * (3 - 1)"
+                   " - (1 + 2) * (3 - 1)");
+    const uint8_t expected[] = {
+        OP_ONE, OP_ADD_CONSTANT, OP_SMALL_INT, OP_SUBTRACT_CONSTANT,
+        OP_MULTIPLY, OP_GET_TEMP, OP_GET_TEMP, OP_ADD, OP_GET_TEMP,
+        OP_SUBTRACT, OP_RETURN,
+    };
+    assert_opcodes(expected);
+    assert_float_equal(run_compiled(), 6.0, 0);
+    assert_int_equal(cseStats.treeInstructions, 17);
+    assert_int_equal(cseStats.emittedInstructions, 10);
+}
+
+static void test_cse_skips_cheap_repeats(void **state) {
+    (void) state;
+    compilerOptions.cse = true;
+    compile_source("-1 * -1");
+    const uint8_t expected[] = {
+        OP_ONE, OP_NEGATE, OP_ONE, OP_NEGATE, OP_MULTIPLY, OP_RETURN,
+    };
+    assert_opcodes(expected);
+    assert_float_equal(run_compiled(), 1.0, 0);
+    assert_int_equal(cseStats.treeInstructions,
+                     cseStats.emittedInstructions);
+}
+
+static void test_cse_shares_constants(void **state) {
+    (void) state;
+    compilerOptions.cse = true;
+    compile_source("2.5 * 3.5 + 2.5 * 3.5");
+    assert_int_equal(chunk.constants.count, 2);
+    assert_float_equal(run_compiled(), 17.5, 0);
+}
+
+// Whatever gets shared, the result is bit for bit the tree's.
+static void test_cse_matches_tree(void **state) {
+    (void) state;
+    const char *sources[] = {
+        "(0 * -1) + (0 * -1)",
+        "-(0 * 1) - -(0 * 1) * -(0 * 1)",
+        "(1 / 0 - 1 / 0) * (1 / 0 - 1 / 0)",
+        "(0.1 + 0.2) * (0.1 + 0.2) / ((0.1 + 0.2) * (0.1 + 0.2) - 1)",
+    };
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        compilerOptions.cse = false;
+        compile_source(sources[i]);
+        Value tree = run_compiled();
+        freeChunk(&chunk);
+
+        compilerOptions.cse = true;
+        compile_source(sources[i]);
+        Value dag = run_compiled();
+        freeChunk(&chunk);
+
+        assert_memory_equal(&tree, &dag, sizeof(Value));
+    }
+}
+
+static void test_strict_mode_does_not_fuse(void **state) {
+    (void) state;
+    compile_source("0.1 * 0.1 - 0.01");
+    const uint8_t expected[] = {
+        OP_CONSTANT, OP_MULTIPLY_CONSTANT, OP_SUBTRACT_CONSTANT, OP_RETURN,
+    };
+    assert_opcodes(expected);
+    volatile double product = 0.1 * 0.1;
+    assert_float_equal(run_compiled(), product - 0.01, 0);
+}
+
+static void test_fast_math_fuses_multiply_add(void **state) {
+    (void) state;
+    compilerOptions.fastMath = true;
+    compile_source("0.1 * 0.1 - 0.01");
+    const uint8_t expected[] = {
+        OP_CONSTANT, OP_CONSTANT, OP_CONSTANT, OP_MULTIPLY_SUBTRACT,
+        OP_RETURN,
+    };
+    assert_opcodes(expected);
+    Value fused = run_compiled();
+    assert_true(fused == fma(0.1, 0.1, -0.01));
+}
+
+static void test_fast_math_fuses_computed_product(void **state) {
+    (void) state;
+    compilerOptions.fastMath = true;
+    compile_source("(1 + 2) * (3 + 4) + 5 * 6");
+    const uint8_t expected[] = {
+        OP_ONE, OP_ADD_CONSTANT, OP_SMALL_INT, OP_ADD_CONSTANT,
+        OP_SMALL_INT, OP_MULTIPLY_CONSTANT, OP_MULTIPLY_ADD, OP_RETURN,
+    };
+    assert_opcodes(expected);
+    assert_float_equal(run_compiled(), 51.0, 0);
+}
+
+static void test_fast_math_reassociates_constants(void **state) {
+    (void) state;
+    compilerOptions.fastMath = true;
+    compile_source("1 - 2 + 3 - 4");
+    const uint8_t expected[] = {OP_ONE, OP_ADD_CONSTANT, OP_RETURN};
+    assert_opcodes(expected);
+    assert_int_equal(chunk.constants.count, 1);
+    assert_float_equal(run_compiled(), -2.0, 0);
+}
+
+static void test_simplify_removes_identities(void **state) {
+    (void) state;
+    compilerOptions.simplify = true;
+    compile_source("((2 + 3) * 1 - 0) / 1");
+    const uint8_t expected[] = {OP_SMALL_INT, OP_ADD_CONSTANT, OP_RETURN};
+    assert_opcodes(expected);
+    assert_int_equal(chunk.constants.count, 1);
+    assert_float_equal(run_compiled(), 5.0, 0);
+    assert_int_equal(simplifyStats.identities, 3);
+}
+
+static void test_simplify_keeps_adding_zero(void **state) {
+    (void) state;
+    compilerOptions.simplify = true;
+    compile_source("-0 + 0");
+    const uint8_t expected[] = {OP_CONSTANT, OP_ADD_CONSTANT, OP_RETURN};
+    assert_opcodes(expected);
+    Value value = run_compiled();
+    assert_true(value == 0 && !signbit(value));
+    assert_int_equal(simplifyStats.identities, 0);
+}
+
+static void test_simplify_multiplies_by_reciprocal(void **state) {
+    (void) state;
+    compilerOptions.simplify = true;
+    compile_source("(3 / 4) / 3");
+    const uint8_t expected[] = {
+        OP_SMALL_INT, OP_MULTIPLY_CONSTANT, OP_DIVIDE_CONSTANT, OP_RETURN,
+    };
+    assert_opcodes(expected);
+    assert_float_equal(chunk.constants.values[0], 0.25, 0);
+    assert_float_equal(run_compiled(), 0.25, 0);
+    assert_int_equal(simplifyStats.reciprocals, 1);
+}
+
+static void test_simplify_folds_negations(void **state) {
+    (void) state;
+    compilerOptions.simplify = true;
+    compile_source("- -(1 + 2) * -2");
+    const uint8_t expected[] = {
+        OP_ONE, OP_ADD_CONSTANT, OP_MULTIPLY_CONSTANT, OP_RETURN,
+    };
+    assert_opcodes(expected);
+    assert_float_equal(run_compiled(), -6.0, 0);
+    assert_int_equal(simplifyStats.negations, 2);
+}
+
+// The rewrites keep every result bit for bit, signed zeros and NaN
+// signs included.
+static void test_simplify_matches_plain(void **state) {
+    (void) state;
+    const char *sources[] = {
+        "-0 * 1 - 0",
+        "(-0 / 1) + -0",
+        "-(0 / 0) / 2 * 1",
+        "- -(0 / 0) - 0",
+        "(1 / 0) / 0.5 - -(1 / 0) / 8",
+        "1 / 3 / 1024 / 0.25",
+        "0.1 / 1024 / 1024 / 1024 / 0.0009765625",
+        "(1 / 3) * 1 / 0.5 - 0",
+        "-(2 * 1) / -0",
+    };
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        compilerOptions.simplify = false;
+        compile_source(sources[i]);
+        Value plain = run_compiled();
+        freeChunk(&chunk);
+
+        compilerOptions.simplify = true;
+        compile_source(sources[i]);
+        Value simplified = run_compiled();
+        freeChunk(&chunk);
+
+        assert_memory_equal(&plain, &simplified, sizeof(Value));
+    }
+}
+
+static void compile_batch(const char *source) {
+    beginBatch(source, strlen(source));
+    compileBatch(&chunk);
+}
+
+static void test_batch_shares_one_chunk(void **state) {
+    (void) state;
+    compile_batch("1.5 + 2.5; 2.5 * 3;\n3 - 1.5");
+    const uint8_t expected[] = {
+        OP_CONSTANT, OP_ADD_CONSTANT, OP_RESULT,
+        OP_CONSTANT, OP_MULTIPLY_CONSTANT, OP_RESULT,
+        OP_SMALL_INT, OP_SUBTRACT_CONSTANT, OP_RESULT,
+        OP_ZERO, OP_RETURN,
+    };
+    assert_opcodes(expected);
+    assert_true(atEndOfStatements());
+
+    // 1.5, 2.5 and 3, each once.
+    assert_int_equal(chunk.constants.count, 3);
+    assert_int_equal(chunk.code[7], chunk.code[3]);
+    assert_int_equal(chunk.code[15], chunk.code[1]);
+    assert_int_equal(chunk.code[5], INTERPRET_OK);
+}
+
+// Pool entries are matched by their bits, so -0 isn't 0.
+static void test_batch_keeps_zeros_apart(void **state) {
+    (void) state;
+    compilerOptions.simplify = true;
+    compile_batch("2.5 + 0; 2.5 * -0; 0.5 + 0;");
+    assert_int_equal(chunk.constants.count, 4);
+    assert_true(chunk.constants.values[1] == 0 &&
+                !signbit(chunk.constants.values[1]));
+    assert_true(chunk.constants.values[2] == 0 &&
+                signbit(chunk.constants.values[2]));
+}
+
+static void test_batch_marks_compile_errors(void **state) {
+    (void) state;
+    beginBatch("1 +; 2.5", 8);
+    assert_false(compileBatch(&chunk));
+    const uint8_t expected[] = {
+        OP_RESULT, OP_CONSTANT, OP_RESULT, OP_ZERO, OP_RETURN,
+    };
+    assert_opcodes(expected);
+    assert_int_equal(chunk.code[1], INTERPRET_COMPILE_ERROR);
+    assert_int_equal(chunk.code[5], INTERPRET_OK);
+    assert_int_equal(chunk.constants.count, 1);
+}
+
+// 300 statements with a new constant each fill one pool and start
+// another, without an error for the one that didn't fit.
+static void test_batch_starts_over_when_constants_run_out(void **state) {
+    (void) state;
+    char source[300 * 8];
+    int length = 0;
+    for (int i = 0; i < 300; i++) {
+        length += sprintf(source + length, "%d.5;", i);
+    }
+    beginBatch(source, (size_t)length);
+    assert_true(compileBatch(&chunk));
+    assert_int_equal(chunk.constants.count, UINT8_MAX + 1);
+    assert_false(atEndOfStatements());
+
+    truncateChunk(&chunk, 0, 0);
+    assert_true(compileBatch(&chunk));
+    assert_int_equal(chunk.constants.count, 300 - (UINT8_MAX + 1));
+    assert_true(chunk.constants.values[0] == 256.5);
+    assert_true(atEndOfStatements());
+}
+
+// A statement that has already failed is kept as its error rather
+// than started over when its constants overflow the pool, which would
+// report the error a second time.
+static void test_batch_keeps_failed_statement_that_overflows(void **state) {
+    (void) state;
+    char source[300 * 8];
+    int length = sprintf(source, "1; 0.5 + $ 0.25");
+    for (int i = 0; i < 300; i++) {
+        length += sprintf(source + length, " + %d.5", i);
+    }
+    beginBatch(source, (size_t)length);
+    assert_false(compileBatch(&chunk));
+    assert_true(atEndOfStatements());
+    assert_int_equal(chunk.code[chunk.count - 3], INTERPRET_COMPILE_ERROR);
+    assert_int_equal(chunk.constants.count, 0);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_literal_right_operand_folds,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_each_operator_folds,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(
+            test_compound_right_operand_does_not_fold,
+            setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_left_literal_does_not_fold,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_small_integers_skip_the_pool,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(
+            test_negative_zero_stays_in_the_pool,
+            setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_precedence_kept,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(
+            test_cse_reuses_repeated_subexpression,
+            setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_cse_skips_cheap_repeats,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_cse_shares_constants,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_cse_matches_tree,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_strict_mode_does_not_fuse,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_fast_math_fuses_multiply_add,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(
+            test_fast_math_fuses_computed_product,
+            setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(
+            test_fast_math_reassociates_constants,
+            setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_simplify_removes_identities,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_simplify_keeps_adding_zero,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(
+            test_simplify_multiplies_by_reciprocal,
+            setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_simplify_folds_negations,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_simplify_matches_plain,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_batch_shares_one_chunk,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_batch_keeps_zeros_apart,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_batch_marks_compile_errors,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(
+            test_batch_starts_over_when_constants_run_out,
+            setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(
+            test_batch_keeps_failed_statement_that_overflows,
+            setup_chunk, teardown_chunk),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
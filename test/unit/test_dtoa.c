@@ -0,0 +1,147 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmocka.h>
+#include <string.h>
+#include "dtoa.h"
+
+static uint64_t seed = 88172645463325252ull;
+
+static uint64_t nextRandom(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+static void assert_formats(double value, const char *expected) {
+    char buffer[DTOA_BUFFER_SIZE];
+    int length = formatDouble(value, buffer);
+    assert_string_equal(buffer, expected);
+    assert_int_equal(length, (int)strlen(expected));
+}
+
+// The significant digits of text, without leading or trailing zeros.
+static int significantDigits(const char *text, char *digits) {
+    int count = 0;
+    for (const char *c = text; *c != '\0' && *c != 'e'; c++) {
+        if (*c < '0' || *c > '9') continue;
+        if (count == 0 && *c == '0') continue;
+        digits[count++] = *c;
+    }
+    while (count > 0 && digits[count - 1] == '0') count--;
+    digits[count] = '\0';
+    return count;
+}
+
+// The output must read back exactly and have no more digits than the
+// shortest "%.*e" that does.
+static void assert_shortest(double value) {
+    char buffer[DTOA_BUFFER_SIZE];
+    formatDouble(value, buffer);
+    double back = strtod(buffer, NULL);
+    if (memcmp(&back, &value, sizeof(double)) != 0) {
+        fail_msg("%.17g printed as %s", value, buffer);
+    }
+
+    char reference[40];
+    for (int precision = 0; precision < 17; precision++) {
+        snprintf(reference, sizeof(reference), "%.*e", precision, value);
+        if (strtod(reference, NULL) == value) break;
+    }
+
+    char ours[40], theirs[40];
+    if (significantDigits(buffer, ours) >
+        significantDigits(reference, theirs)) {
+        fail_msg("%.17g printed as %s, %s is shorter", value, buffer,
+                 reference);
+    }
+}
+
+static void test_integers(void **state) {
+    (void) state;
+    assert_formats(0.0, "0");
+    assert_formats(-0.0, "-0");
+    assert_formats(3.0, "3");
+    assert_formats(-20.0, "-20");
+    assert_formats(9007199254740992.0, "9007199254740992");
+    assert_formats(1e20, "100000000000000000000");
+    assert_formats(1e21, "1e+21");
+}
+
+static void test_fractions(void **state) {
+    (void) state;
+    assert_formats(-1.5, "-1.5");
+    assert_formats(0.1, "0.1");
+    assert_formats(0.1 + 0.2, "0.30000000000000004");
+    assert_formats(1.0 / 3, "0.3333333333333333");
+    assert_formats(0.000001, "0.000001");
+    assert_formats(1e-7, "1e-7");
+    assert_formats(1.5e300, "1.5e+300");
+}
+
+static void test_extremes(void **state) {
+    (void) state;
+    assert_formats(5e-324, "5e-324");
+    assert_formats(1e-323, "1e-323");
+    assert_formats(2.2250738585072014e-308, "2.2250738585072014e-308");
+    assert_formats(1.7976931348623157e308, "1.7976931348623157e+308");
+    assert_formats(1e23, "1e+23");
+    assert_formats(1.0 / 0.0, "inf");
+    assert_formats(-1.0 / 0.0, "-inf");
+}
+
+static void test_random_bit_patterns(void **state) {
+    (void) state;
+    for (int i = 0; i < 200000; i++) {
+        uint64_t bits = nextRandom();
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (value != value || value - value != 0) continue;
+        assert_shortest(value);
+    }
+}
+
+static void test_short_decimals(void **state) {
+    (void) state;
+    for (int i = 0; i < 100000; i++) {
+        assert_shortest((double)(nextRandom() % 1000000) /
+                        (double)(1 + nextRandom() % 1000));
+    }
+}
+
+static void test_powers_of_two(void **state) {
+    (void) state;
+    // The interval below a power of two is half the one above.
+    for (uint64_t biased = 1; biased < 0x7FF; biased++) {
+        uint64_t bits = biased << 52;
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        assert_shortest(value);
+    }
+}
+
+static void test_subnormals(void **state) {
+    (void) state;
+    for (uint64_t bits = 1; bits < 20000; bits++) {
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        assert_shortest(value);
+    }
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_integers),
+        cmocka_unit_test(test_fractions),
+        cmocka_unit_test(test_extremes),
+        cmocka_unit_test(test_random_bit_patterns),
+        cmocka_unit_test(test_short_decimals),
+        cmocka_unit_test(test_powers_of_two),
+        cmocka_unit_test(test_subnormals),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,194 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmocka.h>
+#include <string.h>
+#include "compiler.h"
+#include "memo.h"
+
+static char directory[] = "/tmp/clox-memo-XXXXXX";
+
+static int setup_memo(void **state) {
+    (void) state;
+    initVM();
+    clearResults();
+    memset(&memoStats, 0, sizeof(memoStats));
+    memoizeResults = true;
+    resultCacheDir = NULL;
+    return 0;
+}
+
+static int teardown_memo(void **state) {
+    (void) state;
+    freeVM();
+    memoizeResults = false;
+    resultCacheDir = NULL;
+    compilerOptions.fastMath = false;
+    return 0;
+}
+
+static int setup_directory(void **state) {
+    (void) state;
+    return mkdtemp(directory) == NULL ? -1 : 0;
+}
+
+static int teardown_directory(void **state) {
+    (void) state;
+    char command[64];
+    snprintf(command, sizeof(command), "rm -rf %s", directory);
+    return system(command);
+}
+
+// Interprets source with its result written raw, and returns it.
+static double interpreted(const char *source) {
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    vm.outputFormat = OUTPUT_RAW;
+    vm.outputFile = file;
+    assert_int_equal(interpret(source), INTERPRET_OK);
+    rewind(file);
+    double value;
+    assert_int_equal(fread(&value, sizeof(value), 1, file), 1);
+    vm.outputFile = stdout;
+    vm.outputFormat = OUTPUT_TEXT;
+    fclose(file);
+    return value;
+}
+
+static void assert_digest(const char *message, const char *expected) {
+    uint8_t digest[32];
+    sha256(message, strlen(message), digest);
+    char hex[65];
+    for (int i = 0; i < 32; i++) {
+        snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    }
+    assert_string_equal(hex, expected);
+}
+
+static void test_sha256_vectors(void **state) {
+    (void) state;
+    assert_digest("", "e3b0c44298fc1c149afbf4c8996fb924"
+                      "27ae41e4649b934ca495991b7852b855");
+    assert_digest("abc", "ba7816bf8f01cfea414140de5dae2223"
+                         "b00361a396177a9cb410ff61f20015ad");
+    // 56 bytes: the length spills into a second padding block.
+    assert_digest("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+                  "248d6a61d20638b8e5c026930c3e6039"
+                  "a33ce45964ff2167f6ecedd419db06c1");
+}
+
+static void test_second_run_is_a_hit(void **state) {
+    (void) state;
+    double first = interpreted("(1.5 + 2) * 3 - 0 / 0");
+    double second = interpreted("(1.5 + 2) * 3 - 0 / 0");
+    assert_memory_equal(&first, &second, sizeof(double));
+    assert_int_equal(memoStats.misses, 1);
+    assert_int_equal(memoStats.stored, 1);
+    assert_int_equal(memoStats.hits, 1);
+
+    // Fast math may round differently, so it has results of its own.
+    compilerOptions.fastMath = true;
+    interpreted("(1.5 + 2) * 3 - 0 / 0");
+    assert_int_equal(memoStats.misses, 2);
+}
+
+static void test_compile_errors_are_not_cached(void **state) {
+    (void) state;
+    vm.outputFile = tmpfile();
+    assert_int_equal(interpret("1 +"), INTERPRET_COMPILE_ERROR);
+    assert_int_equal(interpret("1 +"), INTERPRET_COMPILE_ERROR);
+    fclose(vm.outputFile);
+    vm.outputFile = stdout;
+    assert_int_equal(memoStats.misses, 2);
+    assert_int_equal(memoStats.stored, 0);
+}
+
+static void test_disk_outlives_memory(void **state) {
+    (void) state;
+    resultCacheDir = directory;
+    assert_float_equal(interpreted("6 * 7"), 42.0, 0);
+    clearResults();
+    assert_float_equal(interpreted("6 * 7"), 42.0, 0);
+    assert_int_equal(memoStats.diskHits, 1);
+
+    // Memory again, the disk hit having been brought in.
+    assert_float_equal(interpreted("6 * 7"), 42.0, 0);
+    assert_int_equal(memoStats.hits, 2);
+    assert_int_equal(memoStats.diskHits, 1);
+}
+
+static void test_least_recently_used_is_evicted(void **state) {
+    (void) state;
+    Chunk chunk;
+    initChunk(&chunk);
+    writeChunk(&chunk, OP_ONE, 1);
+    writeChunk(&chunk, OP_RETURN, 1);
+
+    // Keys that all land in one set.
+    ResultKey keys[MEMO_WAYS + 1];
+    memset(keys, 0, sizeof(keys));
+    for (int i = 0; i <= MEMO_WAYS; i++) {
+        keys[i].digest[0] = 7;
+        keys[i].digest[1] = (uint8_t)i;
+    }
+    for (int i = 0; i < MEMO_WAYS; i++) storeResult(&keys[i], &chunk, i);
+
+    Value value;
+    assert_true(findResult(&keys[0], &value));
+    storeResult(&keys[MEMO_WAYS], &chunk, MEMO_WAYS);
+    assert_true(findResult(&keys[0], &value));
+    assert_float_equal(value, 0, 0);
+    assert_false(findResult(&keys[1], &value));
+    for (int i = 2; i <= MEMO_WAYS; i++) {
+        assert_true(findResult(&keys[i], &value));
+        assert_float_equal(value, i, 0);
+    }
+    freeChunk(&chunk);
+}
+
+// Anything not known to be pure stays out: OP_RESULT writes output, and
+// an opcode from the future might do anything.
+static void test_impure_chunks_are_not_stored(void **state) {
+    (void) state;
+    ResultKey key;
+    resultKey("1", 1, &key);
+    uint8_t impure[] = {OP_RESULT, OP_RETURN + 1};
+    for (size_t i = 0; i < sizeof(impure); i++) {
+        Chunk chunk;
+        initChunk(&chunk);
+        writeChunk(&chunk, OP_ONE, 1);
+        writeChunk(&chunk, impure[i], 1);
+        writeChunk(&chunk, 0, 1);
+        assert_false(chunkIsPure(&chunk));
+        storeResult(&key, &chunk, 1);
+        freeChunk(&chunk);
+    }
+    Value value;
+    assert_false(findResult(&key, &value));
+    assert_int_equal(memoStats.impure, 2);
+    assert_int_equal(memoStats.stored, 0);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_sha256_vectors),
+        cmocka_unit_test_setup_teardown(test_second_run_is_a_hit,
+                                        setup_memo, teardown_memo),
+        cmocka_unit_test_setup_teardown(test_compile_errors_are_not_cached,
+                                        setup_memo, teardown_memo),
+        cmocka_unit_test_setup_teardown(test_disk_outlives_memory,
+                                        setup_memo, teardown_memo),
+        cmocka_unit_test_setup_teardown(
+            test_least_recently_used_is_evicted,
+            setup_memo, teardown_memo),
+        cmocka_unit_test_setup_teardown(test_impure_chunks_are_not_stored,
+                                        setup_memo, teardown_memo),
+    };
+    return cmocka_run_group_tests(tests, setup_directory,
+                                  teardown_directory);
+}
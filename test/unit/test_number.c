@@ -0,0 +1,135 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmocka.h>
+#include <string.h>
+#include "number.h"
+
+static uint64_t seed = 88172645463325252ull;
+
+static uint64_t nextRandom(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+static void assert_parses_like_strtod(const char *text) {
+    double expected = strtod(text, NULL);
+    double actual = parseNumber(text, (int)strlen(text));
+    if (memcmp(&expected, &actual, sizeof(double)) != 0) {
+        fail_msg("%s: got %.17g, strtod gives %.17g", text, actual,
+                 expected);
+    }
+}
+
+// Trims "%f" output to the shape of a Lox literal.
+static void trimZeros(char *text) {
+    int length = (int)strlen(text);
+    while (length > 2 && text[length - 1] == '0' &&
+           text[length - 2] != '.') {
+        text[--length] = '\0';
+    }
+}
+
+static void test_simple_literals(void **state) {
+    (void) state;
+    assert_float_equal(parseNumber("0", 1), 0.0, 0);
+    assert_float_equal(parseNumber("123", 3), 123.0, 0);
+    assert_float_equal(parseNumber("45.67", 5), 45.67, 0);
+    assert_float_equal(parseNumber("0.5", 3), 0.5, 0);
+}
+
+static void test_only_reads_token(void **state) {
+    (void) state;
+    assert_float_equal(parseNumber("12345", 2), 12.0, 0);
+    assert_float_equal(parseNumber("1.25", 3), 1.2, 0);
+}
+
+static void test_hard_cases(void **state) {
+    (void) state;
+    assert_parses_like_strtod("9007199254740993");
+    assert_parses_like_strtod("9007199254740992.5");
+    assert_parses_like_strtod("2.2250738585072011");
+    assert_parses_like_strtod("0.1");
+    assert_parses_like_strtod("123456789012345678901234567890");
+    assert_parses_like_strtod("0.000000000000000000000000000000000000000"
+                              "00000000000000000000000000000000000000000"
+                              "00000000000000000000000000000000000000000"
+                              "00000000000000000000000000000000000000000"
+                              "00000000000000000000000000000000000000000"
+                              "00000000000000000000000000000000000000000"
+                              "00000000000000000000000000000000000000000"
+                              "000000000000000000000000000049406564584124"
+                              "654");
+}
+
+static void test_random_digit_strings(void **state) {
+    (void) state;
+    char text[64];
+    for (int i = 0; i < 200000; i++) {
+        int integerDigits = 1 + (int)(nextRandom() % 25);
+        int fractionDigits = (int)(nextRandom() % 25);
+        int length = 0;
+        for (int j = 0; j < integerDigits; j++) {
+            text[length++] = (char)('0' + nextRandom() % 10);
+        }
+        if (fractionDigits > 0) {
+            text[length++] = '.';
+            for (int j = 0; j < fractionDigits; j++) {
+                text[length++] = (char)('0' + nextRandom() % 10);
+            }
+        }
+        text[length] = '\0';
+        assert_parses_like_strtod(text);
+    }
+}
+
+static void test_random_doubles_written_out(void **state) {
+    (void) state;
+    char text[400];
+    for (int i = 0; i < 100000; i++) {
+        uint64_t bits = nextRandom() & 0x7FFFFFFFFFFFFFFFull;
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (!(value > 1e-300 && value < 1e300)) continue;
+
+        snprintf(text, sizeof(text), "%.*f",
+                 nextRandom() % 2 ? 340 : 20, value);
+        trimZeros(text);
+        assert_parses_like_strtod(text);
+    }
+}
+
+static void test_halfway_points(void **state) {
+    (void) state;
+    char text[200];
+    for (int i = 0; i < 100000; i++) {
+        uint64_t bits = nextRandom() % 0x7FE0000000000000ull;
+        uint64_t nextBits = bits + 1;
+        double value, next;
+        memcpy(&value, &bits, sizeof(value));
+        memcpy(&next, &nextBits, sizeof(next));
+        if (!(value > 1e-30 && value < 1e30)) continue;
+
+        long double midpoint = ((long double)value + next) / 2;
+        snprintf(text, sizeof(text), "%.60Lf", midpoint);
+        trimZeros(text);
+        assert_parses_like_strtod(text);
+    }
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_simple_literals),
+        cmocka_unit_test(test_only_reads_token),
+        cmocka_unit_test(test_hard_cases),
+        cmocka_unit_test(test_random_digit_strings),
+        cmocka_unit_test(test_random_doubles_written_out),
+        cmocka_unit_test(test_halfway_points),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,130 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmocka.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include "perf.h"
+
+// Containers often refuse every counter. These tests only rely on
+// what the report must say either way.
+static bool opened;
+
+static int setup_counters(void **state) {
+    (void) state;
+    opened = openPerfCounters();
+    return 0;
+}
+
+static int teardown_counters(void **state) {
+    (void) state;
+    closePerfCounters();
+    return 0;
+}
+
+static void report(void (*write)(FILE *), char *buffer, size_t size) {
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    write(file);
+    rewind(file);
+    size_t length = fread(buffer, 1, size - 1, file);
+    buffer[length] = '\0';
+    fclose(file);
+}
+
+static void test_phases_are_counted_when_open(void **state) {
+    (void) state;
+    volatile uint64_t sum = 0;
+    for (int i = 0; i < 2; i++) {
+        perfBegin(PERF_RUN);
+        for (int j = 0; j < 100000; j++) sum += (uint64_t)j;
+        perfEnd(PERF_RUN);
+    }
+
+    char buffer[2048];
+    report(writePerfJson, buffer, sizeof(buffer));
+    assert_non_null(strstr(buffer, opened ? "\"run\":{\"calls\":2,"
+                                          : "\"run\":{\"calls\":0,"));
+    assert_non_null(strstr(buffer, "\"scan\":{\"calls\":0,"));
+}
+
+// Burns CPU time on a thread that counts itself, as a lexing worker
+// does.
+static void *busy_worker(void *arg) {
+    (void) arg;
+    perfWorkerBegin();
+    clock_t start = clock();
+    volatile uint64_t counter = 0;
+    while ((double)(clock() - start) / CLOCKS_PER_SEC < 0.05) counter++;
+    perfWorkerEnd();
+    return NULL;
+}
+
+// The worker's task clock lands in both phases open on the thread that
+// started it, though that thread itself only waits.
+static void test_workers_count_towards_open_phases(void **state) {
+    (void) state;
+    perfBegin(PERF_COMPILE);
+    perfBegin(PERF_SCAN);
+    pthread_t thread;
+    assert_int_equal(pthread_create(&thread, NULL, busy_worker, NULL), 0);
+    pthread_join(thread, NULL);
+    perfEnd(PERF_SCAN);
+    perfEnd(PERF_COMPILE);
+
+    char buffer[2048];
+    report(writePerfJson, buffer, sizeof(buffer));
+    const char *phases[] = {"\"scan\":{", "\"compile\":{"};
+    for (int i = 0; i < 2; i++) {
+        const char *clock = strstr(strstr(buffer, phases[i]),
+                                   "\"task-clock\":");
+        assert_non_null(clock);
+        clock += strlen("\"task-clock\":");
+        if (strncmp(clock, "null", 4) == 0) continue;
+        assert_true(strtoull(clock, NULL, 10) >= 40000000);
+    }
+}
+
+static void test_text_report_has_a_row_per_phase(void **state) {
+    (void) state;
+    char buffer[2048];
+    report(writePerfText, buffer, sizeof(buffer));
+    assert_int_equal(strncmp(buffer, "phase ", 6), 0);
+    assert_non_null(strstr(buffer, "\nscan "));
+    assert_non_null(strstr(buffer, "\ncompile "));
+    assert_non_null(strstr(buffer, "\nrun "));
+    assert_non_null(strstr(buffer, "IPC"));
+}
+
+static void test_closed_counters_report_null(void **state) {
+    (void) state;
+    closePerfCounters();
+    perfBegin(PERF_COMPILE);
+    perfEnd(PERF_COMPILE);
+
+    char buffer[2048];
+    report(writePerfJson, buffer, sizeof(buffer));
+    assert_non_null(strstr(buffer, "\"compile\":{\"calls\":0,"
+                                   "\"cycles\":null,"));
+    assert_non_null(strstr(buffer, "\"ipc\":null}"));
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_phases_are_counted_when_open,
+                                        setup_counters, teardown_counters),
+        cmocka_unit_test_setup_teardown(
+            test_text_report_has_a_row_per_phase,
+            setup_counters, teardown_counters),
+        cmocka_unit_test_setup_teardown(test_closed_counters_report_null,
+                                        setup_counters, teardown_counters),
+        cmocka_unit_test_setup_teardown(
+            test_workers_count_towards_open_phases,
+            setup_counters, teardown_counters),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,138 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <cmocka.h>
+#include <string.h>
+#include <time.h>
+#include "compiler.h"
+#include "profiler.h"
+#include "vm.h"
+
+static Chunk chunk;
+
+static int setup_chunk(void **state) {
+    (void) state;
+    initVM();
+    initChunk(&chunk);
+    const char *source = "1.5 +\n2.5 *\n3.5";
+    assert_true(compile(source, strlen(source), &chunk));
+    return 0;
+}
+
+static int teardown_chunk(void **state) {
+    (void) state;
+    profileSite.ip = NULL;
+    profileSite.pc = NULL;
+    freeChunk(&chunk);
+    freeVM();
+    return 0;
+}
+
+// Burns CPU time, which is what ITIMER_PROF counts.
+static void spin(double seconds) {
+    clock_t start = clock();
+    volatile uint64_t counter = 0;
+    while ((double)(clock() - start) / CLOCKS_PER_SEC < seconds) {
+        counter++;
+    }
+}
+
+static char *profile_output(char *buffer, size_t size) {
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    writeProfile(file);
+    rewind(file);
+    size_t length = fread(buffer, 1, size - 1, file);
+    buffer[length] = '\0';
+    fclose(file);
+    return buffer;
+}
+
+static void test_samples_map_to_line_and_opcode(void **state) {
+    (void) state;
+    // Find the OP_MULTIPLY_CONSTANT for "2.5 *\n3.5", which is on line 3.
+    int offset = 0;
+    while (chunk.code[offset] != OP_MULTIPLY_CONSTANT) offset += 2;
+    profileSite.chunk = &chunk;
+    profileSite.ip = chunk.code + offset;
+
+    assert_true(startProfiler(PROFILE_HZ));
+    spin(0.2);
+    stopProfiler();
+
+    char buffer[1024];
+    profile_output(buffer, sizeof(buffer));
+    const char *prefix = "clox;line 3;OP_MULTIPLY_CONSTANT ";
+    assert_int_equal(strncmp(buffer, prefix, strlen(prefix)), 0);
+    assert_null(strstr(buffer, "line 1;"));
+}
+
+// A predecoded run only publishes its instruction; the handler finds
+// the bytecode it came from.
+static void test_samples_map_decoded_instructions(void **state) {
+    (void) state;
+    DecodedChunk decoded;
+    initDecodedChunk(&decoded);
+    decodeChunk(&decoded, &chunk, 0);
+    int index = 0;
+    while (chunk.code[decoded.offsets[index]] != OP_MULTIPLY_CONSTANT) {
+        index++;
+    }
+    profileSite.ip = NULL;
+    profileSite.decoded = &decoded;
+    profileSite.pc = &decoded.code[index];
+
+    assert_true(startProfiler(PROFILE_HZ));
+    spin(0.2);
+    stopProfiler();
+    profileSite.pc = NULL;
+
+    char buffer[1024];
+    profile_output(buffer, sizeof(buffer));
+    const char *prefix = "clox;line 3;OP_MULTIPLY_CONSTANT ";
+    assert_int_equal(strncmp(buffer, prefix, strlen(prefix)), 0);
+
+    Value value;
+    assert_int_equal(runDecoded(&decoded, &value), INTERPRET_OK);
+    assert_null(profileSite.pc);
+    freeDecodedChunk(&decoded);
+}
+
+static void test_samples_outside_bytecode(void **state) {
+    (void) state;
+    profileSite.ip = NULL;
+
+    assert_true(startProfiler(PROFILE_HZ));
+    spin(0.2);
+    stopProfiler();
+
+    char buffer[1024];
+    profile_output(buffer, sizeof(buffer));
+    assert_int_equal(strncmp(buffer, "clox;[not in bytecode] ", 23), 0);
+    assert_null(strstr(buffer, "clox;line"));
+}
+
+static void test_run_publishes_and_clears_site(void **state) {
+    (void) state;
+    Value value;
+    assert_int_equal(runChunk(&chunk, &value), INTERPRET_OK);
+    assert_ptr_equal(profileSite.chunk, &chunk);
+    assert_null(profileSite.ip);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_samples_map_to_line_and_opcode,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(
+            test_samples_map_decoded_instructions,
+            setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_samples_outside_bytecode,
+                                        setup_chunk, teardown_chunk),
+        cmocka_unit_test_setup_teardown(test_run_publishes_and_clears_site,
+                                        setup_chunk, teardown_chunk),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
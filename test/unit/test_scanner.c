@@ -1,7 +1,10 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdarg.h>
 #include <stddef.h>
 #include <setjmp.h>
 #include <cmocka.h>
+#include <stdio.h>
 #include <string.h>
 #include "scanner.h"
 
@@ -123,6 +126,17 @@ static void test_scan_identifier_vs_keyword(void **state) {
     assert_int_equal(scanToken().type, TOKEN_IDENTIFIER);
 }
 
+static void test_scan_keyword_near_misses(void **state) {
+    (void) state;
+    initScanner("an andd classy f fo t th tru truee whilex w "
+                "Print nul supr thiss vars r o");
+
+    for (int i = 0; i < 18; i++) {
+        assert_int_equal(scanToken().type, TOKEN_IDENTIFIER);
+    }
+    assert_int_equal(scanToken().type, TOKEN_EOF);
+}
+
 static void test_scan_whitespace_handling(void **state) {
     (void) state;
     initScanner("  \t\r\n  123  \n\n  456  ");
@@ -178,6 +192,124 @@ static void test_scan_unterminated_string(void **state) {
     assert_int_equal(token.type, TOKEN_ERROR);
 }
 
+static void test_scan_range_without_terminator(void **state) {
+    (void) state;
+    const char source[] = {'1', '2', '+', '3', '4'};
+    initScannerRange(source, 4);
+
+    Token token1 = scanToken();
+    assert_int_equal(token1.type, TOKEN_NUMBER);
+    assert_int_equal(token1.length, 2);
+    assert_int_equal(scanToken().type, TOKEN_PLUS);
+
+    Token token2 = scanToken();
+    assert_int_equal(token2.type, TOKEN_NUMBER);
+    assert_int_equal(token2.length, 1);
+    assert_int_equal(scanToken().type, TOKEN_EOF);
+}
+
+static void test_scan_range_stops_before_fraction(void **state) {
+    (void) state;
+    initScannerRange("1.5", 2);
+
+    Token token = scanToken();
+    assert_int_equal(token.type, TOKEN_NUMBER);
+    assert_int_equal(token.length, 1);
+    assert_int_equal(scanToken().type, TOKEN_DOT);
+    assert_int_equal(scanToken().type, TOKEN_EOF);
+}
+
+static void test_scan_stream_across_windows(void **state) {
+    (void) state;
+    FILE *file = tmpfile();
+    assert_non_null(file);
+
+    // 200,000 bytes of "12345678 " with a comment every 1000 numbers,
+    // so numbers and comments straddle the 64K window boundaries.
+    for (int i = 0; i < 20000; i++) {
+        fputs("12345678 ", file);
+        if (i % 1000 == 999) fputs("// comment\n", file);
+    }
+    fflush(file);
+    rewind(file);
+
+    initScannerStream(fileno(file));
+    for (int i = 0; i < 20000; i++) {
+        Token token = scanToken();
+        assert_int_equal(token.type, TOKEN_NUMBER);
+        assert_int_equal(token.length, 8);
+        assert_true(strncmp(token.start, "12345678", 8) == 0);
+        assert_int_equal(token.line, i / 1000 + 1);
+    }
+    assert_int_equal(scanToken().type, TOKEN_EOF);
+
+    freeScanner();
+    fclose(file);
+}
+
+static void test_scan_stream_keeps_previous_token(void **state) {
+    (void) state;
+    FILE *file = tmpfile();
+    assert_non_null(file);
+
+    for (int i = 0; i < 30000; i++) fputs("ab ", file);
+    fflush(file);
+    rewind(file);
+
+    initScannerStream(fileno(file));
+    Token previous = scanToken();
+    for (int i = 1; i < 30000; i++) {
+        Token current = scanToken();
+        assert_true(strncmp(previous.start, "ab", 2) == 0);
+        assert_true(strncmp(current.start, "ab", 2) == 0);
+        previous = current;
+    }
+    assert_int_equal(scanToken().type, TOKEN_EOF);
+
+    freeScanner();
+    fclose(file);
+}
+
+static void fputDigits(FILE *file, int count) {
+    for (int i = 0; i < count; i++) fputc('1' + i % 9, file);
+    fputc(' ', file);
+}
+
+static void test_scan_stream_big_token_after_flip(void **state) {
+    (void) state;
+    FILE *file = tmpfile();
+    assert_non_null(file);
+
+    // The first long number grows one window; the short ones flip
+    // between them, and the second, longer than either, has to be
+    // carried over into whichever window is smaller.
+    fputDigits(file, 200000);
+    for (int i = 0; i < 70000; i++) fputs("1 ", file);
+    fputDigits(file, 400000);
+    fflush(file);
+    rewind(file);
+
+    initScannerStream(fileno(file));
+    Token token = scanToken();
+    assert_int_equal(token.type, TOKEN_NUMBER);
+    assert_int_equal(token.length, 200000);
+    for (int i = 0; i < 70000; i++) {
+        assert_int_equal(scanToken().length, 1);
+    }
+    token = scanToken();
+    assert_int_equal(token.type, TOKEN_NUMBER);
+    assert_int_equal(token.length, 400000);
+    bool intact = true;
+    for (int i = 0; i < 400000; i++) {
+        if (token.start[i] != '1' + i % 9) intact = false;
+    }
+    assert_true(intact);
+    assert_int_equal(scanToken().type, TOKEN_EOF);
+
+    freeScanner();
+    fclose(file);
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_scan_single_char_tokens),
@@ -189,11 +321,17 @@ int main(void) {
         cmocka_unit_test(test_scan_identifier),
         cmocka_unit_test(test_scan_keywords),
         cmocka_unit_test(test_scan_identifier_vs_keyword),
+        cmocka_unit_test(test_scan_keyword_near_misses),
         cmocka_unit_test(test_scan_whitespace_handling),
         cmocka_unit_test(test_scan_comment),
         cmocka_unit_test(test_scan_line_tracking),
         cmocka_unit_test(test_scan_unexpected_character),
         cmocka_unit_test(test_scan_unterminated_string),
+        cmocka_unit_test(test_scan_range_without_terminator),
+        cmocka_unit_test(test_scan_range_stops_before_fraction),
+        cmocka_unit_test(test_scan_stream_across_windows),
+        cmocka_unit_test(test_scan_stream_keeps_previous_token),
+        cmocka_unit_test(test_scan_stream_big_token_after_flip),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
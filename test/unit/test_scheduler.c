@@ -0,0 +1,196 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <cmocka.h>
+#include <string.h>
+#include "compiler.h"
+#include "scheduler.h"
+
+#define TASKS 40
+
+static int finishOrder[TASKS];
+static int finishedCount = 0;
+
+static void compile_source(const char *source, Chunk *chunk) {
+    initChunk(chunk);
+    assert_true(compile(source, strlen(source), chunk));
+}
+
+// "1 + 1 + ..." with terms ones.
+static void compile_sum(int terms, Chunk *chunk) {
+    static char source[4096];
+    int length = 0;
+    for (int i = 0; i < terms; i++) {
+        length += sprintf(source + length, i == 0 ? "1" : " + 1");
+    }
+    compile_source(source, chunk);
+}
+
+static void record_finish(Task *task) {
+    // Only ever called from one thread in the test that uses it.
+    finishOrder[finishedCount++] = (int)(intptr_t)task->data;
+}
+
+static void test_yields_and_resumes(void **state) {
+    (void) state;
+    Chunk chunk;
+    compile_source("(1 + 2) * 3 - -4", &chunk);
+
+    VMState saved;
+    Value value = 0;
+    vm.fuel = 2;
+    InterpretResult result = runChunk(&chunk, &value);
+    int yields = 0;
+    while (result == INTERPRET_YIELD) {
+        yields++;
+        saveVM(&saved);
+        // Clobber the VM as another task would.
+        initVM();
+        push(99);
+        restoreVM(&saved);
+        vm.fuel = 2;
+        result = resumeVM(&value);
+    }
+
+    assert_int_equal(result, INTERPRET_OK);
+    assert_float_equal(value, 13.0, 0);
+    assert_true(yields >= 3);
+    vm.fuel = FUEL_UNLIMITED;
+    freeChunk(&chunk);
+}
+
+static void test_runs_tasks_on_threads(void **state) {
+    (void) state;
+    Chunk chunks[TASKS];
+    Task tasks[TASKS];
+    for (int i = 0; i < TASKS; i++) {
+        compile_sum(1 + i * 5, &chunks[i]);
+        initTask(&tasks[i], &chunks[i]);
+    }
+
+    runTasks(tasks, TASKS, 4, 7);
+
+    for (int i = 0; i < TASKS; i++) {
+        assert_int_equal(tasks[i].status, INTERPRET_OK);
+        assert_float_equal(tasks[i].result, 1 + i * 5, 0);
+        freeChunk(&chunks[i]);
+    }
+    assert_true(tasks[TASKS - 1].slices > 1);
+}
+
+static void test_small_tasks_overtake_big_one(void **state) {
+    (void) state;
+    Chunk chunks[TASKS];
+    Task tasks[TASKS];
+    compile_sum(200, &chunks[0]);
+    for (int i = 1; i < TASKS; i++) compile_sum(2, &chunks[i]);
+    for (int i = 0; i < TASKS; i++) {
+        initTask(&tasks[i], &chunks[i]);
+        tasks[i].finished = record_finish;
+        tasks[i].data = (void *)(intptr_t)i;
+    }
+
+    finishedCount = 0;
+    runTasks(tasks, TASKS, 1, 16);
+
+    assert_int_equal(finishedCount, TASKS);
+    assert_int_equal(finishOrder[TASKS - 1], 0);
+    assert_float_equal(tasks[0].result, 200, 0);
+    for (int i = 0; i < TASKS; i++) freeChunk(&chunks[i]);
+}
+
+static void test_unlimited_slice_runs_in_order(void **state) {
+    (void) state;
+    Chunk chunks[TASKS];
+    Task tasks[TASKS];
+    compile_sum(200, &chunks[0]);
+    for (int i = 1; i < TASKS; i++) compile_sum(2, &chunks[i]);
+    for (int i = 0; i < TASKS; i++) {
+        initTask(&tasks[i], &chunks[i]);
+        tasks[i].finished = record_finish;
+        tasks[i].data = (void *)(intptr_t)i;
+    }
+
+    finishedCount = 0;
+    runTasks(tasks, TASKS, 1, 0);
+
+    assert_int_equal(finishOrder[0], 0);
+    assert_int_equal(tasks[0].slices, 1);
+    for (int i = 0; i < TASKS; i++) freeChunk(&chunks[i]);
+}
+
+// The caller's thread runs tasks too, but its own runs afterwards
+// aren't cut short by what was left of the last slice.
+static void test_caller_keeps_its_fuel(void **state) {
+    (void) state;
+    Chunk chunks[TASKS];
+    Task tasks[TASKS];
+    for (int i = 0; i < TASKS; i++) {
+        compile_sum(3 + i, &chunks[i]);
+        initTask(&tasks[i], &chunks[i]);
+    }
+    runTasks(tasks, TASKS, 1, 2);
+    assert_true(vm.fuel == FUEL_UNLIMITED);
+
+    Chunk chunk;
+    compile_sum(50, &chunk);
+    Value value = 0;
+    assert_int_equal(runChunk(&chunk, &value), INTERPRET_OK);
+    assert_float_equal(value, 50, 0);
+    freeChunk(&chunk);
+    for (int i = 0; i < TASKS; i++) freeChunk(&chunks[i]);
+}
+
+// Results written by tasks on the worker threads reach the caller's
+// output, whichever thread ran them.
+static void test_workers_write_results(void **state) {
+    (void) state;
+    Chunk chunks[TASKS];
+    Task tasks[TASKS];
+    for (int i = 0; i < TASKS; i++) {
+        initChunk(&chunks[i]);
+        writeChunk(&chunks[i], OP_ONE, 1);
+        writeChunk(&chunks[i], OP_RESULT, 1);
+        writeChunk(&chunks[i], INTERPRET_OK, 1);
+        writeChunk(&chunks[i], OP_ZERO, 1);
+        writeChunk(&chunks[i], OP_RETURN, 1);
+        initTask(&tasks[i], &chunks[i]);
+    }
+
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    vm.outputFormat = OUTPUT_RAW;
+    vm.outputFile = file;
+    runTasks(tasks, TASKS, 4, 1);
+    flushOutput();
+    vm.outputFormat = OUTPUT_TEXT;
+    vm.outputFile = stdout;
+
+    assert_int_equal(ftell(file), TASKS * sizeof(Value));
+    rewind(file);
+    for (int i = 0; i < TASKS; i++) {
+        Value value = 0;
+        assert_int_equal(fread(&value, sizeof(value), 1, file), 1);
+        assert_float_equal(value, 1, 0);
+        assert_int_equal(tasks[i].status, INTERPRET_OK);
+        freeChunk(&chunks[i]);
+    }
+    fclose(file);
+}
+
+int main(void) {
+    initVM();
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_yields_and_resumes),
+        cmocka_unit_test(test_runs_tasks_on_threads),
+        cmocka_unit_test(test_small_tasks_overtake_big_one),
+        cmocka_unit_test(test_unlimited_slice_runs_in_order),
+        cmocka_unit_test(test_caller_keeps_its_fuel),
+        cmocka_unit_test(test_workers_write_results),
+    };
+    int failures = cmocka_run_group_tests(tests, NULL, NULL);
+    freeVM();
+    return failures;
+}
@@ -0,0 +1,122 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <cmocka.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "server.h"
+#include "vm.h"
+
+static char path[64];
+
+static void pause_for(long milliseconds) {
+    struct timespec time = {milliseconds / 1000,
+                            milliseconds % 1000 * 1000000};
+    nanosleep(&time, NULL);
+}
+
+static int connect_to_server(void) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    // The server may not be listening yet.
+    for (int attempt = 0; attempt < 500; attempt++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        assert_true(fd >= 0);
+        if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+            return fd;
+        }
+        close(fd);
+        pause_for(10);
+    }
+    fail_msg("Could not connect to %s", path);
+    return -1;
+}
+
+static void put_uint32(char *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out[i] = (char)(value >> (8 * i));
+}
+
+// Sends "1 + 2" as request id and waits for its record.
+static void round_trip(int fd, uint32_t id) {
+    char request[REQUEST_HEADER + 5];
+    put_uint32(request, id);
+    put_uint32(request + 4, 5);
+    memcpy(request + REQUEST_HEADER, "1 + 2", 5);
+    assert_int_equal(write(fd, request, sizeof(request)), sizeof(request));
+
+    char record[RECORD_SIZE];
+    size_t got = 0;
+    while (got < sizeof(record)) {
+        ssize_t bytes = read(fd, record + got, sizeof(record) - got);
+        assert_true(bytes > 0);
+        got += (size_t)bytes;
+    }
+    uint32_t index = (uint8_t)record[0] | (uint8_t)record[1] << 8 |
+                     (uint8_t)record[2] << 16 |
+                     (uint32_t)(uint8_t)record[3] << 24;
+    assert_int_equal(index, id);
+    Value value;
+    memcpy(&value, record + 8, sizeof(value));
+    assert_float_equal(value, 3, 0);
+}
+
+static double cpu_seconds(struct rusage *usage) {
+    return (double)(usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) +
+           (double)(usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) /
+               1e6;
+}
+
+// With every slot taken the server sleeps rather than spinning on the
+// listener, and takes the next connection once a slot frees up.
+static void test_full_server_waits(void **state) {
+    (void) state;
+    snprintf(path, sizeof(path), "/tmp/clox-test-%d.sock", (int)getpid());
+    pid_t child = fork();
+    assert_true(child >= 0);
+    if (child == 0) {
+        initVM();
+        _exit(runServer(path, NULL) ? 0 : 1);
+    }
+
+    int clients[MAX_CLIENTS];
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        clients[i] = connect_to_server();
+        round_trip(clients[i], (uint32_t)i);
+    }
+    int extra = connect_to_server();
+    pause_for(300);
+
+    close(clients[0]);
+    round_trip(extra, MAX_CLIENTS);
+
+    kill(child, SIGTERM);
+    int status;
+    assert_int_equal(waitpid(child, &status, 0), child);
+    assert_true(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    assert_true(cpu_seconds(&usage) < 0.15);
+
+    close(extra);
+    for (int i = 1; i < MAX_CLIENTS; i++) close(clients[i]);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_full_server_waits),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,170 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <cmocka.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "shmcache.h"
+#include "vm.h"
+
+static char name[64];
+
+// Two mappings of one segment, as two processes would have.
+static SharedCache first;
+static SharedCache second;
+
+static int setup_segment(void **state) {
+    (void) state;
+    snprintf(name, sizeof(name), "/clox-test-%d", (int)getpid());
+    removeSharedCache(name);
+    initVM();
+    assert_true(openSharedCache(&first, name));
+    assert_true(openSharedCache(&second, name));
+    return 0;
+}
+
+static int teardown_segment(void **state) {
+    (void) state;
+    closeSharedCache(&first);
+    closeSharedCache(&second);
+    removeSharedCache(name);
+    freeVM();
+    return 0;
+}
+
+static Value run_shared(SharedCache *cache, const char *source) {
+    SharedChunk shared;
+    assert_true(acquireSharedChunk(cache, source, strlen(source), &shared));
+    Value value;
+    assert_int_equal(runChunk(&shared.chunk, &value), INTERPRET_OK);
+    releaseSharedChunk(&shared);
+    return value;
+}
+
+static bool inside(SharedCache *cache, const void *pointer) {
+    const char *start = (const char *)cache->header;
+    return (const char *)pointer >= start &&
+           (const char *)pointer < start + cache->size;
+}
+
+static void test_other_mapping_runs_chunk_in_place(void **state) {
+    (void) state;
+    assert_float_equal(run_shared(&first, "(1 + 2) * -4"), -12.0, 0);
+    assert_int_equal(first.misses, 1);
+
+    SharedChunk shared;
+    assert_true(acquireSharedChunk(&second, "(1 + 2) * -4", 12, &shared));
+    assert_int_equal(second.hits, 1);
+    assert_int_equal(second.misses, 0);
+    assert_true(inside(&second, shared.chunk.code));
+    assert_true(inside(&second, shared.chunk.constants.values));
+    Value value;
+    assert_int_equal(runChunk(&shared.chunk, &value), INTERPRET_OK);
+    assert_float_equal(value, -12.0, 0);
+    releaseSharedChunk(&shared);
+}
+
+static void test_compile_errors_are_not_shared(void **state) {
+    (void) state;
+    SharedChunk shared;
+    assert_false(acquireSharedChunk(&first, "1 +", 3, &shared));
+    assert_false(acquireSharedChunk(&second, "1 +", 3, &shared));
+    assert_int_equal(second.misses, 1);
+}
+
+static void test_large_chunk_is_private(void **state) {
+    (void) state;
+    static char source[8192];
+    int length = 0;
+    for (int i = 0; i < 250; i++) {
+        length += sprintf(source + length, i == 0 ? "%d" : " + %d", i);
+    }
+
+    SharedChunk shared;
+    assert_true(acquireSharedChunk(&first, source, (size_t)length,
+                                   &shared));
+    assert_null(shared.slot);
+    Value value;
+    assert_int_equal(runChunk(&shared.chunk, &value), INTERPRET_OK);
+    assert_float_equal(value, 249 * 250 / 2, 0);
+    releaseSharedChunk(&shared);
+}
+
+static void test_pinned_chunk_survives_eviction(void **state) {
+    (void) state;
+    SharedChunk pinned;
+    assert_true(acquireSharedChunk(&first, "7 * 6", 5, &pinned));
+    assert_non_null(pinned.slot);
+
+    // Far more sources than slots, from the other mapping.
+    char source[32];
+    for (int i = 0; i < 20000; i++) {
+        snprintf(source, sizeof(source), "%d + 0.25", i);
+        assert_float_equal(run_shared(&second, source), i + 0.25, 0);
+    }
+
+    Value value;
+    assert_int_equal(runChunk(&pinned.chunk, &value), INTERPRET_OK);
+    assert_float_equal(value, 42.0, 0);
+    releaseSharedChunk(&pinned);
+}
+
+static void test_recently_used_chunk_stays(void **state) {
+    (void) state;
+    char source[32];
+    run_shared(&first, "1 + 1");
+    for (int i = 0; i < 20000; i++) {
+        run_shared(&first, "1 + 1");
+        snprintf(source, sizeof(source), "%d - 0.5", i);
+        run_shared(&first, source);
+    }
+
+    uint64_t misses = second.misses;
+    assert_float_equal(run_shared(&second, "1 + 1"), 2.0, 0);
+    assert_int_equal(second.misses, misses);
+}
+
+static void test_child_process_reuses_compile(void **state) {
+    (void) state;
+    run_shared(&first, "2 / 8");
+
+    pid_t child = fork();
+    if (child == 0) {
+        SharedCache cache;
+        if (!openSharedCache(&cache, name)) _exit(2);
+        SharedChunk shared;
+        if (!acquireSharedChunk(&cache, "2 / 8", 5, &shared)) _exit(3);
+        Value value;
+        runChunk(&shared.chunk, &value);
+        _exit(cache.misses == 0 && value == 0.25 ? 0 : 1);
+    }
+
+    int status;
+    assert_int_equal(waitpid(child, &status, 0), child);
+    assert_true(WIFEXITED(status));
+    assert_int_equal(WEXITSTATUS(status), 0);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(
+            test_other_mapping_runs_chunk_in_place,
+            setup_segment, teardown_segment),
+        cmocka_unit_test_setup_teardown(test_compile_errors_are_not_shared,
+                                        setup_segment, teardown_segment),
+        cmocka_unit_test_setup_teardown(test_large_chunk_is_private,
+                                        setup_segment, teardown_segment),
+        cmocka_unit_test_setup_teardown(test_pinned_chunk_survives_eviction,
+                                        setup_segment, teardown_segment),
+        cmocka_unit_test_setup_teardown(test_recently_used_chunk_stays,
+                                        setup_segment, teardown_segment),
+        cmocka_unit_test_setup_teardown(test_child_process_reuses_compile,
+                                        setup_segment, teardown_segment),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
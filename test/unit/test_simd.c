@@ -0,0 +1,81 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <cmocka.h>
+#include "simd.h"
+
+#define BUFFER_SIZE 4096
+
+static const char alphabet[] = " \t\r\n/_09azAZ.+\"\x80";
+
+static void fillRandom(char *buffer, int length, unsigned seed) {
+    srand(seed);
+    for (int i = 0; i < length; i++) {
+        // Long runs of one class so the vector loops actually run.
+        char c = alphabet[rand() % (sizeof(alphabet) - 1)];
+        int run = rand() % 80;
+        for (int j = 0; j < run && i < length; j++, i++) buffer[i] = c;
+        if (i < length) buffer[i] = c;
+    }
+}
+
+static void test_levels_agree_with_scalar(void **state) {
+    (void) state;
+    char *buffer = malloc(BUFFER_SIZE);
+    const char *end = buffer + BUFFER_SIZE;
+
+    for (unsigned seed = 1; seed <= 50; seed++) {
+        fillRandom(buffer, BUFFER_SIZE, seed);
+
+        for (int start = 0; start < BUFFER_SIZE; start += 7) {
+            const char *p = buffer + start;
+            useSimd(SIMD_SCALAR);
+            int scalarLines = 0;
+            const char *blanks = simd.skipBlanks(p, end, &scalarLines);
+            const char *newline = simd.skipToNewline(p, end);
+            const char *digits = simd.skipDigits(p, end);
+            const char *ident = simd.skipIdentifier(p, end);
+
+            for (int level = SIMD_SSE2; level <= SIMD_AVX2; level++) {
+                if (!useSimd((SimdLevel)level)) continue;
+                int lines = 0;
+                assert_ptr_equal(simd.skipBlanks(p, end, &lines), blanks);
+                assert_int_equal(lines, scalarLines);
+                assert_ptr_equal(simd.skipToNewline(p, end), newline);
+                assert_ptr_equal(simd.skipDigits(p, end), digits);
+                assert_ptr_equal(simd.skipIdentifier(p, end), ident);
+            }
+        }
+    }
+
+    useSimd(detectSimd());
+    free(buffer);
+}
+
+static void test_blank_run_counts_newlines(void **state) {
+    (void) state;
+    char buffer[100];
+    for (int i = 0; i < 99; i++) buffer[i] = i % 3 == 0 ? '\n' : ' ';
+    buffer[99] = 'x';
+
+    int lines = 0;
+    const char *stop = simd.skipBlanks(buffer, buffer + 100, &lines);
+    assert_ptr_equal(stop, buffer + 99);
+    assert_int_equal(lines, 33);
+}
+
+static void test_unsupported_level_is_refused(void **state) {
+    (void) state;
+    if (detectSimd() == SIMD_AVX2) return;
+    assert_false(useSimd(SIMD_AVX2));
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_levels_agree_with_scalar),
+        cmocka_unit_test(test_blank_run_counts_newlines),
+        cmocka_unit_test(test_unsupported_level_is_refused),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,138 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tokens.h"
+
+static const char *source =
+    "(1.5 + abc) // comment\n"
+    "\"multi\nline\" @ while\n"
+    "\n"
+    "  42 \"unterminated\n";
+
+static void test_scan_all_matches_scan_token(void **state) {
+    (void) state;
+    TokenArray tokens;
+    assert_true(scanAll(source, strlen(source), &tokens));
+
+    initScanner(source);
+    for (int i = 0; i < tokens.count; i++) {
+        Token expected = scanToken();
+        Token actual = tokenAt(&tokens, i);
+        assert_int_equal(actual.type, expected.type);
+        assert_int_equal(actual.length, expected.length);
+        assert_int_equal(actual.line, expected.line);
+        assert_true(memcmp(actual.start, expected.start,
+                           expected.length) == 0);
+    }
+    assert_int_equal(tokens.types[tokens.count - 1], TOKEN_EOF);
+
+    freeTokenArray(&tokens);
+}
+
+static void test_token_at_rewinds_line_count(void **state) {
+    (void) state;
+    TokenArray tokens;
+    assert_true(scanAll("1\n2\n3", 5, &tokens));
+
+    assert_int_equal(tokenAt(&tokens, 2).line, 3);
+    assert_int_equal(tokenAt(&tokens, 0).line, 1);
+    assert_int_equal(tokenAt(&tokens, 1).line, 2);
+
+    freeTokenArray(&tokens);
+}
+
+static void test_token_at_past_end_is_eof(void **state) {
+    (void) state;
+    TokenArray tokens;
+    assert_true(scanAll("1", 1, &tokens));
+
+    assert_int_equal(tokens.count, 2);
+    assert_int_equal(tokenAt(&tokens, 5).type, TOKEN_EOF);
+
+    freeTokenArray(&tokens);
+}
+
+static void test_error_token_keeps_message(void **state) {
+    (void) state;
+    TokenArray tokens;
+    assert_true(scanAll("@", 1, &tokens));
+
+    Token token = tokenAt(&tokens, 0);
+    assert_int_equal(token.type, TOKEN_ERROR);
+    assert_string_equal(token.start, "Unexpected character.");
+
+    freeTokenArray(&tokens);
+}
+
+static char *makeLargeSource(size_t *length) {
+    size_t capacity = 6 * 1024 * 1024;
+    char *source = malloc(capacity);
+    size_t used = 0;
+    int line = 0;
+    while (used < capacity - 1024) {
+        const char *piece;
+        if (line % 40000 == 39999) {
+            // Opens a string that runs across many lines and so across
+            // segment boundaries.
+            piece = "\"open\n";
+        } else if (line % 40000 == 20000) {
+            piece = "close\" 7\n";
+        } else if (line % 5000 == 17) {
+            piece = "@ 1.5\n";
+        } else {
+            piece = "12 + abc // comment \"\n";
+        }
+        size_t pieceLength = strlen(piece);
+        memcpy(source + used, piece, pieceLength);
+        used += pieceLength;
+        line++;
+    }
+    memcpy(source + used, "\"left open\n", 11);
+    used += 11;
+    *length = used;
+    return source;
+}
+
+static void test_parallel_scan_matches_serial(void **state) {
+    (void) state;
+    size_t length;
+    char *source = makeLargeSource(&length);
+
+    TokenArray serial;
+    assert_true(scanAll(source, length, &serial));
+
+    for (int threads = 2; threads <= 5; threads++) {
+        TokenArray parallel;
+        assert_true(scanAllParallel(source, length, &parallel, threads));
+        assert_int_equal(parallel.count, serial.count);
+        assert_memory_equal(parallel.types, serial.types, serial.count);
+        assert_memory_equal(parallel.starts, serial.starts,
+                            sizeof(uint32_t) * serial.count);
+
+        for (int i = 0; i < serial.count; i++) {
+            if (serial.types[i] != TOKEN_ERROR) continue;
+            assert_string_equal(tokenAt(&parallel, i).start,
+                                tokenAt(&serial, i).start);
+        }
+        assert_int_equal(tokenAt(&parallel, parallel.count - 1).line,
+                         tokenAt(&serial, serial.count - 1).line);
+        freeTokenArray(&parallel);
+    }
+
+    freeTokenArray(&serial);
+    free(source);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_scan_all_matches_scan_token),
+        cmocka_unit_test(test_token_at_rewinds_line_count),
+        cmocka_unit_test(test_token_at_past_end_is_eof),
+        cmocka_unit_test(test_error_token_keeps_message),
+        cmocka_unit_test(test_parallel_scan_matches_serial),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
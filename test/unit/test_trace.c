@@ -0,0 +1,98 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmocka.h>
+#include <string.h>
+#include "trace.h"
+
+static char *trace_output(void) {
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    writeTrace(file);
+    long length = ftell(file);
+    rewind(file);
+    char *buffer = malloc((size_t)length + 1);
+    assert_non_null(buffer);
+    size_t read = fread(buffer, 1, (size_t)length, file);
+    buffer[read] = '\0';
+    fclose(file);
+    return buffer;
+}
+
+static int count_occurrences(const char *text, const char *needle) {
+    int count = 0;
+    for (const char *p = strstr(text, needle); p != NULL;
+         p = strstr(p + 1, needle)) {
+        count++;
+    }
+    return count;
+}
+
+static void test_nested_spans_end_inner_first(void **state) {
+    (void) state;
+    startTrace();
+    traceBegin("statement", 7);
+    traceBegin("compile", -1);
+    traceEnd();
+    traceBegin("run", -1);
+    traceEnd();
+    traceEnd();
+
+    char *json = trace_output();
+    assert_int_equal(strncmp(json, "{\"displayTimeUnit\":\"ns\","
+                                   "\"traceEvents\":[", 39), 0);
+    const char *compile = strstr(json, "\"name\":\"compile\"");
+    const char *run = strstr(json, "\"name\":\"run\"");
+    const char *statement = strstr(json, "\"name\":\"statement\"");
+    assert_non_null(compile);
+    assert_non_null(run);
+    assert_non_null(statement);
+    assert_true(compile < run && run < statement);
+    assert_non_null(strstr(statement, "\"args\":{\"item\":7}"));
+    assert_int_equal(count_occurrences(json, "\"args\""), 1);
+    assert_int_equal(count_occurrences(json, "\"ph\":\"X\""), 3);
+    free(json);
+}
+
+static void test_unmatched_end_is_ignored(void **state) {
+    (void) state;
+    startTrace();
+    traceEnd();
+    traceBegin("load", -1);
+    traceEnd();
+    traceEnd();
+
+    char *json = trace_output();
+    assert_int_equal(count_occurrences(json, "\"ph\":\"X\""), 1);
+    free(json);
+}
+
+static void test_ring_keeps_latest_spans(void **state) {
+    (void) state;
+    startTrace();
+    for (int i = 0; i < TRACE_EVENTS + 10; i++) {
+        traceBegin("statement", i);
+        traceEnd();
+    }
+
+    char *json = trace_output();
+    assert_int_equal(count_occurrences(json, "\"ph\":\"X\""), TRACE_EVENTS);
+    assert_null(strstr(json, "\"item\":9}"));
+    assert_non_null(strstr(json, "\"item\":10}"));
+    char last[64];
+    sprintf(last, "\"item\":%d}", TRACE_EVENTS + 9);
+    assert_non_null(strstr(json, last));
+    free(json);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_nested_spans_end_inner_first),
+        cmocka_unit_test(test_unmatched_end_is_ignored),
+        cmocka_unit_test(test_ring_keeps_latest_spans),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
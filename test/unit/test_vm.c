@@ -2,8 +2,12 @@
 #include <stddef.h>
 #include <setjmp.h>
 #include <cmocka.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include "vm.h"
 #include "chunk.h"
+#include "compiler.h"
 
 static int setup_vm(void **state) {
     initVM();
@@ -14,6 +18,9 @@ static int setup_vm(void **state) {
 static int teardown_vm(void **state) {
     (void) state;
     freeVM();
+    predecodeChunks = false;
+    compilerOptions.cse = false;
+    compilerOptions.fastMath = false;
     return 0;
 }
 
@@ -93,6 +100,254 @@ static void test_vm_complex_expression(void **state) {
     assert_int_equal(result, INTERPRET_OK);
 }
 
+// Runs source with results going to a temporary file and reads back
+// what was written.
+static size_t capture_output(OutputFormat format, const char *source,
+                             unsigned char *bytes, size_t size) {
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    vm.outputFormat = format;
+    vm.outputFile = file;
+
+    interpret(source);
+    rewind(file);
+    size_t length = fread(bytes, 1, size, file);
+
+    vm.outputFile = stdout;
+    fclose(file);
+    return length;
+}
+
+static uint64_t read_little_endian(const unsigned char *bytes, int size) {
+    uint64_t value = 0;
+    for (int i = size - 1; i >= 0; i--) value = value << 8 | bytes[i];
+    return value;
+}
+
+static double read_double(const unsigned char *bytes) {
+    uint64_t bits = read_little_endian(bytes, 8);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void test_text_output(void **state) {
+    (void) state;
+    unsigned char bytes[64];
+    size_t length = capture_output(OUTPUT_TEXT, "0.1 + 0.2", bytes,
+                                   sizeof(bytes));
+    assert_int_equal(length, 20);
+    assert_memory_equal(bytes, "0.30000000000000004\n", 20);
+}
+
+static void test_raw_output(void **state) {
+    (void) state;
+    unsigned char bytes[64];
+    size_t length = capture_output(OUTPUT_RAW, "(1 + 2) / 4", bytes,
+                                   sizeof(bytes));
+    assert_int_equal(length, 8);
+    assert_true(read_double(bytes) == 0.75);
+}
+
+static void test_framed_output(void **state) {
+    (void) state;
+    unsigned char bytes[64];
+    capture_output(OUTPUT_FRAMED, "1 + 2", bytes, sizeof(bytes));
+    size_t length = capture_output(OUTPUT_FRAMED, "1 +", bytes,
+                                   sizeof(bytes));
+    assert_int_equal(length, 16);
+    assert_int_equal(read_little_endian(bytes, 4), 1);
+    assert_int_equal(read_little_endian(bytes + 4, 4),
+                     INTERPRET_COMPILE_ERROR);
+    assert_true(read_double(bytes + 8) != read_double(bytes + 8));
+}
+
+static void test_append_reuses_chunk(void **state) {
+    (void) state;
+    Chunk chunk;
+    initChunk(&chunk);
+
+    assert_int_equal(interpretAppend(&chunk, "1.5 + 2\n", 8, NULL),
+                     INTERPRET_OK);
+    int firstCount = chunk.count;
+    assert_int_equal(interpretAppend(&chunk, "3.5 * 4\n", 8, NULL),
+                     INTERPRET_OK);
+    assert_int_equal(chunk.count, firstCount * 2);
+    assert_int_equal(chunk.constants.count, 4);
+
+    // A line that fails to compile leaves nothing behind.
+    assert_int_equal(interpretAppend(&chunk, "3 *\n", 4, NULL),
+                     INTERPRET_COMPILE_ERROR);
+    assert_int_equal(chunk.count, firstCount * 2);
+    assert_int_equal(chunk.constants.count, 4);
+
+    freeChunk(&chunk);
+}
+
+static void test_append_starts_over_before_constants_run_out(void **state) {
+    (void) state;
+    unsigned char bytes[64];
+    Chunk chunk;
+    initChunk(&chunk);
+
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    vm.outputFile = file;
+    for (int i = 0; i < 300; i++) {
+        assert_int_equal(interpretAppend(&chunk, "1 + 2", 5, NULL),
+                         INTERPRET_OK);
+        assert_true(chunk.constants.count <= 256);
+    }
+    int capacity = chunk.capacity;
+    assert_int_equal(interpretAppend(&chunk, "4 + 2", 5, NULL),
+                     INTERPRET_OK);
+    assert_int_equal(chunk.capacity, capacity);
+
+    fseek(file, -2, SEEK_END);
+    assert_int_equal(fread(bytes, 1, 2, file), 2);
+    assert_memory_equal(bytes, "6\n", 2);
+    vm.outputFile = stdout;
+    fclose(file);
+    freeChunk(&chunk);
+}
+
+static void test_append_long_line(void **state) {
+    (void) state;
+    static char source[6000];
+    int length = 0;
+    for (int i = 0; i < 200; i++) {
+        length += sprintf(source + length, i == 0 ? "%d" : " + %d", i);
+    }
+    Chunk chunk;
+    initChunk(&chunk);
+    InterpretTimes times;
+    assert_int_equal(interpretAppend(&chunk, source, (size_t)length,
+                                     &times),
+                     INTERPRET_OK);
+    assert_true(times.compile >= 0 && times.run >= 0);
+    freeChunk(&chunk);
+}
+
+// Every opcode, including the fused and temp ones, gives the same bits
+// decoded as it does from the bytecode.
+static void test_decoded_matches_bytecode(void **state) {
+    (void) state;
+    const char *sources[] = {
+        "0 - 1 * 127 + -200 / 3.5",
+        "-(0.1 * 0.1 - 0.01) + 0.3 * 0.7 + 2",
+        "(1 + 2) * (3 - 4) + (1 + 2) * (3 - 4) / (1 + 2) * (3 - 4)",
+        "(0 / 0) * -1",
+    };
+    for (int mode = 0; mode < 3; mode++) {
+        compilerOptions.cse = mode == 1;
+        compilerOptions.fastMath = mode == 2;
+        for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]);
+             i++) {
+            Chunk chunk;
+            initChunk(&chunk);
+            assert_true(compile(sources[i], strlen(sources[i]), &chunk));
+            Value bytecode;
+            assert_int_equal(runChunk(&chunk, &bytecode), INTERPRET_OK);
+
+            DecodedChunk decoded;
+            initDecodedChunk(&decoded);
+            decodeChunk(&decoded, &chunk, 0);
+            Value value;
+            assert_int_equal(runDecoded(&decoded, &value), INTERPRET_OK);
+            assert_memory_equal(&bytecode, &value, sizeof(Value));
+
+            freeDecodedChunk(&decoded);
+            freeChunk(&chunk);
+        }
+    }
+}
+
+static void test_decoded_run_yields_to_bytecode(void **state) {
+    (void) state;
+    const char *source = "1.5 + 2 * 3 - 4 / 5";
+    Chunk chunk;
+    initChunk(&chunk);
+    assert_true(compile(source, strlen(source), &chunk));
+    DecodedChunk decoded;
+    initDecodedChunk(&decoded);
+    decodeChunk(&decoded, &chunk, 0);
+    assert_true(decoded.count < chunk.count);
+
+    Value value;
+    vm.fuel = 3;
+    assert_int_equal(runDecoded(&decoded, &value), INTERPRET_YIELD);
+    assert_ptr_equal(vm.ip, chunk.code + decoded.offsets[3]);
+    assert_int_equal(vm.stackTop - vm.stack, 2);
+
+    vm.fuel = FUEL_UNLIMITED;
+    assert_int_equal(resumeVM(&value), INTERPRET_OK);
+    assert_float_equal(value, 6.7, 0);
+
+    freeDecodedChunk(&decoded);
+    freeChunk(&chunk);
+}
+
+// interpretAppend() decodes only the statement it just compiled.
+static void test_predecode_runs_appended_code(void **state) {
+    (void) state;
+    predecodeChunks = true;
+    Chunk chunk;
+    initChunk(&chunk);
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    vm.outputFile = file;
+
+    assert_int_equal(interpretAppend(&chunk, "1.5 + 2\n", 8, NULL),
+                     INTERPRET_OK);
+    assert_int_equal(interpretAppend(&chunk, "3.5 * -4\n", 9, NULL),
+                     INTERPRET_OK);
+    assert_ptr_equal(vm.decoded.chunk, &chunk);
+    assert_int_equal(vm.decoded.offsets[0], 5);
+
+    char bytes[16];
+    rewind(file);
+    size_t length = fread(bytes, 1, sizeof(bytes), file);
+    assert_int_equal(length, 8);
+    assert_memory_equal(bytes, "3.5\n-14\n", 8);
+    vm.outputFile = stdout;
+    fclose(file);
+    freeChunk(&chunk);
+}
+
+// Each statement gets its record, in order, from inside one run.
+static void test_batch_writes_every_result(void **state) {
+    (void) state;
+    const char *source = "(1.5 + 2) * (1.5 + 2); 1 +;\n3 * 4 - 3 * 4";
+    for (int mode = 0; mode < 3; mode++) {
+        compilerOptions.cse = mode == 1;
+        predecodeChunks = mode == 2;
+        FILE *file = tmpfile();
+        assert_non_null(file);
+        vm.outputFormat = OUTPUT_FRAMED;
+        vm.outputFile = file;
+        vm.resultIndex = 0;
+
+        assert_int_equal(interpretBatch(source, strlen(source)),
+                         INTERPRET_COMPILE_ERROR);
+        unsigned char bytes[64];
+        rewind(file);
+        size_t length = fread(bytes, 1, sizeof(bytes), file);
+        vm.outputFile = stdout;
+        fclose(file);
+
+        assert_int_equal(length, 3 * RECORD_SIZE);
+        assert_int_equal(read_little_endian(bytes + 4, 4), INTERPRET_OK);
+        assert_true(read_double(bytes + 8) == 12.25);
+        assert_int_equal(read_little_endian(bytes + 16, 4), 1);
+        assert_int_equal(read_little_endian(bytes + 20, 4),
+                         INTERPRET_COMPILE_ERROR);
+        assert_int_equal(read_little_endian(bytes + 32, 4), 2);
+        assert_true(read_double(bytes + 40) == 0);
+        // The stack is empty again after every statement.
+        assert_ptr_equal(vm.stackTop, vm.stack);
+    }
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test_setup_teardown(test_push_and_pop,
@@ -113,6 +368,28 @@ int main(void) {
                                          setup_vm, teardown_vm),
         cmocka_unit_test_setup_teardown(test_vm_complex_expression,
                                          setup_vm, teardown_vm),
+        cmocka_unit_test_setup_teardown(test_text_output,
+                                         setup_vm, teardown_vm),
+        cmocka_unit_test_setup_teardown(test_raw_output,
+                                         setup_vm, teardown_vm),
+        cmocka_unit_test_setup_teardown(test_framed_output,
+                                         setup_vm, teardown_vm),
+        cmocka_unit_test_setup_teardown(test_append_reuses_chunk,
+                                         setup_vm, teardown_vm),
+        cmocka_unit_test_setup_teardown(
+            test_append_starts_over_before_constants_run_out,
+            setup_vm, teardown_vm),
+        cmocka_unit_test_setup_teardown(test_decoded_matches_bytecode,
+                                         setup_vm, teardown_vm),
+        cmocka_unit_test_setup_teardown(
+            test_decoded_run_yields_to_bytecode,
+            setup_vm, teardown_vm),
+        cmocka_unit_test_setup_teardown(test_predecode_runs_appended_code,
+                                         setup_vm, teardown_vm),
+        cmocka_unit_test_setup_teardown(test_append_long_line,
+                                         setup_vm, teardown_vm),
+        cmocka_unit_test_setup_teardown(test_batch_writes_every_result,
+                                         setup_vm, teardown_vm),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
@@ -0,0 +1,139 @@
+#include <string.h>
+
+#include "memory.h"
+#include "simd.h"
+#include "tokens.h"
+
+void initTokenArray(TokenArray* array, const char* source) {
+  array->count = 0;
+  array->capacity = 0;
+  array->types = NULL;
+  array->starts = NULL;
+  array->lengths = NULL;
+  array->messageCount = 0;
+  array->messageCapacity = 0;
+  array->messages = NULL;
+  array->source = source;
+  array->lineOffset = 0;
+  array->line = 1;
+}
+
+void writeTokenArray(TokenArray* array, TokenType type,
+                     uint32_t start, uint32_t length) {
+  if (array->capacity < array->count + 1) {
+    int oldCapacity = array->capacity;
+    array->capacity = GROW_CAPACITY(oldCapacity);
+    array->types = GROW_ARRAY(uint8_t, array->types,
+                              oldCapacity, array->capacity);
+    array->starts = GROW_ARRAY(uint32_t, array->starts,
+                               oldCapacity, array->capacity);
+    array->lengths = GROW_ARRAY(uint32_t, array->lengths,
+                                oldCapacity, array->capacity);
+  }
+
+  array->types[array->count] = (uint8_t)type;
+  array->starts[array->count] = start;
+  array->lengths[array->count] = length;
+  array->count++;
+}
+
+static uint32_t addMessage(TokenArray* array, const char* message) {
+  if (array->messageCapacity < array->messageCount + 1) {
+    int oldCapacity = array->messageCapacity;
+    array->messageCapacity = GROW_CAPACITY(oldCapacity);
+    array->messages = GROW_ARRAY(const char*, array->messages,
+                                 oldCapacity, array->messageCapacity);
+  }
+
+  array->messages[array->messageCount] = message;
+  return (uint32_t)array->messageCount++;
+}
+
+void writeErrorToken(TokenArray* array, uint32_t start,
+                     const char* message) {
+  writeTokenArray(array, TOKEN_ERROR, start,
+                  addMessage(array, message));
+}
+
+// Appends all of other's tokens, which must be over the same source.
+void appendTokenArray(TokenArray* array, TokenArray* other) {
+  int count = array->count + other->count;
+  if (array->capacity < count) {
+    int oldCapacity = array->capacity;
+    while (array->capacity < count) {
+      array->capacity = GROW_CAPACITY(array->capacity);
+    }
+    array->types = GROW_ARRAY(uint8_t, array->types,
+                              oldCapacity, array->capacity);
+    array->starts = GROW_ARRAY(uint32_t, array->starts,
+                               oldCapacity, array->capacity);
+    array->lengths = GROW_ARRAY(uint32_t, array->lengths,
+                                oldCapacity, array->capacity);
+  }
+
+  int base = array->count;
+  memcpy(array->types + base, other->types, other->count);
+  memcpy(array->starts + base, other->starts,
+         sizeof(uint32_t) * other->count);
+  memcpy(array->lengths + base, other->lengths,
+         sizeof(uint32_t) * other->count);
+  array->count = count;
+
+  // Error tokens index other's messages; move them over.
+  uint8_t* types = array->types + base;
+  uint8_t* end = array->types + count;
+  while ((types = memchr(types, TOKEN_ERROR, end - types)) != NULL) {
+    uint32_t* length = &array->lengths[types - array->types];
+    *length = addMessage(array, other->messages[*length]);
+    types++;
+  }
+}
+
+void freeTokenArray(TokenArray* array) {
+  FREE_ARRAY(uint8_t, array->types, array->capacity);
+  FREE_ARRAY(uint32_t, array->starts, array->capacity);
+  FREE_ARRAY(uint32_t, array->lengths, array->capacity);
+  FREE_ARRAY(const char*, array->messages, array->messageCapacity);
+  initTokenArray(array, array->source);
+}
+
+// The scanner stamps a token with the line it is on when the token
+// ends, so count newlines up to the token's last byte.
+static int lineAt(TokenArray* array, uint32_t offset) {
+  if (offset < array->lineOffset) {
+    array->lineOffset = 0;
+    array->line = 1;
+  }
+
+  const char* p = array->source + array->lineOffset;
+  const char* end = array->source + offset;
+  for (;;) {
+    p = simd.skipToNewline(p, end);
+    if (p == end) break;
+    array->line++;
+    p++;
+  }
+
+  array->lineOffset = offset;
+  return array->line;
+}
+
+Token tokenAt(TokenArray* array, int index) {
+  // Reading past the end keeps returning the final EOF token.
+  if (index >= array->count) index = array->count - 1;
+
+  Token token;
+  token.type = (TokenType)array->types[index];
+  uint32_t start = array->starts[index];
+
+  if (token.type == TOKEN_ERROR) {
+    token.start = array->messages[array->lengths[index]];
+    token.length = (int)strlen(token.start);
+    token.line = lineAt(array, start);
+  } else {
+    token.start = array->source + start;
+    token.length = (int)array->lengths[index];
+    token.line = lineAt(array, start + array->lengths[index]);
+  }
+  return token;
+}
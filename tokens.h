@@ -0,0 +1,41 @@
+#ifndef clox_tokens_h
+#define clox_tokens_h
+
+#include "common.h"
+#include "scanner.h"
+
+// A whole source lexed up front, one array per field so the parser
+// walks dense bytes instead of 24-byte Tokens. Offsets are relative to
+// source. An error token's length indexes messages instead. Lines are
+// not stored; tokenAt() counts newlines forward from the last token it
+// was asked about.
+typedef struct {
+  int count;
+  int capacity;
+  uint8_t* types;
+  uint32_t* starts;
+  uint32_t* lengths;
+
+  int messageCount;
+  int messageCapacity;
+  const char** messages;
+
+  const char* source;
+  uint32_t lineOffset;
+  int line;
+} TokenArray;
+
+void initTokenArray(TokenArray* array, const char* source);
+void writeTokenArray(TokenArray* array, TokenType type,
+                     uint32_t start, uint32_t length);
+void writeErrorToken(TokenArray* array, uint32_t start,
+                     const char* message);
+void appendTokenArray(TokenArray* array, TokenArray* other);
+void freeTokenArray(TokenArray* array);
+Token tokenAt(TokenArray* array, int index);
+
+bool scanAll(const char* source, size_t length, TokenArray* tokens);
+bool scanAllParallel(const char* source, size_t length,
+                     TokenArray* tokens, int threads);
+
+#endif
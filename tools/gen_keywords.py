@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""
+Generates keywords.h, the perfect hash scanner.c uses to recognize
+keywords.
+
+The hash of an identifier is
+
+    (first * A + last * B + length) & (SIZE - 1)
+
+for its first and last characters. This script searches for A and B
+that give every keyword its own slot and writes the table. Rerun it
+after adding a keyword:
+
+    python3 tools/gen_keywords.py > keywords.h
+"""
+
+import sys
+
+KEYWORDS = [
+    ("and", "TOKEN_AND"), ("class", "TOKEN_CLASS"),
+    ("else", "TOKEN_ELSE"), ("false", "TOKEN_FALSE"),
+    ("for", "TOKEN_FOR"), ("fun", "TOKEN_FUN"),
+    ("if", "TOKEN_IF"), ("nil", "TOKEN_NIL"),
+    ("or", "TOKEN_OR"), ("print", "TOKEN_PRINT"),
+    ("return", "TOKEN_RETURN"), ("super", "TOKEN_SUPER"),
+    ("this", "TOKEN_THIS"), ("true", "TOKEN_TRUE"),
+    ("var", "TOKEN_VAR"), ("while", "TOKEN_WHILE"),
+]
+
+
+def slot(word, a, b, size):
+    return (ord(word[0]) * a + ord(word[-1]) * b + len(word)) & (size - 1)
+
+
+def search():
+    size = 16
+    while size <= 1024:
+        for a in range(1, 64):
+            for b in range(0, 64):
+                slots = {slot(w, a, b, size) for w, _ in KEYWORDS}
+                if len(slots) == len(KEYWORDS):
+                    return size, a, b
+        size *= 2
+    sys.exit("no perfect hash found")
+
+
+def main():
+    size, a, b = search()
+    table = [None] * size
+    for word, token in KEYWORDS:
+        table[slot(word, a, b, size)] = (word, token)
+
+    longest = max(len(w) for w, _ in KEYWORDS)
+    print("// Generated by tools/gen_keywords.py. Do not edit.")
+    print()
+    print("#ifndef clox_keywords_h")
+    print("#define clox_keywords_h")
+    print()
+    print("#include <string.h>")
+    print()
+    print('#include "scanner.h"')
+    print()
+    print(f"#define KEYWORD_HASH_SIZE {size}")
+    print(f"#define KEYWORD_MAX_LENGTH {longest}")
+    print()
+    print("#define KEYWORD_HASH(first, last, length) \\")
+    print(f"    (((unsigned)(unsigned char)(first) * {a}u + \\")
+    print(f"      (unsigned)(unsigned char)(last) * {b}u + \\")
+    print(f"      (unsigned)(length)) & {size - 1}u)")
+    print()
+    print("typedef struct {")
+    print("  const char* name;")
+    print("  int length;")
+    print("  TokenType type;")
+    print("} Keyword;")
+    print()
+    print("static const Keyword keywords[KEYWORD_HASH_SIZE] = {")
+    for i, entry in enumerate(table):
+        if entry is None:
+            print(f"  [{i}] = {{\"\", 0, TOKEN_IDENTIFIER}},")
+        else:
+            word, token = entry
+            print(f"  [{i}] = {{\"{word}\", {len(word)}, {token}}},")
+    print("};")
+    print()
+    print("// Empty slots have length 0, which no identifier has.")
+    print("static inline TokenType lookupKeyword(const char* start,")
+    print("                                      int length) {")
+    print("  if (length > KEYWORD_MAX_LENGTH) return TOKEN_IDENTIFIER;")
+    print()
+    print("  const Keyword* keyword = &keywords[")
+    print("      KEYWORD_HASH(start[0], start[length - 1], length)];")
+    print("  if (keyword->length == length &&")
+    print("      memcmp(start, keyword->name, length) == 0) {")
+    print("    return keyword->type;")
+    print("  }")
+    print("  return TOKEN_IDENTIFIER;")
+    print("}")
+    print()
+    print("#endif")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+"""
+Generates pow10.h, the table of 126-bit powers of ten dtoa.c uses to
+find the shortest decimal for a double (Schubfach).
+
+Entry k - POW10_MIN holds g = floor(10^-k * 2^(125 - r)) + 1 for
+r = floor(log2(10^-k)), so 2^125 < g < 2^126, split into its high and
+low 63 bits.
+
+    python3 tools/gen_pow10.py > pow10.h
+"""
+
+from fractions import Fraction
+
+SMALLEST = -324
+LARGEST = 292
+
+
+def floor_log2(value):
+    # value is a positive Fraction.
+    r = value.numerator.bit_length() - value.denominator.bit_length()
+    while Fraction(2) ** r > value:
+        r -= 1
+    while Fraction(2) ** (r + 1) <= value:
+        r += 1
+    return r
+
+
+def entry(k):
+    power = Fraction(10) ** -k
+    r = floor_log2(power)
+    assert r == (-k * 913124641741) >> 38
+    g = int(power * Fraction(2) ** (125 - r)) + 1
+    assert (1 << 125) < g < (1 << 126)
+    return g
+
+
+def main():
+    mask = (1 << 63) - 1
+    print("// Generated by tools/gen_pow10.py. Do not edit.")
+    print()
+    print("#ifndef clox_pow10_h")
+    print("#define clox_pow10_h")
+    print()
+    print('#include "common.h"')
+    print()
+    print(f"#define POW10_MIN ({SMALLEST})")
+    print(f"#define POW10_MAX {LARGEST}")
+    print()
+    print("static const uint64_t pow10[][2] = {")
+    for k in range(SMALLEST, LARGEST + 1):
+        g = entry(k)
+        print(f"  {{0x{g >> 63:016x}u, 0x{g & mask:016x}u}},  // 10^{-k}")
+    print("};")
+    print()
+    print("#endif")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+"""
+Generates pow5.h, the 128-bit powers of five number.c uses to turn a
+decimal significand and exponent into a double (Eisel-Lemire).
+
+Entry q - POW5_MIN holds 5^q for q in [-342, 308], shifted so its top
+bit is set, as a high and a low 64-bit word. Positive powers are
+truncated to 128 bits; negative powers are the reciprocal rounded up.
+
+    python3 tools/gen_pow5.py > pow5.h
+"""
+
+SMALLEST = -342
+LARGEST = 308
+
+
+def entry(q):
+    if q >= 0:
+        power5 = 5 ** q
+        while power5 < (1 << 127):
+            power5 *= 2
+        while power5 >= (1 << 128):
+            power5 //= 2
+        return power5
+
+    power5 = 5 ** -q
+    z = power5.bit_length()
+    if q >= -27:
+        b = z + 127
+        c = 2 ** b // power5 + 1
+    else:
+        b = 2 * z + 2 * 64
+        c = 2 ** b // power5 + 1
+        while c >= (1 << 128):
+            c //= 2
+    return c
+
+
+def main():
+    print("// Generated by tools/gen_pow5.py. Do not edit.")
+    print()
+    print("#ifndef clox_pow5_h")
+    print("#define clox_pow5_h")
+    print()
+    print('#include "common.h"')
+    print()
+    print(f"#define POW5_MIN ({SMALLEST})")
+    print(f"#define POW5_MAX {LARGEST}")
+    print()
+    print("static const uint64_t pow5[][2] = {")
+    for q in range(SMALLEST, LARGEST + 1):
+        value = entry(q)
+        high = value >> 64
+        low = value & ((1 << 64) - 1)
+        print(f"  {{0x{high:016x}u, 0x{low:016x}u}},  // 5^{q}")
+    print("};")
+    print()
+    print("#endif")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,85 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "trace.h"
+
+// The last TRACE_EVENTS spans, oldest overwritten first. Spans are
+// stored when they end, so a nested one comes before its parent; the
+// viewer sorts them out by time. Only the main thread records.
+typedef struct {
+  TraceSpan* spans;
+  uint64_t count;
+  uint64_t epoch;
+  int depth;
+  // Open spans. Ones nested deeper than TRACE_DEPTH are dropped.
+  const char* names[TRACE_DEPTH];
+  int64_t items[TRACE_DEPTH];
+  uint64_t starts[TRACE_DEPTH];
+} Trace;
+
+static Trace trace;
+
+static uint64_t nanoseconds() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+
+// Until this is called, traceBegin() and traceEnd() do nothing.
+void startTrace() {
+  if (trace.spans == NULL) {
+    trace.spans = GROW_ARRAY(TraceSpan, NULL, 0, TRACE_EVENTS);
+  }
+  trace.count = 0;
+  trace.depth = 0;
+  trace.epoch = nanoseconds();
+}
+
+void traceBegin(const char* name, int64_t item) {
+  if (trace.spans == NULL) return;
+  if (trace.depth < TRACE_DEPTH) {
+    trace.names[trace.depth] = name;
+    trace.items[trace.depth] = item;
+    trace.starts[trace.depth] = nanoseconds();
+  }
+  trace.depth++;
+}
+
+void traceEnd() {
+  if (trace.spans == NULL || trace.depth == 0) return;
+  trace.depth--;
+  if (trace.depth >= TRACE_DEPTH) return;
+
+  TraceSpan* span = &trace.spans[trace.count++ % TRACE_EVENTS];
+  span->name = trace.names[trace.depth];
+  span->item = trace.items[trace.depth];
+  span->start = trace.starts[trace.depth];
+  span->end = nanoseconds();
+}
+
+// Writes the spans as Chrome trace-event JSON, complete ("X") events
+// with microsecond times, for chrome://tracing or Perfetto.
+void writeTrace(FILE* out) {
+  if (trace.spans == NULL) return;
+
+  uint64_t first = trace.count > TRACE_EVENTS
+                   ? trace.count - TRACE_EVENTS : 0;
+  long pid = (long)getpid();
+  fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  for (uint64_t i = first; i < trace.count; i++) {
+    TraceSpan* span = &trace.spans[i % TRACE_EVENTS];
+    fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%ld,"
+            "\"tid\":1,\"ts\":%.3f,\"dur\":%.3f",
+            i == first ? "" : ",", span->name, pid,
+            (double)(span->start - trace.epoch) / 1000.0,
+            (double)(span->end - span->start) / 1000.0);
+    if (span->item >= 0) {
+      fprintf(out, ",\"args\":{\"item\":%lld}", (long long)span->item);
+    }
+    fprintf(out, "}");
+  }
+  fprintf(out, "\n]}\n");
+}
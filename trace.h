@@ -0,0 +1,37 @@
+#ifndef clox_trace_h
+#define clox_trace_h
+
+#include <stdio.h>
+
+#include "common.h"
+
+#define TRACE_EVENTS 65536
+#define TRACE_DEPTH 16
+
+// A finished span. item is the statement or request it belongs to in
+// batch modes, or -1.
+typedef struct {
+  const char* name;
+  int64_t item;
+  uint64_t start;
+  uint64_t end;
+} TraceSpan;
+
+void startTrace();
+void traceBegin(const char* name, int64_t item);
+void traceEnd();
+void writeTrace(FILE* out);
+
+// Phase boundaries. Spans are only recorded in builds with
+// TRACE_PHASES (make TRACE=1); otherwise these expand to nothing.
+#ifdef TRACE_PHASES
+#define TRACE_BEGIN(name) traceBegin(name, -1)
+#define TRACE_BEGIN_ITEM(name, item) traceBegin(name, (int64_t)(item))
+#define TRACE_END() traceEnd()
+#else
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_BEGIN_ITEM(name, item) ((void)0)
+#define TRACE_END() ((void)0)
+#endif
+
+#endif
@@ -26,6 +26,19 @@ void freeValueArray(ValueArray* array) {
   initValueArray(array);
 }
 
+NumberFormat numberFormat = NUMBER_SHORTEST;
+
+// Writes value and a '\0' into buffer, which must hold
+// VALUE_BUFFER_SIZE bytes, and returns the length.
+int formatValue(Value value, char* buffer) {
+  if (numberFormat == NUMBER_G) {
+    return snprintf(buffer, VALUE_BUFFER_SIZE, "%g", value);
+  }
+  return formatDouble(value, buffer);
+}
+
 void printValue(Value value) {
-  printf("%g", value);
+  char buffer[VALUE_BUFFER_SIZE];
+  int length = formatValue(value, buffer);
+  fwrite(buffer, 1, (size_t)length, stdout);
 }
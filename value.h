@@ -2,9 +2,21 @@
 #define clox_value_h
 
 #include "common.h"
+#include "dtoa.h"
 
 typedef double Value;
 
+typedef enum {
+  NUMBER_SHORTEST,
+  NUMBER_G,
+} NumberFormat;
+
+// How printValue() and formatValue() spell numbers: the shortest
+// decimal that reads back exactly, or printf("%g").
+extern NumberFormat numberFormat;
+
+#define VALUE_BUFFER_SIZE DTOA_BUFFER_SIZE
+
 typedef struct {
   int capacity;
   int count;
@@ -15,6 +27,7 @@ void initValueArray(ValueArray* array);
 void writeValueArray(ValueArray* array, Value value);
 void freeValueArray(ValueArray* array);
 
+int formatValue(Value value, char* buffer);
 void printValue(Value value);
 
 #endif
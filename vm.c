@@ -1,11 +1,24 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
+#include "aot.h"
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "memo.h"
+#include "memory.h"
+#include "perf.h"
+#include "profiler.h"
+#include "scanner.h"
+#include "trace.h"
 #include "vm.h"
 
-VM vm;
+_Thread_local VM vm;
+bool predecodeChunks = false;
 
 static void resetStack() {
   vm.stackTop = vm.stack;
@@ -13,9 +26,80 @@ static void resetStack() {
 
 void initVM() {
   resetStack();
+  vm.fuel = FUEL_UNLIMITED;
+  initDecodedChunk(&vm.decoded);
+  vm.outputFormat = OUTPUT_TEXT;
+  vm.outputFile = stdout;
+  vm.resultIndex = 0;
+  vm.outputLength = 0;
 }
 
 void freeVM() {
+  flushOutput();
+  freeDecodedChunk(&vm.decoded);
+}
+
+// Results are formatted straight into vm.output and handed to stdio a
+// block at a time, so a batch of a million expressions costs a few
+// dozen locked writes instead of two per result.
+void flushOutput() {
+  if (vm.outputLength == 0) return;
+  TRACE_BEGIN("output");
+  fwrite(vm.output, 1, (size_t)vm.outputLength, vm.outputFile);
+  fflush(vm.outputFile);
+  vm.outputLength = 0;
+  TRACE_END();
+}
+
+static char* writeUint32(char* out, uint32_t value) {
+  for (int i = 0; i < 4; i++) out[i] = (char)(value >> (8 * i));
+  return out + 4;
+}
+
+static char* writeDouble(char* out, double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  for (int i = 0; i < 8; i++) out[i] = (char)(bits >> (8 * i));
+  return out + 8;
+}
+
+// Writes the RECORD_SIZE bytes of a framed result and returns the end.
+char* encodeRecord(char* out, uint32_t index, InterpretResult status,
+                   Value value) {
+  out = writeUint32(out, index);
+  out = writeUint32(out, (uint32_t)status);
+  return writeDouble(out, status == INTERPRET_OK ? value : NAN);
+}
+
+// Every statement gets a result, even one that failed to compile, so
+// the binary formats stay aligned with the input.
+static void writeResult(InterpretResult status, Value value) {
+  TRACE_BEGIN("format");
+  if (OUTPUT_MAX - vm.outputLength < VALUE_BUFFER_SIZE) flushOutput();
+
+  char* out = vm.output + vm.outputLength;
+  switch (vm.outputFormat) {
+    case OUTPUT_TEXT:
+      if (status == INTERPRET_OK) {
+        out += formatValue(value, out);
+        *out++ = '\n';
+      }
+      break;
+    case OUTPUT_RAW:
+      out = writeDouble(out, status == INTERPRET_OK ? value : NAN);
+      break;
+    case OUTPUT_FRAMED:
+      out = encodeRecord(out, vm.resultIndex, status, value);
+      break;
+  }
+  vm.outputLength = (int)(out - vm.output);
+  vm.resultIndex++;
+  TRACE_END();
+
+#if defined(DEBUG_PRINT_CODE) || defined(DEBUG_TRACE_EXECUTION)
+  // Keep results in order with the disassembly and traces.
+  flushOutput();
+#endif
 }
 
 void push(Value value) {
@@ -28,7 +112,20 @@ Value pop() {
   return *vm.stackTop;
 }
 
-static InterpretResult run() {
+#ifdef DEBUG_TRACE_EXECUTION
+static void traceInstruction(Chunk* chunk, Value* stackTop, int offset) {
+  printf("          ");
+  for (Value* slot = vm.stack; slot < stackTop; slot++) {
+    printf("[ ");
+    printValue(*slot);
+    printf(" ]");
+  }
+  printf("\n");
+  disassembleInstruction(chunk, offset);
+}
+#endif
+
+static InterpretResult run(Value* result) {
 #define READ_BYTE() (*vm.ip++)
 #define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
 #define BINARY_OP(op) \
@@ -37,18 +134,34 @@ static InterpretResult run() {
       double a = pop(); \
       push(a op b); \
     } while (false)
+#define BINARY_CONSTANT_OP(op) \
+    do { \
+      double b = READ_CONSTANT(); \
+      vm.stackTop[-1] = vm.stackTop[-1] op b; \
+    } while (false)
+#define FUSED_OP(sign) \
+    do { \
+      double c = pop(); \
+      double b = pop(); \
+      vm.stackTop[-1] = fma(vm.stackTop[-1], b, sign c); \
+    } while (false)
 
+  profileSite.chunk = vm.chunk;
   for (;;) {
-#ifdef DEBUG_TRACE_EXECUTION
-    printf("          ");
-    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-      printf("[ ");
-      printValue(*slot);
-      printf(" ]");
+    // With no jumps or calls yet, every instruction is checked. Once
+    // there are, only backward branches and returns need to be.
+    if (--vm.fuel < 0) {
+      vm.fuel = 0;
+      profileSite.ip = NULL;
+      return INTERPRET_YIELD;
     }
-    printf("\n");
-    disassembleInstruction(vm.chunk,
-                           (int)(vm.ip - vm.chunk->code));
+    // One store per instruction, so a SIGPROF sample always sees the
+    // instruction being run even if ip is kept in a register.
+    profileSite.ip = vm.ip;
+
+#ifdef DEBUG_TRACE_EXECUTION
+    traceInstruction(vm.chunk, vm.stackTop,
+                     (int)(vm.ip - vm.chunk->code));
 #endif
 
     uint8_t instruction;
@@ -58,14 +171,30 @@ static InterpretResult run() {
         push(constant);
         break;
       }
+      case OP_ZERO:      push(0); break;
+      case OP_ONE:       push(1); break;
+      case OP_SMALL_INT: push((int8_t)READ_BYTE()); break;
       case OP_ADD:      BINARY_OP(+); break;
       case OP_SUBTRACT: BINARY_OP(-); break;
       case OP_MULTIPLY: BINARY_OP(*); break;
       case OP_DIVIDE:   BINARY_OP(/); break;
+      case OP_ADD_CONSTANT:      BINARY_CONSTANT_OP(+); break;
+      case OP_SUBTRACT_CONSTANT: BINARY_CONSTANT_OP(-); break;
+      case OP_MULTIPLY_CONSTANT: BINARY_CONSTANT_OP(*); break;
+      case OP_DIVIDE_CONSTANT:   BINARY_CONSTANT_OP(/); break;
+      case OP_MULTIPLY_ADD:      FUSED_OP(+); break;
+      case OP_MULTIPLY_SUBTRACT: FUSED_OP(-); break;
       case OP_NEGATE:   push(-pop()); break;
+      case OP_GET_TEMP: push(vm.stack[READ_BYTE()]); break;
+      case OP_RESULT: {
+        InterpretResult status = (InterpretResult)READ_BYTE();
+        writeResult(status, status == INTERPRET_OK ? pop() : 0);
+        resetStack();
+        break;
+      }
       case OP_RETURN: {
-        printValue(pop());
-        printf("\n");
+        *result = pop();
+        profileSite.ip = NULL;
         return INTERPRET_OK;
       }
     }
@@ -74,22 +203,448 @@ static InterpretResult run() {
 #undef READ_BYTE
 #undef READ_CONSTANT
 #undef BINARY_OP
+#undef BINARY_CONSTANT_OP
+#undef FUSED_OP
+}
+
+void initDecodedChunk(DecodedChunk* decoded) {
+  decoded->chunk = NULL;
+  decoded->code = NULL;
+  decoded->offsets = NULL;
+  decoded->count = 0;
+  decoded->capacity = 0;
+}
+
+void freeDecodedChunk(DecodedChunk* decoded) {
+  FREE_ARRAY(DecodedInstruction, decoded->code, decoded->capacity);
+  FREE_ARRAY(int, decoded->offsets, decoded->capacity);
+  initDecodedChunk(decoded);
+}
+
+// Handler addresses by opcode. They are labels inside execute(), which
+// hands them out when called without a chunk.
+static _Thread_local const void* const* handlers = NULL;
+
+static InterpretResult execute(DecodedChunk* decoded, Value* result);
+
+// Translates chunk from offset to its end, one DecodedInstruction per
+// instruction. The memory in decoded is kept for the next chunk.
+void decodeChunk(DecodedChunk* decoded, Chunk* chunk, int offset) {
+  if (handlers == NULL) execute(NULL, NULL);
+
+  // Every instruction is at least a byte long.
+  int needed = chunk->count - offset;
+  if (decoded->capacity < needed) {
+    int oldCapacity = decoded->capacity;
+    int capacity = oldCapacity;
+    while (capacity < needed) capacity = GROW_CAPACITY(capacity);
+    decoded->code = GROW_ARRAY(DecodedInstruction, decoded->code,
+                               oldCapacity, capacity);
+    decoded->offsets = GROW_ARRAY(int, decoded->offsets,
+                                  oldCapacity, capacity);
+    decoded->capacity = capacity;
+  }
+
+  decoded->chunk = chunk;
+  decoded->count = 0;
+  uint8_t* code = chunk->code;
+  Value* constants = chunk->constants.values;
+  while (offset < chunk->count) {
+    uint8_t op = code[offset];
+    DecodedInstruction* instruction = &decoded->code[decoded->count];
+    decoded->offsets[decoded->count++] = offset;
+    instruction->handler = handlers[op];
+
+    switch (op) {
+      case OP_CONSTANT:
+      case OP_ADD_CONSTANT:
+      case OP_SUBTRACT_CONSTANT:
+      case OP_MULTIPLY_CONSTANT:
+      case OP_DIVIDE_CONSTANT:
+        instruction->as.value = constants[code[offset + 1]];
+        offset += 2;
+        break;
+      case OP_ZERO:
+        instruction->as.value = 0;
+        offset++;
+        break;
+      case OP_ONE:
+        instruction->as.value = 1;
+        offset++;
+        break;
+      case OP_SMALL_INT:
+        instruction->as.value = (int8_t)code[offset + 1];
+        offset += 2;
+        break;
+      case OP_GET_TEMP:
+      case OP_RESULT:
+        instruction->as.slot = code[offset + 1];
+        offset += 2;
+        break;
+      default:
+        offset++;
+        break;
+    }
+  }
+}
+
+// The loop behind runDecoded(). Each handler jumps straight to the
+// next one through its resolved address, with the stack top and fuel
+// in locals, and every literal pushes the same way whatever opcode it
+// was. Fuel is kept as in run(). The profiler's site gets pc, which
+// its handler maps back to the bytecode, so dispatch doesn't have to.
+static InterpretResult execute(DecodedChunk* decoded, Value* result) {
+  static const void* const table[] = {
+    [OP_CONSTANT] = &&push,
+    [OP_ZERO] = &&push,
+    [OP_ONE] = &&push,
+    [OP_SMALL_INT] = &&push,
+    [OP_ADD] = &&add,
+    [OP_SUBTRACT] = &&subtract,
+    [OP_MULTIPLY] = &&multiply,
+    [OP_DIVIDE] = &&divide,
+    [OP_ADD_CONSTANT] = &&addConstant,
+    [OP_SUBTRACT_CONSTANT] = &&subtractConstant,
+    [OP_MULTIPLY_CONSTANT] = &&multiplyConstant,
+    [OP_DIVIDE_CONSTANT] = &&divideConstant,
+    [OP_MULTIPLY_ADD] = &&multiplyAdd,
+    [OP_MULTIPLY_SUBTRACT] = &&multiplySubtract,
+    [OP_NEGATE] = &&negate,
+    [OP_GET_TEMP] = &&getTemp,
+    [OP_RESULT] = &&writeOut,
+    [OP_RETURN] = &&ret,
+  };
+  if (decoded == NULL) {
+    handlers = table;
+    return INTERPRET_OK;
+  }
+
+  Chunk* chunk = decoded->chunk;
+  DecodedInstruction* code = decoded->code;
+  int* offsets = decoded->offsets;
+  DecodedInstruction* pc = code;
+  Value* sp = vm.stackTop;
+  int64_t fuel = vm.fuel;
+  profileSite.decoded = decoded;
+
+#ifdef DEBUG_TRACE_EXECUTION
+#define TRACE_DECODED() \
+    traceInstruction(chunk, sp, offsets[pc - code])
+#else
+#define TRACE_DECODED() do {} while (false)
+#endif
+#define DISPATCH() \
+    do { \
+      if (--fuel < 0) goto yield; \
+      profileSite.pc = pc; \
+      TRACE_DECODED(); \
+      goto *pc->handler; \
+    } while (false)
+#define NEXT() \
+    do { \
+      pc++; \
+      DISPATCH(); \
+    } while (false)
+#define BINARY_OP(op) \
+    do { \
+      sp[-2] = sp[-2] op sp[-1]; \
+      sp--; \
+      NEXT(); \
+    } while (false)
+#define BINARY_CONSTANT_OP(op) \
+    do { \
+      sp[-1] = sp[-1] op pc->as.value; \
+      NEXT(); \
+    } while (false)
+#define FUSED_OP(sign) \
+    do { \
+      sp[-3] = fma(sp[-3], sp[-2], sign sp[-1]); \
+      sp -= 2; \
+      NEXT(); \
+    } while (false)
+
+  DISPATCH();
+
+push:             *sp++ = pc->as.value; NEXT();
+add:              BINARY_OP(+);
+subtract:         BINARY_OP(-);
+multiply:         BINARY_OP(*);
+divide:           BINARY_OP(/);
+addConstant:      BINARY_CONSTANT_OP(+);
+subtractConstant: BINARY_CONSTANT_OP(-);
+multiplyConstant: BINARY_CONSTANT_OP(*);
+divideConstant:   BINARY_CONSTANT_OP(/);
+multiplyAdd:      FUSED_OP(+);
+multiplySubtract: FUSED_OP(-);
+negate:           sp[-1] = -sp[-1]; NEXT();
+getTemp:          *sp++ = vm.stack[pc->as.slot]; NEXT();
+writeOut:
+  writeResult((InterpretResult)pc->as.slot,
+              pc->as.slot == INTERPRET_OK ? sp[-1] : 0);
+  sp = vm.stack;
+  NEXT();
+ret:
+  *result = *--sp;
+  vm.stackTop = sp;
+  vm.fuel = fuel;
+  profileSite.pc = NULL;
+  return INTERPRET_OK;
+
+yield:
+  // Hand the rest to run(), which resumeVM() continues with.
+  vm.fuel = 0;
+  vm.chunk = chunk;
+  vm.ip = chunk->code + offsets[pc - code];
+  vm.stackTop = sp;
+  profileSite.pc = NULL;
+  return INTERPRET_YIELD;
+
+#undef TRACE_DECODED
+#undef DISPATCH
+#undef NEXT
+#undef BINARY_OP
+#undef BINARY_CONSTANT_OP
+#undef FUSED_OP
+}
+
+// Runs what decodeChunk() produced on an empty stack, with the same
+// results, fuel and yields as running the chunk itself.
+InterpretResult runDecoded(DecodedChunk* decoded, Value* result) {
+  resetStack();
+  return execute(decoded, result);
+}
+
+static InterpretResult runChunkFrom(Chunk* chunk, int offset,
+                                    Value* result) {
+  vm.chunk = chunk;
+  vm.ip = chunk->code + offset;
+  resetStack();
+  if (predecodeChunks) {
+    decodeChunk(&vm.decoded, chunk, offset);
+    return runDecoded(&vm.decoded, result);
+  }
+  return run(result);
+}
+
+// Runs a compiled chunk and hands back its value instead of writing
+// it out. If vm.fuel runs out first, returns INTERPRET_YIELD with the
+// VM stopped before the next instruction.
+InterpretResult runChunk(Chunk* chunk, Value* result) {
+  return runChunkFrom(chunk, 0, result);
+}
+
+// Continues a run that yielded, once vm.fuel has been topped up.
+InterpretResult resumeVM(Value* result) {
+  return run(result);
+}
+
+void saveVM(VMState* state) {
+  state->chunk = vm.chunk;
+  state->ip = (int)(vm.ip - vm.chunk->code);
+  state->stackCount = (int)(vm.stackTop - vm.stack);
+  memcpy(state->stack, vm.stack, sizeof(Value) * state->stackCount);
+}
+
+void restoreVM(const VMState* state) {
+  vm.chunk = state->chunk;
+  vm.ip = state->chunk->code + state->ip;
+  memcpy(vm.stack, state->stack, sizeof(Value) * state->stackCount);
+  vm.stackTop = vm.stack + state->stackCount;
 }
 
 InterpretResult interpret(const char* source) {
+  return interpretRange(source, strlen(source));
+}
+
+// With memoizeResults set, a source whose result is cached isn't
+// compiled or run at all. With nativeCacheDir set, a source that was
+// built before runs its native function without even being compiled,
+// and one that wasn't is built on the way. If that fails it is
+// interpreted after all.
+InterpretResult interpretRange(const char* source, size_t length) {
+  ResultKey key;
+  Value value;
+  if (memoizeResults) {
+    resultKey(source, length, &key);
+    if (findResult(&key, &value)) {
+      writeResult(INTERPRET_OK, value);
+      flushOutput();
+      return INTERPRET_OK;
+    }
+  }
+
   Chunk chunk;
   initChunk(&chunk);
 
-  if (!compile(source, &chunk)) {
+  NativeFunction native = NULL;
+  if (nativeCacheDir != NULL) native = loadNative(source, length, NULL);
+
+  if (native == NULL) {
+    if (!compile(source, length, &chunk)) {
+      freeChunk(&chunk);
+      writeResult(INTERPRET_COMPILE_ERROR, 0);
+      flushOutput();
+      return INTERPRET_COMPILE_ERROR;
+    }
+    if (nativeCacheDir != NULL) {
+      native = loadNative(source, length, &chunk);
+      if (native == NULL) {
+        fprintf(stderr, "Could not build native code in %s; "
+                "interpreting instead.\n", nativeCacheDir);
+      }
+    }
+  }
+
+  InterpretResult result = INTERPRET_OK;
+  TRACE_BEGIN("run");
+  perfBegin(PERF_RUN);
+  if (native != NULL) {
+    value = native();
+  } else {
+    result = runChunk(&chunk, &value);
+  }
+  perfEnd(PERF_RUN);
+  TRACE_END();
+  writeResult(result, value);
+
+  // A native function found without compiling leaves no chunk to vet.
+  if (memoizeResults && result == INTERPRET_OK && chunk.count > 0) {
+    storeResult(&key, &chunk, value);
+  }
+  freeChunk(&chunk);
+  flushOutput();
+  return result;
+}
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// An upper bound on the constants source can add: one per run of
+// digits.
+static int maxConstants(const char* source, size_t length) {
+  int runs = 0;
+  bool inDigits = false;
+  for (size_t i = 0; i < length; i++) {
+    bool digit = source[i] >= '0' && source[i] <= '9';
+    if (digit && !inDigits) runs++;
+    inDigits = digit;
+  }
+  return runs;
+}
+
+// Compiles source onto the end of chunk and runs only the new code, so
+// the REPL keeps one chunk, and its memory, for a whole session. The
+// chunk starts over when the line might not fit in what's left of the
+// 256 constants, and code from a line that fails to compile is
+// dropped. If times isn't NULL, it gets how long each half took.
+InterpretResult interpretAppend(Chunk* chunk, const char* source,
+                                size_t length, InterpretTimes* times) {
+  if (chunk->constants.count + maxConstants(source, length) >
+      UINT8_MAX + 1) {
+    truncateChunk(chunk, 0, 0);
+  }
+
+  TRACE_BEGIN_ITEM("statement", vm.resultIndex);
+  int start = chunk->count;
+  int startConstants = chunk->constants.count;
+  double started = times != NULL ? now() : 0;
+  bool compiled = compile(source, length, chunk);
+  double compiledAt = times != NULL ? now() : 0;
+
+  InterpretResult result = INTERPRET_COMPILE_ERROR;
+  Value value = 0;
+  if (compiled) {
+    TRACE_BEGIN("run");
+    perfBegin(PERF_RUN);
+    result = runChunkFrom(chunk, start, &value);
+    perfEnd(PERF_RUN);
+    TRACE_END();
+  } else {
+    truncateChunk(chunk, start, startConstants);
+  }
+  writeResult(result, value);
+  flushOutput();
+  TRACE_END();
+
+  if (times != NULL) {
+    times->compile = compiledAt - started;
+    times->run = now() - compiledAt;
+  }
+  return result;
+}
+
+// Compiles and runs each statement from the scanner in a chunk of
+// its own.
+static InterpretResult runStatements() {
+  InterpretResult result = INTERPRET_OK;
+  beginStatements();
+
+  while (!atEndOfStatements()) {
+    TRACE_BEGIN_ITEM("statement", vm.resultIndex);
+    Chunk chunk;
+    initChunk(&chunk);
+
+    if (compileStatement(&chunk)) {
+      Value value;
+      TRACE_BEGIN("run");
+      perfBegin(PERF_RUN);
+      InterpretResult status = runChunk(&chunk, &value);
+      perfEnd(PERF_RUN);
+      TRACE_END();
+      writeResult(status, value);
+      if (status == INTERPRET_RUNTIME_ERROR) {
+        result = INTERPRET_RUNTIME_ERROR;
+      }
+    } else {
+      writeResult(INTERPRET_COMPILE_ERROR, 0);
+      if (result == INTERPRET_OK) result = INTERPRET_COMPILE_ERROR;
+    }
+
     freeChunk(&chunk);
-    return INTERPRET_COMPILE_ERROR;
+    TRACE_END();
   }
+  return result;
+}
 
-  vm.chunk = &chunk;
-  vm.ip = vm.chunk->code;
+// Compiles and runs each statement as soon as it has been read, so
+// memory stays bounded by the scanner's windows however long the
+// stream is.
+InterpretResult interpretStream(int fd) {
+  initScannerStream(fd);
+  InterpretResult result = runStatements();
+  freeScanner();
+  flushOutput();
+  return result;
+}
 
-  InterpretResult result = run();
+// Compiles the statements in source into as few chunks as their
+// constants allow, and runs each chunk once: one pool, one dispatch
+// loop entry and one stack reset for all its statements, instead of
+// one each. Their OP_RESULTs write the results.
+InterpretResult interpretBatch(const char* source, size_t length) {
+  beginBatch(source, length);
+  InterpretResult result = INTERPRET_OK;
+  Chunk chunk;
+  initChunk(&chunk);
+  while (!atEndOfStatements()) {
+    truncateChunk(&chunk, 0, 0);
+    if (!compileBatch(&chunk) && result == INTERPRET_OK) {
+      result = INTERPRET_COMPILE_ERROR;
+    }
 
+    Value value;
+    TRACE_BEGIN("run");
+    perfBegin(PERF_RUN);
+    InterpretResult status = runChunk(&chunk, &value);
+    perfEnd(PERF_RUN);
+    TRACE_END();
+    // As in runStatements(), a failed run outranks a compile error.
+    if (status != INTERPRET_OK) result = status;
+  }
   freeChunk(&chunk);
+  flushOutput();
   return result;
 }
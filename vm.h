@@ -1,27 +1,115 @@
 #ifndef clox_vm_h
 #define clox_vm_h
 
+#include <stdio.h>
+
 #include "chunk.h"
 #include "value.h"
 
 #define STACK_MAX 256
+#define OUTPUT_MAX 65536
+#define RECORD_SIZE 16
+#define FUEL_UNLIMITED INT64_MAX
+
+// Text is one formatted number per line. Raw is each result as a
+// little-endian double, NaN for a statement that failed. Framed is a
+// 16-byte record per statement: its index and an InterpretResult as
+// little-endian uint32s, then the double.
+typedef enum {
+  OUTPUT_TEXT,
+  OUTPUT_RAW,
+  OUTPUT_FRAMED,
+} OutputFormat;
+
+// One bytecode instruction as runDecoded() sees it: the address of
+// its handler, and its literal, constant or slot already read out of
+// the chunk.
+typedef struct DecodedInstruction {
+  const void* handler;
+  union {
+    Value value;
+    int slot;
+  } as;
+} DecodedInstruction;
+
+// A chunk, from some offset on, translated for runDecoded(). The
+// chunk stays what gets cached, shared and disassembled; this is
+// rebuilt from it.
+typedef struct DecodedChunk {
+  Chunk* chunk;
+  DecodedInstruction* code;
+  // Where each instruction came from in chunk, for the profiler and
+  // for handing a run that yields back to run().
+  int* offsets;
+  int count;
+  int capacity;
+} DecodedChunk;
 
 typedef struct {
   Chunk* chunk;
   uint8_t* ip;
   Value stack[STACK_MAX];
   Value* stackTop;
+  // Instructions left before run() yields.
+  int64_t fuel;
+  // Where runChunk() decodes chunks when predecodeChunks is set.
+  DecodedChunk decoded;
+
+  // Results waiting to be written to outputFile.
+  OutputFormat outputFormat;
+  FILE* outputFile;
+  uint32_t resultIndex;
+  char output[OUTPUT_MAX];
+  int outputLength;
 } VM;
 
 typedef enum {
   INTERPRET_OK,
   INTERPRET_COMPILE_ERROR,
-  INTERPRET_RUNTIME_ERROR
+  INTERPRET_RUNTIME_ERROR,
+  // Out of fuel; resumeVM() carries on from where it stopped.
+  INTERPRET_YIELD,
 } InterpretResult;
 
+// Seconds spent compiling and running, for interpretAppend().
+typedef struct {
+  double compile;
+  double run;
+} InterpretTimes;
+
+// Where a run that yielded left off, so it can be picked up later,
+// possibly by another thread's VM.
+typedef struct {
+  Chunk* chunk;
+  int ip;
+  int stackCount;
+  Value stack[STACK_MAX];
+} VMState;
+
+// One per thread, so several chunks can run at once.
+extern _Thread_local VM vm;
+// Run chunks through runDecoded() instead of the bytecode loop.
+extern bool predecodeChunks;
+
 void initVM();
 void freeVM();
 InterpretResult interpret(const char* source);
+InterpretResult interpretRange(const char* source, size_t length);
+InterpretResult interpretStream(int fd);
+InterpretResult interpretBatch(const char* source, size_t length);
+InterpretResult interpretAppend(Chunk* chunk, const char* source,
+                                size_t length, InterpretTimes* times);
+void flushOutput();
+char* encodeRecord(char* out, uint32_t index, InterpretResult status,
+                   Value value);
+InterpretResult runChunk(Chunk* chunk, Value* result);
+InterpretResult resumeVM(Value* result);
+void initDecodedChunk(DecodedChunk* decoded);
+void freeDecodedChunk(DecodedChunk* decoded);
+void decodeChunk(DecodedChunk* decoded, Chunk* chunk, int offset);
+InterpretResult runDecoded(DecodedChunk* decoded, Value* result);
+void saveVM(VMState* state);
+void restoreVM(const VMState* state);
 void push(Value value);
 Value pop();
 